@@ -247,6 +247,192 @@ ConVar cv_pt_albedo =
     .desc = "Output path tracer albedo",
 };
 
+ConVar cv_pt_wavefront =
+{
+    .type = cvart_bool,
+    .name = "pt_wavefront",
+    .value = "1",
+    .desc = "Trace paths in batches of 16-wide ray packets; 0: trace one pixel at a time",
+};
+
+ConVar cv_pt_tile_size =
+{
+    .type = cvart_int,
+    .name = "pt_tile_size",
+    .value = "16",
+    .minInt = 8,
+    .maxInt = 256,
+    .desc = "Side length in pixels of the square tiles path tracing is scheduled in, visited in morton order",
+};
+
+ConVar cv_pt_adaptive =
+{
+    .type = cvart_float,
+    .name = "pt_adaptive",
+    .value = "0.01",
+    .minFloat = 0.0f,
+    .maxFloat = 1.0f,
+    .desc = "Target relative standard error per pixel; converged pixels are skipped, noisy ones get extra samples. 0: uniform sampling",
+};
+
+ConVar cv_pt_adaptive_max =
+{
+    .type = cvart_int,
+    .name = "pt_adaptive_max",
+    .value = "4",
+    .minInt = 1,
+    .maxInt = 64,
+    .desc = "Maximum samples per pixel per frame with adaptive sampling",
+};
+
+ConVar cv_pt_adaptive_revisit =
+{
+    .type = cvart_int,
+    .name = "pt_adaptive_revisit",
+    .value = "8",
+    .minInt = 1,
+    .maxInt = 256,
+    .desc = "Converged pixels still take a sample every this many frames, so late found light paths are not frozen out",
+};
+
+ConVar cv_pt_dynres =
+{
+    .type = cvart_bool,
+    .name = "pt_dynres",
+    .value = "1",
+    .desc = "Path trace at a reduced resolution while the camera moves",
+};
+
+ConVar cv_pt_dynres_ms =
+{
+    .type = cvart_float,
+    .name = "pt_dynres_ms",
+    .value = "33.3",
+    .minFloat = 1.0f,
+    .maxFloat = 1000.0f,
+    .desc = "Path tracing milliseconds per frame targeted by dynamic resolution",
+};
+
+ConVar cv_pt_reproject =
+{
+    .type = cvart_bool,
+    .name = "pt_reproject",
+    .value = "1",
+    .desc = "Reproject the path traced accumulation when the camera moves",
+};
+
+ConVar cv_pt_reproject_max =
+{
+    .type = cvart_int,
+    .name = "pt_reproject_max",
+    .value = "32",
+    .minInt = 1,
+    .maxInt = 1024,
+    .desc = "Maximum history length in samples kept by reprojection",
+};
+
+ConVar cv_pt_sampler =
+{
+    .type = cvart_int,
+    .name = "pt_sampler",
+    .value = "1",
+    .minInt = 0,
+    .maxInt = 1,
+    .desc = "Path tracer sample sequence; 0: independent randoms, 1: owen scrambled sobol",
+};
+
+ConVar cv_pt_light_select =
+{
+    .type = cvart_int,
+    .name = "pt_light_select",
+    .value = "1",
+    .minInt = 0,
+    .maxInt = 1,
+    .desc = "Path tracer light selection; 0: light grid of distributions, 1: light tree with orientation cones",
+};
+
+ConVar cv_pt_light_alias =
+{
+    .type = cvart_bool,
+    .name = "pt_light_alias",
+    .value = "1",
+    .desc = "Bake alias tables into the light grid for constant time light selection, applied on scene load",
+};
+
+ConVar cv_pt_cache =
+{
+    .type = cvart_bool,
+    .name = "pt_cache",
+    .value = "0",
+    .desc = "Terminate deep paths with a hash grid radiance cache, filled by the path tracer",
+};
+
+ConVar cv_pt_cache_bounce =
+{
+    .type = cvart_int,
+    .name = "pt_cache_bounce",
+    .value = "2",
+    .minInt = 1,
+    .maxInt = 16,
+    .desc = "Bounces before the radiance cache may terminate a path",
+};
+
+ConVar cv_pt_cache_meters =
+{
+    .type = cvart_float,
+    .name = "pt_cache_meters",
+    .value = "0.25",
+    .minFloat = 0.01f,
+    .maxFloat = 4.0f,
+    .desc = "Radiance cache meters per cell",
+};
+
+ConVar cv_pt_guide =
+{
+    .type = cvart_bool,
+    .name = "pt_guide",
+    .value = "0",
+    .desc = "Guide path continuation with learned spatio-directional distributions of incident light",
+};
+
+ConVar cv_pt_guide_meters =
+{
+    .type = cvart_float,
+    .name = "pt_guide_meters",
+    .value = "2",
+    .minFloat = 0.25f,
+    .maxFloat = 20.0f,
+    .desc = "Path guide meters per cell, applied when the guide is rebuilt",
+};
+
+ConVar cv_pt_media_bake =
+{
+    .type = cvart_bool,
+    .name = "pt_media_bake",
+    .value = "0",
+    .desc = "Bake the media noise into a 3D texture instead of evaluating it per sample",
+};
+
+ConVar cv_pt_media_voxel =
+{
+    .type = cvart_float,
+    .name = "pt_media_voxel",
+    .value = "0.25",
+    .minFloat = 0.05f,
+    .maxFloat = 4.0f,
+    .desc = "Meters per voxel of the baked media density",
+};
+
+ConVar cv_pt_light_samples =
+{
+    .type = cvart_int,
+    .name = "pt_light_samples",
+    .value = "1",
+    .minInt = 1,
+    .maxInt = 16,
+    .desc = "Light samples per direct lighting estimate, shadow rays are traced as one packet",
+};
+
 ConVar cv_r_refl_gen =
 {
     .type = cvart_bool,
@@ -570,6 +756,26 @@ void ConVars_RegisterAll(void)
     ConVar_Reg(&cv_pt_dist_meters);
     ConVar_Reg(&cv_pt_normal);
     ConVar_Reg(&cv_pt_trace);
+    ConVar_Reg(&cv_pt_wavefront);
+    ConVar_Reg(&cv_pt_tile_size);
+    ConVar_Reg(&cv_pt_adaptive);
+    ConVar_Reg(&cv_pt_adaptive_max);
+    ConVar_Reg(&cv_pt_adaptive_revisit);
+    ConVar_Reg(&cv_pt_dynres);
+    ConVar_Reg(&cv_pt_dynres_ms);
+    ConVar_Reg(&cv_pt_reproject);
+    ConVar_Reg(&cv_pt_reproject_max);
+    ConVar_Reg(&cv_pt_sampler);
+    ConVar_Reg(&cv_pt_light_select);
+    ConVar_Reg(&cv_pt_light_alias);
+    ConVar_Reg(&cv_pt_light_samples);
+    ConVar_Reg(&cv_pt_cache);
+    ConVar_Reg(&cv_pt_cache_bounce);
+    ConVar_Reg(&cv_pt_cache_meters);
+    ConVar_Reg(&cv_pt_guide);
+    ConVar_Reg(&cv_pt_guide_meters);
+    ConVar_Reg(&cv_pt_media_bake);
+    ConVar_Reg(&cv_pt_media_voxel);
     ConVar_Reg(&cv_r_fov);
     ConVar_Reg(&cv_r_height);
     ConVar_Reg(&cv_r_scale);
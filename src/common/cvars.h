@@ -31,6 +31,26 @@ extern ConVar cv_pt_trace;
 extern ConVar cv_pt_denoise;
 extern ConVar cv_pt_normal;
 extern ConVar cv_pt_albedo;
+extern ConVar cv_pt_wavefront;
+extern ConVar cv_pt_tile_size;
+extern ConVar cv_pt_adaptive;
+extern ConVar cv_pt_adaptive_max;
+extern ConVar cv_pt_adaptive_revisit;
+extern ConVar cv_pt_dynres;
+extern ConVar cv_pt_dynres_ms;
+extern ConVar cv_pt_reproject;
+extern ConVar cv_pt_reproject_max;
+extern ConVar cv_pt_sampler;
+extern ConVar cv_pt_light_select;
+extern ConVar cv_pt_light_alias;
+extern ConVar cv_pt_light_samples;
+extern ConVar cv_pt_cache;
+extern ConVar cv_pt_cache_bounce;
+extern ConVar cv_pt_cache_meters;
+extern ConVar cv_pt_guide;
+extern ConVar cv_pt_guide_meters;
+extern ConVar cv_pt_media_bake;
+extern ConVar cv_pt_media_voxel;
 
 extern ConVar cv_r_refl_gen;
 extern ConVar cv_r_sun_dir;
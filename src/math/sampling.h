@@ -70,6 +70,87 @@ pim_inline float2 VEC_CALL Hammersley2D(u32 i, u32 N)
     return c;
 }
 
+pim_inline u32 VEC_CALL ReverseBits32(u32 bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return bits;
+}
+
+// integer avalanche hash, for deriving seeds
+pim_inline u32 VEC_CALL HashU32(u32 x)
+{
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+// Practical Hash-based Owen Scrambling, Burley 2020
+// https://jcgt.org/published/0009/04/01/
+pim_inline u32 VEC_CALL LaineKarrasPermutation(u32 x, u32 seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+pim_inline u32 VEC_CALL NestedUniformScramble(u32 x, u32 seed)
+{
+    x = ReverseBits32(x);
+    x = LaineKarrasPermutation(x, seed);
+    x = ReverseBits32(x);
+    return x;
+}
+
+// second dimension of the sobol sequence; the first is ReverseBits32
+pim_inline u32 VEC_CALL SobolDim1(u32 index)
+{
+    u32 v = 1u << 31u;
+    u32 result = 0u;
+    while (index)
+    {
+        result ^= (index & 1u) ? v : 0u;
+        v ^= v >> 1u;
+        index >>= 1u;
+    }
+    return result;
+}
+
+// maps 32 random bits to [0, 1)
+pim_inline float VEC_CALL BitsToUnorm(u32 bits)
+{
+    return (float)(bits >> 8u) * 5.9604644775390625e-8f; // / 0x1000000
+}
+
+// owen scrambled sobol point, shuffled by seed
+pim_inline float VEC_CALL Sobol1D_Owen(u32 index, u32 seed)
+{
+    index = NestedUniformScramble(index, seed);
+    u32 x = ReverseBits32(index);
+    x = NestedUniformScramble(x, HashU32(seed));
+    return BitsToUnorm(x);
+}
+
+// owen scrambled 2D sobol point, shuffled by seed
+pim_inline float2 VEC_CALL Sobol2D_Owen(u32 index, u32 seed)
+{
+    index = NestedUniformScramble(index, seed);
+    u32 x = ReverseBits32(index);
+    u32 y = SobolDim1(index);
+    x = NestedUniformScramble(x, HashU32(seed ^ 0x2c1b3c6du));
+    y = NestedUniformScramble(y, HashU32(seed ^ 0x297a2d39u));
+    return f2_v(BitsToUnorm(x), BitsToUnorm(y));
+}
+
 // http://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/Importance_Sampling.html
 pim_inline float VEC_CALL PowerHeuristic(float f, float g)
 {
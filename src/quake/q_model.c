@@ -76,6 +76,31 @@ static bool LoadEntities(
     EAlloc allocator,
     dheader_t const *const header,
     mmodel_t* model);
+static bool LoadPlanes(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model);
+static bool LoadNodes(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model);
+static bool LoadLeafs(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model);
+static bool LoadVisibility(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model);
+static bool LoadWorldModel(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model);
 
 mmodel_t* LoadModel(
     const char* name,
@@ -117,6 +142,10 @@ void FreeModel(mmodel_t* model)
         }
         Mem_Free(model->textures);
         Mem_Free(model->entities);
+        Mem_Free(model->planes);
+        Mem_Free(model->nodes);
+        Mem_Free(model->leafs);
+        Mem_Free(model->visdata);
 
         memset(model, 0, sizeof(*model));
         Mem_Free(model);
@@ -145,6 +174,11 @@ static mmodel_t* LoadBrushModel(
     LoadTexInfo(buffer, allocator, header, model);
     LoadFaces(buffer, allocator, header, model);
     LoadEntities(buffer, allocator, header, model);
+    LoadPlanes(buffer, allocator, header, model);
+    LoadNodes(buffer, allocator, header, model);
+    LoadLeafs(buffer, allocator, header, model);
+    LoadVisibility(buffer, allocator, header, model);
+    LoadWorldModel(buffer, allocator, header, model);
 
     return model;
 }
@@ -496,3 +530,126 @@ static bool LoadEntities(
     return false;
 }
 
+
+static bool LoadPlanes(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model)
+{
+    lump_t lump = header->lumps[LUMP_PLANES];
+    dplane_t const *const pim_noalias src = OffsetPtr(buffer, lump.fileofs);
+    i32 count = 0;
+    if (CheckLump(model->name, "planes", lump, sizeof(src[0]), MAX_MAP_PLANES, &count))
+    {
+        mplane_t *const pim_noalias dst = Mem_Alloc(allocator, sizeof(dst[0]) * count);
+        model->planes = dst;
+        model->numplanes = count;
+        for (i32 i = 0; i < count; ++i)
+        {
+            dst[i].normal.x = src[i].normal[0];
+            dst[i].normal.y = src[i].normal[1];
+            dst[i].normal.z = src[i].normal[2];
+            dst[i].dist = src[i].dist;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool LoadNodes(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model)
+{
+    lump_t lump = header->lumps[LUMP_NODES];
+    dnode_t const *const pim_noalias src = OffsetPtr(buffer, lump.fileofs);
+    i32 count = 0;
+    if (CheckLump(model->name, "nodes", lump, sizeof(src[0]), MAX_MAP_NODES, &count))
+    {
+        mnode_t *const pim_noalias dst = Mem_Alloc(allocator, sizeof(dst[0]) * count);
+        model->nodes = dst;
+        model->numnodes = count;
+        const i32 numplanes = model->numplanes;
+        for (i32 i = 0; i < count; ++i)
+        {
+            dst[i].plane = i1_clamp(src[i].planenum, 0, i1_max(0, numplanes - 1));
+            for (i32 j = 0; j < 2; ++j)
+            {
+                // cyclic or out of range nodes collapse into the solid leaf
+                i32 child = src[i].children[j];
+                if ((child >= 0) && ((child <= i) || (child >= count)))
+                {
+                    child = -1;
+                }
+                dst[i].children[j] = child;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool LoadLeafs(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model)
+{
+    lump_t lump = header->lumps[LUMP_LEAFS];
+    dleaf_t const *const pim_noalias src = OffsetPtr(buffer, lump.fileofs);
+    i32 count = 0;
+    if (CheckLump(model->name, "leafs", lump, sizeof(src[0]), MAX_MAP_LEAFS, &count))
+    {
+        mleaf_t *const pim_noalias dst = Mem_Alloc(allocator, sizeof(dst[0]) * count);
+        model->leafs = dst;
+        model->numleafs = count;
+        for (i32 i = 0; i < count; ++i)
+        {
+            dst[i].contents = src[i].contents;
+            dst[i].visofs = src[i].visofs;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool LoadVisibility(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model)
+{
+    lump_t lump = header->lumps[LUMP_VISIBILITY];
+    u8 const *const pim_noalias src = OffsetPtr(buffer, lump.fileofs);
+    i32 count = 0;
+    if (CheckLump(model->name, "visibility", lump, sizeof(src[0]), MAX_MAP_VISIBILITY, &count))
+    {
+        u8 *const pim_noalias dst = Mem_Alloc(allocator, count);
+        memcpy(dst, src, count);
+        model->visdata = dst;
+        model->visdatasize = count;
+        return true;
+    }
+    return false;
+}
+
+static bool LoadWorldModel(
+    const void* buffer,
+    EAlloc allocator,
+    dheader_t const *const header,
+    mmodel_t* model)
+{
+    lump_t lump = header->lumps[LUMP_MODELS];
+    dmodel_t const *const pim_noalias src = OffsetPtr(buffer, lump.fileofs);
+    i32 count = 0;
+    if (CheckLump(model->name, "models", lump, sizeof(src[0]), MAX_MAP_MODELS, &count))
+    {
+        // submodels share the world's leafs, only the world has visibility
+        model->headnode = i1_clamp(src[0].headnode[0], 0, i1_max(0, model->numnodes - 1));
+        model->visleafs = i1_clamp(src[0].visleafs, 0, i1_max(0, model->numleafs - 1));
+        return true;
+    }
+    return false;
+}
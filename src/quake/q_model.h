@@ -90,6 +90,26 @@ typedef struct mtexinfo_s
     mtexture_t const* texture;
 } mtexinfo_t;
 
+typedef struct mplane_s
+{
+    float3 normal;
+    float dist; // dist == dot(normal, pointOnPlane)
+} mplane_t;
+
+typedef struct mnode_s
+{
+    i32 plane; // model->planes[]
+    // >=0: points to child node
+    //  <0: points to leaf. add 1 then negate to extract index.
+    i32 children[2];
+} mnode_t;
+
+typedef struct mleaf_s
+{
+    i32 contents;
+    i32 visofs; // offset into model->visdata, -1 = no visibility info
+} mleaf_t;
+
 typedef struct msurface_s
 {
     i32 firstedge; // model->surfedges[]
@@ -327,6 +347,23 @@ typedef struct mmodel_s
 
     i32 entitiessize;
     char* entities;
+
+    i32 numplanes;
+    mplane_t* planes;
+
+    i32 numnodes;
+    mnode_t* nodes;
+
+    i32 numleafs;
+    mleaf_t* leafs;
+
+    // run length compressed PVS rows of the world model's leafs
+    i32 visdatasize;
+    u8* visdata;
+
+    // world model
+    i32 headnode;
+    i32 visleafs; // not including the solid leaf 0
 } mmodel_t;
 
 mmodel_t* LoadModel(const char* name, const void* buffer, EAlloc allocator);
@@ -144,6 +144,8 @@ static void BakeFn(void* pBase, i32 begin, i32 end)
     PtScene* scene = task->scene;
     const float4 origin = task->origin;
     const float weight = task->weight;
+    // weight is 1 / sampleCount
+    const u32 sampleIndex = (u32)(1.0f / weight - 0.5f);
 
     const i32 size = cm->size;
     const i32 flen = size * size;
@@ -154,6 +156,7 @@ static void BakeFn(void* pBase, i32 begin, i32 end)
         i32 face = i / flen;
         i32 fi = i % flen;
         int2 coord = { fi % size, fi / size };
+        PtSampler_Start(&sampler, i, sampleIndex);
         float2 Xi = f2_tent(Pt_Sample2D(&sampler));
         float4 dir = Cubemap_CalcDir(size, face, coord, Xi);
         PtResult result = Pt_TraceRay(&sampler, scene, origin, dir);
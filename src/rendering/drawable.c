@@ -123,6 +123,7 @@ void Entities_Clear(Entities *const dr)
             DestroyAtIndex(dr, i);
         }
         dr->count = 0;
+        Pvs_Del(&dr->pvs);
         dr->modtime = Time_Now();
     }
 }
@@ -276,6 +277,7 @@ bool Entities_Save(Crate *const crate, Entities const *const src)
         Guid_FromStr("drawables.rotations"), src->rotations, sizeof(src->rotations[0]) * length);
     wrote &= Crate_Set(crate,
         Guid_FromStr("drawables.scales"), src->scales, sizeof(src->scales[0]) * length);
+    wrote &= Pvs_Save(crate, &src->pvs);
 
     return wrote;
 }
@@ -351,6 +353,8 @@ bool Entities_Load(Crate *const crate, Entities *const dst)
             Guid_FromStr("drawables.rotations"), dst->rotations, sizeof(dst->rotations[0]) * len);
         loaded &= Crate_Get(crate,
             Guid_FromStr("drawables.scales"), dst->scales, sizeof(dst->scales[0]) * len);
+        // optional, maps without visibility have none
+        Pvs_Load(crate, &dst->pvs);
     }
 
     return loaded;
@@ -4,6 +4,7 @@
 #include "common/dbytes.h"
 #include "common/guid.h"
 #include "math/types.h"
+#include "rendering/pvs.h"
 
 PIM_C_BEGIN
 
@@ -23,6 +24,7 @@ typedef struct Entities_s
     float4* pim_noalias translations;
     quat* pim_noalias rotations;
     float4* pim_noalias scales;
+    Pvs pvs;                            // visibility of the loaded bsp map, may be empty
     u64 modtime;
 } Entities;
 
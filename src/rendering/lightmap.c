@@ -1148,7 +1148,8 @@ static void BakeFn(void* pbase, i32 begin, i32 end)
             continue;
         }
 
-        if (Pt_Sample1D(&sampler) > timeSlice)
+        // independent of the per texel sequence
+        if (Prng_f32(&sampler.rng) > timeSlice)
         {
             continue;
         }
@@ -1174,6 +1175,7 @@ static void BakeFn(void* pbase, i32 begin, i32 end)
 
         for (i32 i = 0; i < spp; ++i)
         {
+            PtSampler_Start(&sampler, iWork, (u32)sampleCount);
             float4 Lts = SampleUnitHemisphere(Pt_Sample2D(&sampler));
             float4 rd = TbnToWorld(TBN, Lts);
             float dt = (Pt_Sample1D(&sampler) - 0.5f) * metersPerTexel;
@@ -3,6 +3,7 @@
 #include "math/types.h"
 #include "math/int2_funcs.h"
 #include "math/float2_funcs.h"
+#include "math/float3_funcs.h"
 #include "math/float4_funcs.h"
 #include "math/float4x4_funcs.h"
 #include "math/quat_funcs.h"
@@ -746,6 +747,59 @@ void ModelSys_Shutdown(void)
 
 }
 
+// keeps the world's bsp and vis data, transformed into world space
+static void ModelToPvs(mmodel_t const *const model, float4x4 M, Pvs *const pvs)
+{
+    Pvs_Del(pvs);
+
+    const i32 numnodes = model->numnodes;
+    const i32 numleafs = model->numleafs;
+    const i32 numplanes = model->numplanes;
+    if ((numnodes <= 0) || (numleafs <= 0) || (numplanes <= 0) ||
+        (model->visleafs <= 0) || (model->visdatasize <= 0))
+    {
+        return;
+    }
+
+    // world space nodes, rebased so that the world's head node is the root
+    const i32 headnode = model->headnode;
+    const i32 nodeCount = numnodes - headnode;
+    PvsNode *const pim_noalias nodes = Perm_Alloc(sizeof(nodes[0]) * nodeCount);
+    for (i32 i = 0; i < nodeCount; ++i)
+    {
+        const mnode_t node = model->nodes[headnode + i];
+        const mplane_t src = model->planes[node.plane];
+        const float4 N = f3_f4(src.normal, 0.0f);
+        const float4 P = f4_mulvs(N, src.dist);
+        float4 plane = f4_normalize3(f4x4_mul_dir(M, N));
+        plane.w = f4_dot3(plane, f4x4_mul_pt(M, P));
+        nodes[i].plane = plane;
+        for (i32 j = 0; j < 2; ++j)
+        {
+            const i32 child = node.children[j];
+            nodes[i].children[j] = (child >= 0) ? (child - headnode) : child;
+        }
+    }
+
+    i32 *const pim_noalias leafVis = Perm_Alloc(sizeof(leafVis[0]) * numleafs);
+    for (i32 i = 0; i < numleafs; ++i)
+    {
+        const i32 visofs = model->leafs[i].visofs;
+        leafVis[i] = ((i > 0) && (visofs < model->visdatasize)) ? visofs : -1;
+    }
+
+    u8 *const pim_noalias vis = Perm_Alloc(model->visdatasize);
+    memcpy(vis, model->visdata, model->visdatasize);
+
+    pvs->nodeCount = nodeCount;
+    pvs->leafCount = numleafs;
+    pvs->visLeafCount = model->visleafs;
+    pvs->visSize = model->visdatasize;
+    pvs->nodes = nodes;
+    pvs->leafVis = leafVis;
+    pvs->vis = vis;
+}
+
 void ModelToDrawables(mmodel_t const *const model, Entities *const dr)
 {
     ASSERT(model);
@@ -824,6 +878,8 @@ void ModelToDrawables(mmodel_t const *const model, Entities *const dr)
 
     CreateDrawable(dr, &prevMesh, model->name, prevSurf, prevTex);
     ASSERT(!prevMesh.positions);
+
+    ModelToPvs(model, M, &dr->pvs);
 }
 
 bool LoadModelAsDrawables(const char* name, Entities *const dr)
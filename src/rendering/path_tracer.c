@@ -7,6 +7,7 @@
 #include "rendering/material.h"
 #include "rendering/cubemap.h"
 #include "rendering/librtc.h"
+#include "rendering/vulkan/vkr_texture.h"
 
 #include "math/float2_funcs.h"
 #include "math/float4_funcs.h"
@@ -15,7 +16,6 @@
 #include "math/float4x4_funcs.h"
 #include "math/sampling.h"
 #include "math/grid.h"
-#include "math/dist1d.h"
 #include "math/sdf.h"
 #include "math/area.h"
 #include "math/frustum.h"
@@ -25,6 +25,7 @@
 #include "math/box.h"
 
 #include "allocator/allocator.h"
+#include "containers/dict.h"
 #include "threading/task.h"
 #include "common/profiler.h"
 #include "common/console.h"
@@ -33,6 +34,12 @@
 #include "common/serialize.h"
 #include "common/atomics.h"
 #include "common/time.h"
+#include "common/nextpow2.h"
+#include "common/sort.h"
+#include "common/fnv1a.h"
+#include "common/guid.h"
+#include "assets/crate.h"
+#include "io/fstr.h"
 #include "ui/cimgui_ext.h"
 
 #include "stb/stb_perlin_fork.h"
@@ -40,35 +47,83 @@
 
 pim_optimize;
 
+#define kMaxBounces     666
+#define kWaveSize       256 // paths in flight per wavefront batch, multiple of 16
+#define kAdaptiveMinSamples 16 // samples before a pixel's variance is trusted
+#define kCacheCapacity  (1 << 20) // radiance cache cells, power of 2
+#define kCacheProbes    8
+#define kCacheMinSamples 8  // samples before a cell is trusted
+#define kCacheMaxSamples 1024 // cells stop accumulating once converged
+#define kGuideProb      0.5f // chance of sampling the guide over the brdf
+#define kGuideSplit     0.01f // flux fraction above which a quadrant is split
+#define kGuideMinSamples 128 // training samples before the first build
+#define kGuideMaxSamples (1 << 16)
+#define kMajorantMeters 1.0f // majorant grid cell size
+#define kMajorantMaxCells (1 << 18) // cap of the majorant grid, coarsens larger scenes
+#define kMediaMaxVoxels (1 << 26) // cap of the baked media volume
+#define kMaxConeLod 32.0f
+#define kConeSpreadMedia 1.0f // cone widening of a media scattering event
+#define kReprojectDepthTol 0.05f // relative depth change of a valid history sample
+#define kReprojectNormalTol 0.9f // min cosine between history and current normals
+
 // ----------------------------------------------------------------------------
 
+// per-thread wavefront path queues
+typedef struct PtWave_s
+{
+    PtPath paths[kWaveSize];
+    PtRayHit hits[kWaveSize];   // indexed by queue slot
+    float4 ros[kWaveSize];      // indexed by queue slot
+    float4 rds[kWaveSize];      // indexed by queue slot
+    i32 queue[kWaveSize];       // compacted indices of live paths
+    i32 pixels[kWaveSize];      // image index of each path
+    PtSampler samplers[kWaveSize]; // per path, as paths interleave
+} PtWave;
+
 static RTCDevice ms_device;
 static PtSampler ms_samplers[kMaxThreads];
+static PtSeq ms_sampleSeq;
+static i32 ms_lightSamples = 1;
+static i32 ms_cacheBounce; // 0 when the radiance cache is disabled
+static float ms_cacheMeters = 1.0f;
+static bool ms_guide;
+static PtWave* ms_waves[kMaxThreads];
+// PtEmitCacheKey -> PtEmitCacheEntry, see CalcEmissionPdfs
+static Dict ms_emitCache;
+static u32 ms_emitCacheBuild;
+// see PtScene_LoadLights
+static PtLightBake ms_lightBake;
 
 // ----------------------------------------------------------------------------
 
 static void PtScene_Init(PtScene* scene);
 static void PtScene_Clear(PtScene* scene);
+static void ClearLights(PtScene*const pim_noalias scene);
+static void UpdateLights(PtScene*const pim_noalias scene);
 static void OnRtcError(void* user, RTCError error, const char* msg);
 static bool InitRTC(void);
 static void InitSamplers(void);
-static RTCScene RtcNewScene(const PtScene*const pim_noalias scene);
+static RTCScene RtcNewScene(PtScene*const pim_noalias scene);
 static void FlattenDrawables(PtScene*const pim_noalias scene);
-static float EmissionPdf(
-    PtSampler*const pim_noalias sampler,
-    const PtScene*const pim_noalias scene,
-    i32 iVert,
-    i32 attempts);
-static void CalcEmissionPdfFn(void* pbase, i32 begin, i32 end);
+static void SetupMatTexs(PtScene*const pim_noalias scene);
+static void ClearEmitCache(void);
+static void LightBake_Del(PtLightBake *const bake);
+static void CalcEmissionPdfs(
+    PtScene const *const pim_noalias scene,
+    float *const pim_noalias pdfs);
 static void SetupEmissives(PtScene*const pim_noalias scene);
 static void SetupLightGridFn(void* pbase, i32 begin, i32 end);
 static void SetupLightGrid(PtScene*const pim_noalias scene);
+static void SetupLightTree(PtScene*const pim_noalias scene);
 
 static void media_desc_new(PtMediaDesc *const desc);
 static void media_desc_update(PtMediaDesc *const desc);
-static void media_desc_gui(PtMediaDesc *const desc);
-static void media_desc_load(PtMediaDesc *const desc, const char* name);
-static void media_desc_save(PtMediaDesc const *const desc, const char* name);
+static void media_desc_gui(PtMediaDesc *const desc, PtMediaVolume *const vol, char* pendingLoad);
+static void media_desc_load(PtMediaDesc *const desc, PtMediaVolume *const vol, const char* name);
+static void media_desc_save(
+    PtMediaDesc const *const desc,
+    PtMediaVolume const *const vol,
+    const char* name);
 
 // ----------------------------------------------------------------------------
 
@@ -107,7 +162,7 @@ pim_inline PtSurfHit VEC_CALL GetSurface(
     float4 ro,
     float4 rd,
     PtRayHit hit,
-    i32 bounce);
+    float coneWidth);
 pim_inline PtRayHit VEC_CALL pt_intersect_local(
     const PtScene*const pim_noalias scene,
     float4 ro,
@@ -144,13 +199,13 @@ pim_inline bool VEC_CALL LightSelect(
     PtSampler*const pim_noalias sampler,
     PtScene*const pim_noalias scene,
     float4 position,
-    i32* iVertOut,
+    i32* iEmitOut,
     float* pdfOut);
 pim_inline PtLightSample VEC_CALL SampleLight(
     PtSampler *const pim_noalias sampler,
     PtScene *const pim_noalias scene,
     float4 ro,
-    i32 iVert,
+    i32 iEmit,
     i32 bounce);
 pim_inline float VEC_CALL LightSelectPdf(
     PtScene *const pim_noalias scene,
@@ -183,7 +238,10 @@ pim_inline bool VEC_CALL EvaluateLight(
 // ----------------------------------------------------------------------------
 
 pim_inline float4 VEC_CALL MeanFreePathToMu(float4 albedo);
-pim_inline PtMedia VEC_CALL Media_Sample(PtMediaDesc const *const desc, float4 P);
+pim_inline PtMedia VEC_CALL Media_Sample(
+    PtMediaDesc const *const desc,
+    PtMediaVolume const *const vol,
+    float4 P);
 pim_inline float4 VEC_CALL Media_Albedo(PtMediaDesc const *const desc, float4 P, float t);
 pim_inline float4 VEC_CALL CalcMajorant(PtMediaDesc const *const desc);
 pim_inline float VEC_CALL CalcPhase(
@@ -210,6 +268,7 @@ pim_inline PtScatter VEC_CALL ScatterRay(
 // ----------------------------------------------------------------------------
 
 static void TraceFn(void* pbase, i32 begin, i32 end);
+static void TraceWaveFn(void* pbase, i32 begin, i32 end);
 static void RayGenFn(void* pBase, i32 begin, i32 end);
 pim_inline void VEC_CALL LightOnHit(
     PtSampler*const pim_noalias sampler,
@@ -218,6 +277,13 @@ pim_inline void VEC_CALL LightOnHit(
     float4 lum,
     i32 iVert);
 static void UpdateDists(PtScene *const pim_noalias scene);
+static void UpdateCache(PtScene *const pim_noalias scene);
+static void ClearCache(PtScene *const pim_noalias scene);
+static void UpdateGuide(PtScene *const pim_noalias scene);
+static void UpdateMajorants(PtScene *const pim_noalias scene);
+static void RefitMajorants(PtScene *const pim_noalias scene);
+static void UpdateMediaVolume(PtScene *const pim_noalias scene);
+static void ClearGuide(PtScene *const pim_noalias scene);
 static void DofUpdate(PtTrace* trace, const Camera* camera);
 
 // ----------------------------------------------------------------------------
@@ -225,7 +291,9 @@ static void DofUpdate(PtTrace* trace, const Camera* camera);
 pim_inline PtSampler VEC_CALL GetSampler(void)
 {
     i32 tid = Task_ThreadId();
-    return ms_samplers[tid];
+    PtSampler sampler = ms_samplers[tid];
+    sampler.seq = PtSeq_Random;
+    return sampler;
 }
 
 pim_inline void VEC_CALL SetSampler(PtSampler sampler)
@@ -234,13 +302,36 @@ pim_inline void VEC_CALL SetSampler(PtSampler sampler)
     ms_samplers[tid] = sampler;
 }
 
+pim_inline void VEC_CALL StartSample(PtSampler*const pim_noalias sampler, u32 pixel, u32 index)
+{
+    sampler->seq = ms_sampleSeq;
+    sampler->seed = HashU32(pixel);
+    sampler->index = index;
+    sampler->dim = 0;
+}
+
+// each dimension gets its own shuffle of the sequence, so paths
+// may consume any number of dimensions
+pim_inline u32 VEC_CALL NextDimSeed(PtSampler*const pim_noalias sampler)
+{
+    return HashU32(sampler->seed ^ HashU32(sampler->dim++));
+}
+
 pim_inline float VEC_CALL Sample1D(PtSampler*const pim_noalias sampler)
 {
+    if (sampler->seq == PtSeq_Sobol)
+    {
+        return Sobol1D_Owen(sampler->index, NextDimSeed(sampler));
+    }
     return Prng_f32(&sampler->rng);
 }
 
 pim_inline float2 VEC_CALL Sample2D(PtSampler*const pim_noalias sampler)
 {
+    if (sampler->seq == PtSeq_Sobol)
+    {
+        return Sobol2D_Owen(sampler->index, NextDimSeed(sampler));
+    }
     return Prng_float2(&sampler->rng);
 }
 
@@ -285,15 +376,27 @@ void PtSys_Init(void)
 {
     InitRTC();
     InitSamplers();
+    Dict_New(&ms_emitCache, sizeof(PtEmitCacheKey), sizeof(PtEmitCacheEntry), EAlloc_Perm);
 }
 
 void PtSys_Update(void)
 {
-
+    ms_sampleSeq = (PtSeq)i1_clamp(ConVar_GetInt(&cv_pt_sampler), 0, PtSeq_COUNT - 1);
+    ms_lightSamples = i1_clamp(ConVar_GetInt(&cv_pt_light_samples), 1, 16);
+    ms_cacheBounce = ConVar_GetBool(&cv_pt_cache) ? ConVar_GetInt(&cv_pt_cache_bounce) : 0;
+    ms_cacheMeters = ConVar_GetFloat(&cv_pt_cache_meters);
+    ms_guide = ConVar_GetBool(&cv_pt_guide);
 }
 
 void PtSys_Shutdown(void)
 {
+    ClearEmitCache();
+    LightBake_Del(&ms_lightBake);
+    for (i32 i = 0; i < NELEM(ms_waves); ++i)
+    {
+        Mem_Free(ms_waves[i]);
+        ms_waves[i] = NULL;
+    }
     if (ms_device)
     {
         rtc.ReleaseDevice(ms_device);
@@ -305,6 +408,7 @@ PtSampler VEC_CALL PtSampler_Get(void) { return GetSampler(); }
 void VEC_CALL PtSampler_Set(PtSampler sampler) { SetSampler(sampler); }
 float2 VEC_CALL Pt_Sample2D(PtSampler*const pim_noalias sampler) { return Sample2D(sampler); }
 float VEC_CALL Pt_Sample1D(PtSampler*const pim_noalias sampler) { return Sample1D(sampler); }
+void VEC_CALL PtSampler_Start(PtSampler*const pim_noalias sampler, u32 pixel, u32 index) { StartSample(sampler, pixel, index); }
 
 pim_inline RTCRay VEC_CALL RtcNewRay(
     float4 ro,
@@ -348,16 +452,18 @@ pim_inline RTCRayHit VEC_CALL RtcIntersect(
 
 // ros[i].w = tNear
 // rds[i].w = tFar
+// lanes at or beyond count are masked off
 pim_inline RTCRayHit16 VEC_CALL RtcIntersect16(
     RTCScene scene,
     float4 const *const pim_noalias ros,
-    float4 const *const pim_noalias rds)
+    float4 const *const pim_noalias rds,
+    i32 count)
 {
     RTCRayHit16 rayHit = { 0 };
     RTCIntersectContext ctx = { 0 };
     rtcInitIntersectContext(&ctx);
-    i32 valid[16] = { 0 };
-    for (i32 i = 0; i < 16; ++i)
+    pim_alignas(64) i32 valid[16] = { 0 };
+    for (i32 i = 0; i < count; ++i)
     {
         rayHit.ray.org_x[i] = ros[i].x;
         rayHit.ray.org_y[i] = ros[i].y;
@@ -382,17 +488,37 @@ pim_inline RTCRayHit16 VEC_CALL RtcIntersect16(
 // rds[i].w = tFar (place at least 1 millimeter before surface)
 // on miss (visible): tFar unchanged
 // on hit (occluded): tFar < 0
+// lanes at or beyond count are masked off.
+// a single ray skips the 16 wide packet.
 pim_inline void VEC_CALL RtcOccluded16(
     RTCScene scene,
     const float4* pim_noalias ros,
     const float4* pim_noalias rds,
-    bool* pim_noalias visibles)
+    bool* pim_noalias visibles,
+    i32 count)
 {
-    RTCRay16 rayHit = { 0 };
     RTCIntersectContext ctx = { 0 };
     rtcInitIntersectContext(&ctx);
-    i32 valid[16] = { 0 };
-    for (i32 i = 0; i < 16; ++i)
+    if (count == 1)
+    {
+        RTCRay ray = { 0 };
+        ray.org_x = ros[0].x;
+        ray.org_y = ros[0].y;
+        ray.org_z = ros[0].z;
+        ray.tnear = ros[0].w;
+        ray.dir_x = rds[0].x;
+        ray.dir_y = rds[0].y;
+        ray.dir_z = rds[0].z;
+        ray.tfar = rds[0].w;
+        ray.mask = -1;
+        ray.flags = 0;
+        rtc.Occluded1(scene, &ctx, &ray);
+        visibles[0] = ray.tfar > 0.0f;
+        return;
+    }
+    RTCRay16 rayHit = { 0 };
+    pim_alignas(64) i32 valid[16] = { 0 };
+    for (i32 i = 0; i < count; ++i)
     {
         rayHit.org_x[i] = ros[i].x;
         rayHit.org_y[i] = ros[i].y;
@@ -407,7 +533,7 @@ pim_inline void VEC_CALL RtcOccluded16(
         valid[i] = -1;
     }
     rtc.Occluded16(valid, scene, &ctx, &rayHit);
-    for (i32 i = 0; i < 16; ++i)
+    for (i32 i = 0; i < count; ++i)
     {
         visibles[i] = rayHit.tfar[i] > 0.0f;
     }
@@ -417,6 +543,8 @@ typedef struct PointQueryUserData
 {
     pim_alignas(16)
     const float4* pim_noalias positions;
+    const i32* pim_noalias indices;
+    const PtInstance* pim_noalias instances;
     float distance;
     u32 primID;
     u32 geomID;
@@ -427,14 +555,17 @@ pim_inline bool RtcPointQueryFn(RTCPointQueryFunctionArguments* args)
 {
     PointQueryUserData* pim_noalias usr = args->userPtr;
     const u32 primID = args->primID;
-    if (primID != RTC_INVALID_GEOMETRY_ID)
+    const u32 instID = args->context->instID[0];
+    if ((primID != RTC_INVALID_GEOMETRY_ID) && (instID != RTC_INVALID_GEOMETRY_ID))
     {
+        // query is in world space, so are the welded positions
         RTCPointQuery* pim_noalias query = args->query;
         const float4* pim_noalias positions = usr->positions;
-        const u32 iVert = primID * 3;
-        float4 A = positions[iVert + 0];
-        float4 B = positions[iVert + 1];
-        float4 C = positions[iVert + 2];
+        const i32 iVert = usr->instances[instID].indexBase + primID * 3;
+        const i32* pim_noalias tri = usr->indices + iVert;
+        float4 A = positions[tri[0]];
+        float4 B = positions[tri[1]];
+        float4 C = positions[tri[2]];
         float4 P = { query->x, query->y, query->z, query->radius };
         float distance = sdTriangle3D(A, B, C, P);
         bool frontFace = distance > 0.0f;
@@ -445,7 +576,7 @@ pim_inline bool RtcPointQueryFn(RTCPointQueryFunctionArguments* args)
             {
                 usr->distance = distance;
                 usr->primID = primID;
-                usr->geomID = args->geomID;
+                usr->geomID = instID;
                 usr->frontFace = frontFace;
                 query->radius = f1_min(query->radius, distance);
                 return true;
@@ -459,6 +590,8 @@ pim_inline PointQueryUserData VEC_CALL RtcPointQuery(const PtScene*const pim_noa
 {
     PointQueryUserData usr = { 0 };
     usr.positions = scene->positions;
+    usr.indices = scene->indices;
+    usr.instances = scene->instances;
     usr.distance = 1 << 20;
     usr.primID = RTC_INVALID_GEOMETRY_ID;
     usr.geomID = RTC_INVALID_GEOMETRY_ID;
@@ -474,7 +607,132 @@ pim_inline PointQueryUserData VEC_CALL RtcPointQuery(const PtScene*const pim_noa
     return usr;
 }
 
-static RTCScene RtcNewScene(const PtScene*const pim_noalias scene)
+// key for welding identical vertices of a mesh
+typedef struct PtWeldKey_s
+{
+    float4 position;
+    float4 normal;
+    float4 uv;
+} PtWeldKey;
+
+pim_inline PtWeldKey VEC_CALL GetWeldKey(Mesh const *const mesh, i32 iCorner)
+{
+    PtWeldKey key;
+    key.position = mesh->positions[iCorner];
+    key.normal = mesh->normals[iCorner];
+    key.normal.w = 0.0f;
+    key.uv = f4_v(mesh->uvs[iCorner].x, mesh->uvs[iCorner].y, 0.0f, 0.0f);
+    return key;
+}
+
+// orders corners by key, then by corner index
+static i32 CmpWeldCorner(i32 lhs, i32 rhs, void* usr)
+{
+    Mesh const *const mesh = usr;
+    const PtWeldKey a = GetWeldKey(mesh, lhs);
+    const PtWeldKey b = GetWeldKey(mesh, rhs);
+    i32 cmp = memcmp(&a, &b, sizeof(a));
+    if (cmp == 0)
+    {
+        cmp = (lhs < rhs) ? -1 : ((lhs > rhs) ? 1 : 0);
+    }
+    return cmp;
+}
+
+// welds the corners of a mesh by sorting them.
+// unique vertices are numbered in order of their first corner.
+static PtMesh WeldMesh(Mesh const *const mesh)
+{
+    const i32 meshLen = mesh->length;
+    PtMesh pm = { 0 };
+    pm.indices = Tex_Alloc(sizeof(pm.indices[0]) * i1_max(1, meshLen));
+
+    i32* pim_noalias order = Tex_Alloc(sizeof(order[0]) * i1_max(1, meshLen));
+    for (i32 i = 0; i < meshLen; ++i)
+    {
+        order[i] = i;
+    }
+    QuickSort_Int(order, meshLen, CmpWeldCorner, (void*)mesh);
+
+    // point each corner at the first corner of its run of equal keys
+    i32* pim_noalias indices = pm.indices;
+    i32 vertCount = 0;
+    PtWeldKey runKey = { 0 };
+    i32 run = -1;
+    for (i32 i = 0; i < meshLen; ++i)
+    {
+        const i32 iCorner = order[i];
+        const PtWeldKey key = GetWeldKey(mesh, iCorner);
+        if ((run < 0) || memcmp(&key, &runKey, sizeof(key)))
+        {
+            runKey = key;
+            run = iCorner;
+            ++vertCount;
+        }
+        indices[iCorner] = run;
+    }
+    Mem_Free(order);
+
+    // number the first corners in corner order; others follow their first
+    pm.vertCount = vertCount;
+    pm.corners = Tex_Alloc(sizeof(pm.corners[0]) * i1_max(1, vertCount));
+    i32 iVert = 0;
+    for (i32 i = 0; i < meshLen; ++i)
+    {
+        const i32 first = indices[i];
+        if (first == i)
+        {
+            pm.corners[iVert] = i;
+            indices[i] = iVert++;
+        }
+        else
+        {
+            indices[i] = indices[first];
+        }
+    }
+    ASSERT(iVert == vertCount);
+
+    return pm;
+}
+
+// welded mesh of id, welding it on first use
+static PtMesh GetPtMesh(PtScene *const pim_noalias scene, MeshId id, Mesh const *const mesh)
+{
+    PtMesh pm = { 0 };
+    if (!Dict_Get(&scene->meshes, &id, &pm))
+    {
+        pm = WeldMesh(mesh);
+        Dict_Add(&scene->meshes, &id, &pm);
+    }
+    return pm;
+}
+
+// writes the unique vertices of a welded mesh transformed by M
+static void TransformPtMesh(
+    PtMesh const *const pm,
+    Mesh const *const mesh,
+    float4x4 M,
+    float4* pim_noalias positions,
+    float4* pim_noalias normals,
+    i32 vertBase)
+{
+    float4 const *const pim_noalias meshPositions = mesh->positions;
+    float4 const *const pim_noalias meshNormals = mesh->normals;
+    i32 const *const pim_noalias corners = pm->corners;
+    const float3x3 IM = f3x3_IM(M);
+    const i32 vertCount = pm->vertCount;
+    for (i32 i = 0; i < vertCount; ++i)
+    {
+        const i32 iCorner = corners[i];
+        float4 N = meshNormals[iCorner];
+        N.w = 0.0f;
+        positions[vertBase + i] = f4x4_mul_pt(M, meshPositions[iCorner]);
+        normals[vertBase + i] = f4_normalize3(f3x3_mul_col(IM, N));
+    }
+}
+
+// bottom level scene of a single mesh, in object space
+static RTCScene RtcNewMeshScene(PtMesh const *const pm, Mesh const *const mesh)
 {
     RTCScene rtcScene = rtc.NewScene(ms_device);
     ASSERT(rtcScene);
@@ -488,11 +746,12 @@ static RTCScene RtcNewScene(const PtScene*const pim_noalias scene)
     RTCGeometry geom = rtc.NewGeometry(ms_device, RTC_GEOMETRY_TYPE_TRIANGLE);
     ASSERT(geom);
 
-    const i32 vertCount = scene->vertCount;
-    const i32 triCount = vertCount / 3;
+    const i32 triCount = mesh->length / 3;
+    const i32 vertCount = pm->vertCount;
 
-    if (vertCount > 0)
+    if (triCount > 0)
     {
+        // the weld of FlattenDrawables, so primIDs line up
         float3* pim_noalias dstPositions = rtc.SetNewGeometryBuffer(
             geom,
             RTC_BUFFER_TYPE_VERTEX,
@@ -500,23 +759,6 @@ static RTCScene RtcNewScene(const PtScene*const pim_noalias scene)
             RTC_FORMAT_FLOAT3,
             sizeof(float3),
             vertCount);
-        if (!dstPositions)
-        {
-            ASSERT(false);
-            rtc.ReleaseGeometry(geom);
-            rtc.ReleaseScene(rtcScene);
-            return NULL;
-        }
-        const float4* pim_noalias srcPositions = scene->positions;
-        for (i32 i = 0; i < vertCount; ++i)
-        {
-            dstPositions[i] = f4_f3(srcPositions[i]);
-        }
-    }
-
-    if (triCount > 0)
-    {
-        // kind of wasteful
         i32* pim_noalias dstIndices = rtc.SetNewGeometryBuffer(
             geom,
             RTC_BUFFER_TYPE_INDEX,
@@ -524,17 +766,19 @@ static RTCScene RtcNewScene(const PtScene*const pim_noalias scene)
             RTC_FORMAT_UINT3,
             sizeof(int3),
             triCount);
-        if (!dstIndices)
+        if (!dstPositions || !dstIndices)
         {
             ASSERT(false);
             rtc.ReleaseGeometry(geom);
             rtc.ReleaseScene(rtcScene);
             return NULL;
         }
+        float4 const *const pim_noalias positions = mesh->positions;
         for (i32 i = 0; i < vertCount; ++i)
         {
-            dstIndices[i] = i;
+            dstPositions[i] = f4_f3(positions[pm->corners[i]]);
         }
+        memcpy(dstIndices, pm->indices, sizeof(dstIndices[0]) * triCount * 3);
     }
 
     rtc.CommitGeometry(geom);
@@ -547,6 +791,52 @@ static RTCScene RtcNewScene(const PtScene*const pim_noalias scene)
     return rtcScene;
 }
 
+// top level scene with one instance per PtInstance.
+// instance geomIDs match indices into scene->instances.
+static RTCScene RtcNewScene(PtScene*const pim_noalias scene)
+{
+    RTCScene rtcScene = rtc.NewScene(ms_device);
+    ASSERT(rtcScene);
+    if (!rtcScene)
+    {
+        return NULL;
+    }
+
+    // built for tracing; moving instances switch it to cheap rebuilds
+    // until they settle, see PtScene_MoveInstances and SettleRtcScene
+    rtc.SetSceneBuildQuality(rtcScene, RTC_BUILD_QUALITY_MEDIUM);
+
+    const i32 instCount = scene->instCount;
+    PtInstance const *const pim_noalias instances = scene->instances;
+    for (i32 i = 0; i < instCount; ++i)
+    {
+        const MeshId meshId = instances[i].mesh;
+        PtMesh pm = { 0 };
+        Dict_Get(&scene->meshes, &meshId, &pm);
+        if (!pm.rtcScene)
+        {
+            Mesh const *const mesh = Mesh_Get(meshId);
+            ASSERT(mesh);
+            pm.rtcScene = RtcNewMeshScene(&pm, mesh);
+            Dict_Set(&scene->meshes, &meshId, &pm);
+        }
+
+        RTCGeometry geom = rtc.NewGeometry(ms_device, RTC_GEOMETRY_TYPE_INSTANCE);
+        ASSERT(geom);
+        rtc.SetGeometryInstancedScene(geom, pm.rtcScene);
+        rtc.SetGeometryTransform(geom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, &instances[i].matrix);
+        rtc.CommitGeometry(geom);
+        rtc.AttachGeometryByID(rtcScene, geom, i);
+        rtc.ReleaseGeometry(geom);
+    }
+
+    rtc.CommitScene(rtcScene);
+
+    return rtcScene;
+}
+
+// vertices are welded within each drawable; the material is per drawable.
+// sizes are counted first so that every array is allocated exactly.
 static void FlattenDrawables(PtScene*const pim_noalias scene)
 {
     const Entities* drawTable = Entities_Get();
@@ -556,14 +846,31 @@ static void FlattenDrawables(PtScene*const pim_noalias scene)
     const Material* materials = drawTable->materials;
 
     i32 vertCount = 0;
-    float4* positions = NULL;
-    float4* normals = NULL;
-    float2* uvs = NULL;
-    i32* matIds = NULL;
-
-    i32 matCount = 0;
-    Material* sceneMats = NULL;
+    i32 indexCount = 0;
+    i32 instCount = 0;
+    for (i32 i = 0; i < drawCount; ++i)
+    {
+        Mesh const *const mesh = Mesh_Get(meshes[i]);
+        if (mesh)
+        {
+            const PtMesh pm = GetPtMesh(scene, meshes[i], mesh);
+            vertCount += pm.vertCount;
+            indexCount += mesh->length;
+            ++instCount;
+        }
+    }
 
+    float4* pim_noalias positions = Perm_Alloc(sizeof(positions[0]) * i1_max(1, vertCount));
+    float4* pim_noalias normals = Perm_Alloc(sizeof(normals[0]) * i1_max(1, vertCount));
+    float2* pim_noalias uvs = Perm_Alloc(sizeof(uvs[0]) * i1_max(1, vertCount));
+    i32* pim_noalias indices = Perm_Alloc(sizeof(indices[0]) * i1_max(1, indexCount));
+    i32* pim_noalias matIds = Perm_Alloc(sizeof(matIds[0]) * i1_max(1, indexCount / 3));
+    Material* pim_noalias sceneMats = Perm_Alloc(sizeof(sceneMats[0]) * i1_max(1, instCount));
+    PtInstance* pim_noalias instances = Perm_Alloc(sizeof(instances[0]) * i1_max(1, instCount));
+
+    i32 vertBase = 0;
+    i32 indexBase = 0;
+    i32 iInst = 0;
     for (i32 i = 0; i < drawCount; ++i)
     {
         Mesh const *const mesh = Mesh_Get(meshes[i]);
@@ -572,509 +879,2671 @@ static void FlattenDrawables(PtScene*const pim_noalias scene)
             continue;
         }
 
+        const PtMesh pm = GetPtMesh(scene, meshes[i], mesh);
         const i32 meshLen = mesh->length;
-        float4 const *const pim_noalias meshPositions = mesh->positions;
-        float4 const *const pim_noalias meshNormals = mesh->normals;
-        float4 const *const pim_noalias meshUvs = mesh->uvs;
-
-        const i32 vertBack = vertCount;
-        const i32 matBack = matCount;
-        vertCount += meshLen;
-        matCount += 1;
-
         const float4x4 M = matrices[i];
-        const float3x3 IM = f3x3_IM(M);
-        const Material material = materials[i];
-
-        Perm_Reserve(positions, vertCount);
-        Perm_Reserve(normals, vertCount);
-        Perm_Reserve(uvs, vertCount);
-        Perm_Reserve(matIds, vertCount);
 
-        Perm_Reserve(sceneMats, matCount);
-        sceneMats[matBack] = material;
-
-        for (i32 j = 0; j < meshLen; ++j)
+        TransformPtMesh(&pm, mesh, M, positions, normals, vertBase);
+        for (i32 j = 0; j < pm.vertCount; ++j)
         {
-            positions[vertBack + j] = f4x4_mul_pt(M, meshPositions[j]);
+            const float4 uv = mesh->uvs[pm.corners[j]];
+            uvs[vertBase + j] = f2_v(uv.x, uv.y);
         }
-
         for (i32 j = 0; j < meshLen; ++j)
         {
-            normals[vertBack + j] = f4_normalize3(f3x3_mul_col(IM, meshNormals[j]));
-        }
-
-        for (i32 j = 0; (j + 3) <= meshLen; j += 3)
-        {
-            float4 uva = meshUvs[j + 0];
-            float4 uvb = meshUvs[j + 1];
-            float4 uvc = meshUvs[j + 2];
-            float2 UA = f2_v(uva.x, uva.y);
-            float2 UB = f2_v(uvb.x, uvb.y);
-            float2 UC = f2_v(uvc.x, uvc.y);
-            uvs[vertBack + j + 0] = UA;
-            uvs[vertBack + j + 1] = UB;
-            uvs[vertBack + j + 2] = UC;
+            indices[indexBase + j] = vertBase + pm.indices[j];
         }
-
-        for (i32 j = 0; j < meshLen; ++j)
+        for (i32 j = indexBase; (j + 3) <= (indexBase + meshLen); j += 3)
         {
-            matIds[vertBack + j] = matBack;
+            matIds[j / 3] = iInst;
         }
+        sceneMats[iInst] = materials[i];
+
+        PtInstance* inst = &instances[iInst];
+        inst->mesh = meshes[i];
+        inst->matrix = M;
+        inst->iEntity = i;
+        inst->vertBase = vertBase;
+        inst->vertCount = pm.vertCount;
+        inst->indexBase = indexBase;
+
+        vertBase += pm.vertCount;
+        indexBase += meshLen;
+        ++iInst;
     }
+    ASSERT(vertBase == vertCount);
+    ASSERT(indexBase == indexCount);
+    ASSERT(iInst == instCount);
 
     scene->vertCount = vertCount;
     scene->positions = positions;
     scene->normals = normals;
     scene->uvs = uvs;
+    scene->indexCount = indexCount;
+    scene->indices = indices;
     scene->matIds = matIds;
 
-    scene->matCount = matCount;
+    scene->matCount = instCount;
     scene->materials = sceneMats;
+
+    scene->instCount = instCount;
+    scene->instances = instances;
 }
 
-static float EmissionPdf(
-    PtSampler*const pim_noalias sampler,
-    const PtScene*const pim_noalias scene,
-    i32 iVert,
-    i32 attempts)
+typedef struct PtMatTexKey_s
 {
-    const i32 iMat = scene->matIds[iVert];
-    const Material* mat = scene->materials + iMat;
+    TextureId albedo;
+    TextureId rome;
+    TextureId normal;
+} PtMatTexKey;
 
-    if (mat->flags & MatFlag_Sky)
-    {
-        return 1.0f;
-    }
+typedef struct task_PackMatTex
+{
+    Task task;
+    PtMatTexKey const* keys;
+    PtMatTex* matTexs;
+} task_PackMatTex;
 
-    Texture const *const romeMap = Texture_Get(mat->rome);
-    if (!romeMap)
+// uv of a dst texel's center, with both textures spanning [0, 1]
+pim_inline float2 VEC_CALL PackDstUv(int2 dstSize, int2 coord)
+{
+    return f2_v((coord.x + 0.5f) / dstSize.x, (coord.y + 0.5f) / dstSize.y);
+}
+
+// src texel for a texel of dst; copied at equal sizes, else bilinearly resampled
+pim_inline R8G8B8A8_t VEC_CALL PackSrc_c32(
+    R8G8B8A8_t const *const pim_noalias src, int2 srcSize, int2 dstSize, int2 coord)
+{
+    if ((srcSize.x == dstSize.x) && (srcSize.y == dstSize.y))
     {
-        return 0.0f;
+        return src[coord.x + coord.y * srcSize.x];
     }
-    u32 const *const pim_noalias texels = romeMap->texels;
-    const int2 texSize = romeMap->size;
-
-    const float2* pim_noalias uvs = scene->uvs;
-    const float2 UA = uvs[iVert + 0];
-    const float2 UB = uvs[iVert + 1];
-    const float2 UC = uvs[iVert + 2];
+    return GammaEncode_rgba8(UvBilinearWrapPow2_c32(src, srcSize, PackDstUv(dstSize, coord)));
+}
 
-    i32 hits = 0;
-    for (i32 i = 0; i < attempts; ++i)
+pim_inline short2 VEC_CALL PackSrc_xy16(
+    short2 const *const pim_noalias src, int2 srcSize, int2 dstSize, int2 coord)
+{
+    if ((srcSize.x == dstSize.x) && (srcSize.y == dstSize.y))
     {
-        float4 wuv = SampleBaryCoord(Sample2D(sampler));
-        float2 uv = f2_blend(UA, UB, UC, wuv);
-        i32 iTexel = UvWrapPow2(texSize, uv);
-        u32 sample = texels[iTexel] >> 24;
-        hits += sample ? 1 : 0;
+        return src[coord.x + coord.y * srcSize.x];
     }
-    return (float)hits / (float)attempts;
+    return NormalTsToXy16(UvBilinearWrapPow2_xy16(src, srcSize, PackDstUv(dstSize, coord)));
 }
 
-typedef struct task_CalcEmissionPdf
+// box filters the 2x2 texels of the finer mip under a texel of dst.
+// src is the morton ordered mip above dst, wrapped along a side of 1.
+pim_inline PtTexel VEC_CALL PackMip(
+    PtTexel const *const pim_noalias src, int2 srcSize, int2 coord)
 {
-    Task task;
-    const PtScene* scene;
-    float* pdfs;
-    i32 attempts;
-} task_CalcEmissionPdf;
+    const int2 c = i2_mulvs(coord, 2);
+    const PtTexel a = src[WrapMortonPow2(srcSize, c)];
+    const PtTexel b = src[WrapMortonPow2(srcSize, i2_v(c.x + 1, c.y + 0))];
+    const PtTexel d = src[WrapMortonPow2(srcSize, i2_v(c.x + 0, c.y + 1))];
+    const PtTexel e = src[WrapMortonPow2(srcSize, i2_v(c.x + 1, c.y + 1))];
+    PtTexel texel;
+    texel.albedo = GammaEncode_rgba8(f4_mulvs(f4_add(
+        f4_add(GammaDecode_rgba8(a.albedo), GammaDecode_rgba8(b.albedo)),
+        f4_add(GammaDecode_rgba8(d.albedo), GammaDecode_rgba8(e.albedo))), 0.25f));
+    texel.rome = GammaEncode_rgba8(f4_mulvs(f4_add(
+        f4_add(GammaDecode_rgba8(a.rome), GammaDecode_rgba8(b.rome)),
+        f4_add(GammaDecode_rgba8(d.rome), GammaDecode_rgba8(e.rome))), 0.25f));
+    texel.normal = NormalTsToXy16(f4_normalize3(f4_add(
+        f4_add(Xy16ToNormalTs(a.normal), Xy16ToNormalTs(b.normal)),
+        f4_add(Xy16ToNormalTs(d.normal), Xy16ToNormalTs(e.normal)))));
+    return texel;
+}
 
-static void CalcEmissionPdfFn(void* pbase, i32 begin, i32 end)
+static void PackMatTexFn(void* pbase, i32 begin, i32 end)
 {
-    task_CalcEmissionPdf* task = (task_CalcEmissionPdf*)pbase;
-    const PtScene*const pim_noalias scene = task->scene;
-    const i32 attempts = task->attempts;
-    float* pim_noalias pdfs = task->pdfs;
+    task_PackMatTex *const task = pbase;
+    PtMatTexKey const *const pim_noalias keys = task->keys;
+    PtMatTex *const pim_noalias matTexs = task->matTexs;
+
+    const R8G8B8A8_t albedoDefault = GammaEncode_rgba8(f4_1);
+    const R8G8B8A8_t romeDefault = GammaEncode_rgba8(f4_v(0.5f, 1.0f, 0.0f, 0.0f));
+    const short2 normalDefault = NormalTsToXy16(f4_v(0.0f, 0.0f, 1.0f, 0.0f));
 
-    PtSampler sampler = PtSampler_Get();
     for (i32 i = begin; i < end; ++i)
     {
-        pdfs[i] = EmissionPdf(&sampler, scene, i * 3, attempts);
+        Texture const *const albedo = Texture_Get(keys[i].albedo);
+        Texture const *const rome = Texture_Get(keys[i].rome);
+        Texture const *const normal = Texture_Get(keys[i].normal);
+        const int2 size = matTexs[i].size;
+        const i32 mipCount = CalcMipCount(size);
+        PtTexel *const pim_noalias texels = matTexs[i].texels;
+
+        // mip 0 resamples the sources to the largest of them
+        const int2 albedoSize = albedo ? albedo->size : size;
+        const int2 romeSize = rome ? rome->size : size;
+        const int2 normalSize = normal ? normal->size : size;
+        R8G8B8A8_t const *const pim_noalias albedoSrc = albedo ? albedo->texels : NULL;
+        R8G8B8A8_t const *const pim_noalias romeSrc = rome ? rome->texels : NULL;
+        short2 const *const pim_noalias normalSrc = normal ? normal->texels : NULL;
+        const i32 len = size.x * size.y;
+        for (i32 j = 0; j < len; ++j)
+        {
+            const int2 coord = IndexToCoord(size, j);
+            PtTexel texel;
+            texel.albedo = albedoSrc ?
+                PackSrc_c32(albedoSrc, albedoSize, size, coord) : albedoDefault;
+            texel.rome = romeSrc ?
+                PackSrc_c32(romeSrc, romeSize, size, coord) : romeDefault;
+            texel.normal = normalSrc ?
+                PackSrc_xy16(normalSrc, normalSize, size, coord) : normalDefault;
+            texels[CoordToMortonPow2(size, coord)] = texel;
+        }
+
+        // the rest of the chain filters the packed mip above,
+        // so textures carry no cpu mips of their own
+        for (i32 m = 1; m < mipCount; ++m)
+        {
+            const int2 srcSize = CalcMipSize(size, m - 1);
+            const int2 dstSize = CalcMipSize(size, m);
+            const i32 dstLen = dstSize.x * dstSize.y;
+            PtTexel const *const pim_noalias src = texels + CalcMipOffset(size, m - 1);
+            PtTexel *const pim_noalias dst = texels + CalcMipOffset(size, m);
+            for (i32 j = 0; j < dstLen; ++j)
+            {
+                const int2 coord = IndexToCoord(dstSize, j);
+                dst[CoordToMortonPow2(dstSize, coord)] = PackMip(src, srcSize, coord);
+            }
+        }
     }
-    PtSampler_Set(sampler);
 }
 
-static void SetupEmissives(PtScene*const pim_noalias scene)
+// packs the textures of each distinct material texture set,
+// so that a surface hit reads one interleaved texel array
+ProfileMark(pm_setupmattexs, SetupMatTexs)
+static void SetupMatTexs(PtScene*const pim_noalias scene)
 {
-    const i32 vertCount = scene->vertCount;
-    const i32 triCount = vertCount / 3;
-
-    task_CalcEmissionPdf* task = Temp_Calloc(sizeof(*task));
-    task->scene = scene;
-    task->pdfs = Temp_Alloc(sizeof(task->pdfs[0]) * triCount);
-    task->attempts = 1000;
+    ProfileBegin(pm_setupmattexs);
 
-    Task_Run(&task->task, CalcEmissionPdfFn, triCount);
+    const i32 matCount = scene->matCount;
+    Material const *const pim_noalias materials = scene->materials;
+    i32 *const pim_noalias matToTex = Perm_Alloc(sizeof(matToTex[0]) * matCount);
 
-    i32 emissiveCount = 0;
-    i32* emitToVert = NULL;
-    i32* pim_noalias vertToEmit = Perm_Alloc(sizeof(vertToEmit[0]) * vertCount);
+    Dict lookup;
+    Dict_New(&lookup, sizeof(PtMatTexKey), sizeof(i32), EAlloc_Temp);
+    i32 matTexCount = 0;
+    PtMatTexKey* keys = NULL;
+    PtMatTex* matTexs = NULL;
 
-    const float* pim_noalias taskPdfs = task->pdfs;
-    for (i32 iTri = 0; iTri < triCount; ++iTri)
+    for (i32 i = 0; i < matCount; ++i)
     {
-        i32 iVert = iTri * 3;
-        vertToEmit[iVert + 0] = -1;
-        vertToEmit[iVert + 1] = -1;
-        vertToEmit[iVert + 2] = -1;
-        float pdf = taskPdfs[iTri];
-        if (pdf > 0.01f)
+        PtMatTexKey key = { 0 };
+        key.albedo = materials[i].albedo;
+        key.rome = materials[i].rome;
+        key.normal = materials[i].normal;
+        Texture const *const albedo = Texture_Get(key.albedo);
+        Texture const *const rome = Texture_Get(key.rome);
+        Texture const *const normal = Texture_Get(key.normal);
+        if (!albedo && !rome && !normal)
         {
-            vertToEmit[iVert + 0] = emissiveCount;
-            vertToEmit[iVert + 1] = emissiveCount;
-            vertToEmit[iVert + 2] = emissiveCount;
-            ++emissiveCount;
-            Perm_Reserve(emitToVert, emissiveCount);
-            emitToVert[emissiveCount - 1] = iVert;
+            matToTex[i] = -1;
+            continue;
+        }
+
+        i32 iTex = matTexCount;
+        if (!Dict_GetAdd(&lookup, &key, &iTex))
+        {
+            int2 size = { 1, 1 };
+            size = albedo ? i2_max(size, albedo->size) : size;
+            size = rome ? i2_max(size, rome->size) : size;
+            size = normal ? i2_max(size, normal->size) : size;
+
+            ++matTexCount;
+            Perm_Reserve(keys, matTexCount);
+            Perm_Reserve(matTexs, matTexCount);
+            keys[iTex] = key;
+            matTexs[iTex].size = size;
+            matTexs[iTex].texels = Tex_Alloc(sizeof(PtTexel) * MipChainLen(size));
         }
+        matToTex[i] = iTex;
     }
+    Dict_Del(&lookup);
 
-    scene->vertToEmit = vertToEmit;
-    scene->emissiveCount = emissiveCount;
-    scene->emitToVert = emitToVert;
+    task_PackMatTex* task = Temp_Calloc(sizeof(*task));
+    task->keys = keys;
+    task->matTexs = matTexs;
+    Task_Run(&task->task, PackMatTexFn, matTexCount);
+    Mem_Free(keys);
+
+    scene->matTexCount = matTexCount;
+    scene->matTexs = matTexs;
+    scene->matToTex = matToTex;
+
+    ProfileEnd(pm_setupmattexs);
 }
 
-typedef struct task_SetupLightGrid
-{
-    Task task;
-    PtScene* scene;
-} task_SetupLightGrid;
+// texel centers to rasterize per triangle, see AverageEmission
+#define kEmitRasterTexels   256.0f
 
-static void SetupLightGridFn(void* pbase, i32 begin, i32 end)
+pim_inline float VEC_CALL TexelEmission(PtTexel texel)
 {
-    task_SetupLightGrid* task = (task_SetupLightGrid*)pbase;
+    const float e = texel.rome.a * (1.0f / 255.0f);
+    return e * e;
+}
 
-    PtScene*const pim_noalias scene = task->scene;
+// average emission over a triangle's uv footprint, without albedo.
+// rasterizes texel centers of the coarsest packed mip keeping about
+// kEmitRasterTexels within the footprint; larger footprints are strided.
+// mips average emission, so partially emissive texels weigh in partially.
+static float AverageEmission(PtMatTex const *const matTex, float2 UA, float2 UB, float2 UC)
+{
+    const float2 size0 = i2_f2(matTex->size);
+    const float uvArea = 0.5f * ((UB.x - UA.x) * (UC.y - UA.y) - (UC.x - UA.x) * (UB.y - UA.y));
+    const float texArea = f1_abs(uvArea) * size0.x * size0.y;
+    const i32 m = i1_min(
+        (i32)ceilf(0.5f * log2f(f1_max(1.0f, texArea / kEmitRasterTexels))),
+        CalcMipCount(matTex->size) - 1);
+
+    const int2 size = CalcMipSize(matTex->size, m);
+    PtTexel const *const pim_noalias texels = matTex->texels + CalcMipOffset(matTex->size, m);
+    const float2 scale = i2_f2(size);
+    const float2 A = f2_mul(UA, scale);
+    const float2 B = f2_mul(UB, scale);
+    const float2 C = f2_mul(UC, scale);
+    const float sign = (uvArea < 0.0f) ? -1.0f : 1.0f;
+
+    const int2 lo = f2_i2(f2_floor(f2_min(A, f2_min(B, C))));
+    const int2 hi = f2_i2(f2_ceil(f2_max(A, f2_max(B, C))));
+    const float boxArea = (float)(hi.x - lo.x) * (float)(hi.y - lo.y);
+    const i32 stride = i1_max(1, (i32)ceilf(sqrtf(boxArea / (4.0f * kEmitRasterTexels))));
+    const int2 mask = { size.x - 1, size.y - 1 };
+
+    i32 inside = 0;
+    float emission = 0.0f;
+    for (i32 y = lo.y; y < hi.y; y += stride)
+    {
+        for (i32 x = lo.x; x < hi.x; x += stride)
+        {
+            const float2 P = { x + 0.5f, y + 0.5f };
+            const float e0 = sign * ((B.x - A.x) * (P.y - A.y) - (B.y - A.y) * (P.x - A.x));
+            const float e1 = sign * ((C.x - B.x) * (P.y - B.y) - (C.y - B.y) * (P.x - B.x));
+            const float e2 = sign * ((A.x - C.x) * (P.y - C.y) - (A.y - C.y) * (P.x - C.x));
+            if ((e0 >= 0.0f) && (e1 >= 0.0f) && (e2 >= 0.0f))
+            {
+                ++inside;
+                const i32 i = CoordToMortonPow2(size, i2_v(x & mask.x, y & mask.y));
+                emission += TexelEmission(texels[i]);
+            }
+        }
+    }
 
-    const Grid grid = scene->lightGrid;
-    Dist1D *const pim_noalias dists = scene->lightDists;
+    if (inside == 0)
+    {
+        // smaller than a texel, take the texel under its centroid
+        const float2 P = f2_mulvs(f2_add(A, f2_add(B, C)), 1.0f / 3.0f);
+        const int2 c = f2_i2(f2_floor(P));
+        const i32 i = CoordToMortonPow2(size, i2_v(c.x & mask.x, c.y & mask.y));
+        return TexelEmission(texels[i]);
+    }
+    return emission / inside;
+}
 
-    float4 const *const pim_noalias positions = scene->positions;
+static void ClearEmitCache(void)
+{
+    const u32 width = Dict_GetWidth(&ms_emitCache);
+    for (u32 i = 0; i < width; ++i)
+    {
+        PtEmitCacheEntry entry;
+        if (Dict_GetValueAt(&ms_emitCache, i, &entry))
+        {
+            Mem_Free(entry.emission);
+        }
+    }
+    Dict_Del(&ms_emitCache);
+}
 
-    const i32 emissiveCount = scene->emissiveCount;
-    i32 const *const pim_noalias emitToVert = scene->emitToVert;
+typedef struct task_CalcEmitEmission
+{
+    Task task;
+    PtEmitCacheKey const* keys;
+    PtEmitCacheEntry const* entries;
+    PtMatTex const* const* matTexs;
+} task_CalcEmitEmission;
 
-    const float metersPerCell = ConVar_GetFloat(&cv_pt_dist_meters);
-    const float radius = metersPerCell * 0.666f;
-    PtSampler sampler = GetSampler();
+static void CalcEmitEmissionFn(void* pbase, i32 begin, i32 end)
+{
+    task_CalcEmitEmission const *const task = pbase;
+    for (i32 i = begin; i < end; ++i)
+    {
+        Mesh const *const mesh = Mesh_Get(task->keys[i].mesh);
+        PtMatTex const *const matTex = task->matTexs[i];
+        const PtEmitCacheEntry entry = task->entries[i];
+        float4 const *const pim_noalias uvs = mesh->uvs;
+        for (i32 iTri = 0; iTri < entry.triCount; ++iTri)
+        {
+            const i32 iVert = iTri * 3;
+            entry.emission[iTri] = AverageEmission(
+                matTex,
+                f2_v(uvs[iVert + 0].x, uvs[iVert + 0].y),
+                f2_v(uvs[iVert + 1].x, uvs[iVert + 1].y),
+                f2_v(uvs[iVert + 2].x, uvs[iVert + 2].y));
+        }
+    }
+}
 
-    float4 hamm[16];
-    for (i32 i = 0; i < NELEM(hamm); ++i)
+// average emission of every scene triangle.
+// computed once per mesh and rome texture upload, reused by identical
+// meshes and later rebuilds; pairs unused by this scene are evicted.
+ProfileMark(pm_emissionpdfs, CalcEmissionPdfs)
+static void CalcEmissionPdfs(
+    PtScene const *const pim_noalias scene,
+    float *const pim_noalias pdfs)
+{
+    ProfileBegin(pm_emissionpdfs);
+
+    const u32 build = ++ms_emitCacheBuild;
+    PtInstance const *const pim_noalias instances = scene->instances;
+    Material const *const pim_noalias materials = scene->materials;
+    i32 const *const pim_noalias matIds = scene->matIds;
+    const i32 triCount = scene->indexCount / 3;
+    const i32 instCount = scene->instCount;
+
+    // find or queue each instance's emission
+    i32 missCount = 0;
+    PtEmitCacheKey* missKeys = NULL;
+    PtEmitCacheEntry* missEntries = NULL;
+    PtMatTex const** missTexs = NULL;
+    PtEmitCacheEntry* instEntries = Temp_Calloc(sizeof(instEntries[0]) * instCount);
+    for (i32 i = 0; i < instCount; ++i)
     {
-        float2 Xi = Hammersley2D(i, NELEM(hamm));
-        hamm[i] = SampleUnitSphere(Xi);
+        const PtInstance inst = instances[i];
+        Mesh const *const mesh = Mesh_Get(inst.mesh);
+        if (!mesh || (inst.indexBase / 3) >= triCount)
+        {
+            continue;
+        }
+        const i32 matId = matIds[inst.indexBase / 3];
+        Material const *const mat = materials + matId;
+        Texture const *const romeMap = Texture_Get(mat->rome);
+        if ((mat->flags & MatFlag_Sky) || !romeMap)
+        {
+            continue;
+        }
+        // a rome texture implies a packed texture
+        PtMatTex const *const matTex = scene->matTexs + scene->matToTex[matId];
+        PtEmitCacheKey key;
+        memset(&key, 0, sizeof(key));
+        key.mesh = inst.mesh;
+        key.rome = mat->rome;
+        key.romeGeneration = romeMap->generation;
+        key.texSize = matTex->size;
+        PtEmitCacheEntry entry = { 0 };
+        if (!Dict_Get(&ms_emitCache, &key, &entry))
+        {
+            entry.triCount = mesh->length / 3;
+            entry.emission = Perm_Alloc(sizeof(entry.emission[0]) * i1_max(1, entry.triCount));
+            ++missCount;
+            Temp_Reserve(missKeys, missCount);
+            Temp_Reserve(missEntries, missCount);
+            Temp_Reserve(missTexs, missCount);
+            missKeys[missCount - 1] = key;
+            missEntries[missCount - 1] = entry;
+            missTexs[missCount - 1] = matTex;
+        }
+        entry.build = build;
+        Dict_SetAdd(&ms_emitCache, &key, &entry);
+        instEntries[i] = entry;
     }
 
-    RTCScene rtScene = scene->rtcScene;
+    if (missCount > 0)
+    {
+        task_CalcEmitEmission* task = Temp_Calloc(sizeof(*task));
+        task->keys = missKeys;
+        task->entries = missEntries;
+        task->matTexs = missTexs;
+        Task_Run(task, CalcEmitEmissionFn, missCount);
+    }
 
-    for (i32 i = begin; i < end; ++i)
+    memset(pdfs, 0, sizeof(pdfs[0]) * triCount);
+    for (i32 i = 0; i < instCount; ++i)
     {
-        float4 position = Grid_Position(&grid, i);
-        position.w = radius + 0.01f * kMilli;
+        const PtInstance inst = instances[i];
+        const i32 base = inst.indexBase / 3;
+        const i32 len = (i + 1 < instCount) ? (instances[i + 1].indexBase / 3 - base) : (triCount - base);
+        if (len <= 0)
         {
-            PointQueryUserData query = RtcPointQuery(scene, position);
-            if (query.distance > radius)
+            continue;
+        }
+        Material const *const mat = materials + matIds[base];
+        if (mat->flags & MatFlag_Sky)
+        {
+            for (i32 j = 0; j < len; ++j)
             {
-                // far from a surface. might be inside or outside the map
-                // toss some rays and see if they are backfaces
-                float hitcount = 0.0f;
-                for (i32 j = 0; j < NELEM(hamm); ++j)
-                {
-                    PtRayHit hit = pt_intersect_local(scene, position, hamm[j], 0.0f, 1 << 20);
-                    if (hit.type == PtHit_Triangle)
-                    {
-                        ++hitcount;
-                    }
-                }
-                float hitratio = hitcount / NELEM(hamm);
-                if (hitratio < 0.5f)
-                {
-                    continue;
-                }
+                pdfs[base + j] = 1.0f;
             }
         }
+        else if (instEntries[i].emission)
+        {
+            memcpy(pdfs + base, instEntries[i].emission, sizeof(pdfs[0]) * i1_min(len, instEntries[i].triCount));
+        }
+    }
 
-        Dist1D dist = { 0 };
-        Dist1D_New(&dist, emissiveCount);
-
-        for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+    // evict pairs this scene no longer uses
+    const u32 width = Dict_GetWidth(&ms_emitCache);
+    for (u32 i = 0; i < width; ++i)
+    {
+        PtEmitCacheEntry entry;
+        if (Dict_GetValueAt(&ms_emitCache, i, &entry) && (entry.build != build))
         {
-            i32 iVert = emitToVert[iEmit];
-            float4 A = positions[iVert + 0];
-            float4 B = positions[iVert + 1];
-            float4 C = positions[iVert + 2];
+            Mem_Free(entry.emission);
+            Dict_RmAt(&ms_emitCache, i, NULL);
+        }
+    }
 
-            i32 hits = 0;
-            float4 ros[16];
-            float4 rds[16];
-            bool visibles[16];
-            const i32 hitAttempts = 16;
-            const i32 loopIterations = hitAttempts / NELEM(ros);
-            for (i32 j = 0; j < loopIterations; ++j)
-            {
-                for (i32 k = 0; k < NELEM(ros); ++k)
-                {
-                    float4 t = f4_mulvs(f4_lerpsv(-1.5f, 1.5f, f4_rand(&sampler.rng)), radius);
-                    float4 ro = f4_add(position, t);
-                    ro.w = 0.0f;
-                    float4 at = f4_blend(A, B, C, SampleBaryCoord(Sample2D(&sampler)));
-                    float4 rd = f4_sub(at, ro);
-                    float dist = f4_length3(rd);
-                    rd = f4_divvs(rd, dist);
-                    rd.w = dist - 0.01f * kMilli;
-                    ros[k] = ro;
-                    rds[k] = rd;
-                }
-                RtcOccluded16(rtScene, ros, rds, visibles);
-                for (i32 k = 0; k < NELEM(ros); ++k)
-                {
-                    hits += visibles[k] ? 1 : 0;
-                }
-            }
-            float hitPdf = (float)hits / (float)hitAttempts;
+    ProfileEnd(pm_emissionpdfs);
+}
 
-            dist.pdf[iEmit] = hitPdf;
-        }
+// coplanar emissive triangles of one material merge into a single light.
+// merging is bounded to cells of this size, so that lights stay local.
+#define kEmitMergeMeters    4.0f
+// plane quantization of merged triangles
+#define kEmitNormalSteps    1024.0f
+#define kEmitDistSteps      (1.0f / kMilli)
 
-        Dist1D_Bake(&dist);
-        dists[i] = dist;
-    }
-    SetSampler(sampler);
+typedef struct PtEmitKey_s
+{
+    i32 matId;
+    i32 normal[3];
+    i32 dist;
+    i32 cell[3];
+} PtEmitKey;
+
+static PtEmitKey GetEmitKey(PtScene const *const pim_noalias scene, i32 iVert)
+{
+    float4 const *const pim_noalias positions = scene->positions;
+    i32 const *const pim_noalias tri = scene->indices + iVert;
+    const float4 A = positions[tri[0]];
+    const float4 B = positions[tri[1]];
+    const float4 C = positions[tri[2]];
+    const float4 N = f4_normalize3(f4_cross3(f4_sub(B, A), f4_sub(C, A)));
+    const float4 P = f4_blend(A, B, C, f4_s(1.0f / 3.0f));
+
+    PtEmitKey key;
+    memset(&key, 0, sizeof(key));
+    key.matId = scene->matIds[iVert / 3];
+    key.normal[0] = (i32)roundf(N.x * kEmitNormalSteps);
+    key.normal[1] = (i32)roundf(N.y * kEmitNormalSteps);
+    key.normal[2] = (i32)roundf(N.z * kEmitNormalSteps);
+    key.dist = (i32)roundf(f4_dot3(N, A) * kEmitDistSteps);
+    key.cell[0] = (i32)floorf(P.x / kEmitMergeMeters);
+    key.cell[1] = (i32)floorf(P.y / kEmitMergeMeters);
+    key.cell[2] = (i32)floorf(P.z / kEmitMergeMeters);
+    return key;
 }
 
-static void SetupLightGrid(PtScene*const pim_noalias scene)
+static void SetupEmissives(PtScene*const pim_noalias scene)
 {
-    if (scene->vertCount > 0)
-    {
-        Box3D bounds = box_from_pts(scene->positions, scene->vertCount);
-        float metersPerCell = ConVar_GetFloat(&cv_pt_dist_meters);
-        Grid grid;
-        Grid_New(&grid, bounds, 1.0f / metersPerCell);
-        const i32 len = Grid_Len(&grid);
-        scene->lightGrid = grid;
-        scene->lightDists = Tex_Calloc(sizeof(scene->lightDists[0]) * len);
+    const i32 triCount = scene->indexCount / 3;
 
-        task_SetupLightGrid* task = Temp_Calloc(sizeof(*task));
-        task->scene = scene;
+    float* pim_noalias pdfs = Temp_Alloc(sizeof(pdfs[0]) * i1_max(1, triCount));
+    CalcEmissionPdfs(scene, pdfs);
 
-        Task_Run(task, SetupLightGridFn, len);
+    // group emissive triangles by material and plane
+    Dict lookup;
+    Dict_New(&lookup, sizeof(PtEmitKey), sizeof(i32), EAlloc_Temp);
+    i32 emissiveCount = 0;
+    i32 emitTriCount = 0;
+    i32* memberCounts = NULL;
+    i32* pim_noalias triToEmit = Perm_Alloc(sizeof(triToEmit[0]) * triCount);
+
+    for (i32 iTri = 0; iTri < triCount; ++iTri)
+    {
+        triToEmit[iTri] = -1;
+        float pdf = pdfs[iTri];
+        if (pdf > 0.01f)
+        {
+            const PtEmitKey key = GetEmitKey(scene, iTri * 3);
+            i32 iEmit = -1;
+            if (!Dict_Get(&lookup, &key, &iEmit))
+            {
+                iEmit = emissiveCount;
+                ++emissiveCount;
+                Dict_Add(&lookup, &key, &iEmit);
+                Temp_Reserve(memberCounts, emissiveCount);
+                memberCounts[iEmit] = 0;
+            }
+            triToEmit[iTri] = iEmit;
+            ++memberCounts[iEmit];
+            ++emitTriCount;
+        }
     }
-}
+    Dict_Del(&lookup);
 
-static void PtScene_FindSky(PtScene* scene)
-{
-    scene->sky = NULL;
-    Guid skyname = Guid_FromStr("sky");
-    Cubemaps* maps = Cubemaps_Get();
-    i32 iSky = Cubemaps_Find(maps, skyname);
-    if (iSky >= 0)
+    i32* pim_noalias emitOffsets = Perm_Calloc(sizeof(emitOffsets[0]) * (emissiveCount + 1));
+    i32* pim_noalias emitTris = Perm_Alloc(sizeof(emitTris[0]) * emitTriCount);
+    float* pim_noalias emitCdfs = Perm_Alloc(sizeof(emitCdfs[0]) * emitTriCount);
+    float* pim_noalias emitAreas = Perm_Calloc(sizeof(emitAreas[0]) * emissiveCount);
+    for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
     {
-        scene->sky = &maps->cubemaps[iSky];
+        emitOffsets[iEmit + 1] = emitOffsets[iEmit] + memberCounts[iEmit];
+        memberCounts[iEmit] = 0;
+    }
+
+    // members in triangle order, with a running sum of their area
+    for (i32 iTri = 0; iTri < triCount; ++iTri)
+    {
+        const i32 iEmit = triToEmit[iTri];
+        if (iEmit >= 0)
+        {
+            const i32 i = emitOffsets[iEmit] + memberCounts[iEmit]++;
+            emitAreas[iEmit] += GetArea(scene, iTri * 3);
+            emitTris[i] = iTri;
+            emitCdfs[i] = emitAreas[iEmit];
+        }
+    }
+    for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+    {
+        const float rcpArea = (emitAreas[iEmit] > 0.0f) ? (1.0f / emitAreas[iEmit]) : 0.0f;
+        const i32 begin = emitOffsets[iEmit];
+        const i32 end = emitOffsets[iEmit + 1];
+        for (i32 i = begin; i < end; ++i)
+        {
+            emitCdfs[i] *= rcpArea;
+        }
+        emitCdfs[end - 1] = 1.0f;
     }
+
+    scene->triToEmit = triToEmit;
+    scene->emissiveCount = emissiveCount;
+    scene->emitTriCount = emitTriCount;
+    scene->emitOffsets = emitOffsets;
+    scene->emitTris = emitTris;
+    scene->emitCdfs = emitCdfs;
+    scene->emitAreas = emitAreas;
 }
 
-ProfileMark(pm_scene_update, PtScene_Update)
-void PtScene_Update(PtScene* scene)
+// member triangle of an emissive, chosen in proportion to its area
+pim_inline i32 VEC_CALL SampleEmitTri(
+    PtScene const *const pim_noalias scene,
+    i32 iEmit,
+    float u)
 {
-    ProfileBegin(pm_scene_update);
-
-    if (Entities_Get()->modtime != scene->modtime)
+    float const *const pim_noalias cdfs = scene->emitCdfs;
+    i32 lo = scene->emitOffsets[iEmit];
+    i32 hi = scene->emitOffsets[iEmit + 1] - 1;
+    while (lo < hi)
     {
-        PtScene_Clear(scene);
-        PtScene_Init(scene);
+        i32 mid = (lo + hi) >> 1;
+        if (cdfs[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
     }
-    PtScene_FindSky(scene);
-    UpdateDists(scene);
-
-    ProfileEnd(pm_scene_update);
+    return scene->emitTris[lo];
 }
 
-static void PtScene_Init(PtScene* scene)
+// point uniformly distributed over the area of an emissive.
+// returns the member triangle's first vertex, wuvOut: barycentrics within it
+pim_inline i32 VEC_CALL SampleEmitPoint(
+    PtSampler *const pim_noalias sampler,
+    PtScene const *const pim_noalias scene,
+    i32 iEmit,
+    float4 *const pim_noalias ptOut,
+    float4 *const pim_noalias wuvOut)
 {
-    PtScene_FindSky(scene);
-    FlattenDrawables(scene);
-    SetupEmissives(scene);
-    media_desc_new(&scene->mediaDesc);
-    scene->rtcScene = RtcNewScene(scene);
-    SetupLightGrid(scene);
+    const i32 iVert = SampleEmitTri(scene, iEmit, Sample1D(sampler)) * 3;
+    const float4 wuv = SampleBaryCoord(Sample2D(sampler));
+    float4 const *const pim_noalias positions = scene->positions;
+    i32 const *const pim_noalias tri = scene->indices + iVert;
+    *ptOut = f4_blend(positions[tri[0]], positions[tri[1]], positions[tri[2]], wuv);
+    *wuvOut = wuv;
+    return iVert;
+}
 
-    scene->modtime = Entities_Get()->modtime;
+// area of the emissive containing the triangle, or of the triangle alone
+pim_inline float VEC_CALL GetLightArea(PtScene const *const pim_noalias scene, i32 iVert)
+{
+    const i32 iEmit = scene->triToEmit[iVert / 3];
+    return (iEmit >= 0) ? scene->emitAreas[iEmit] : GetArea(scene, iVert);
 }
 
-static void PtScene_Clear(PtScene* scene)
+// ----------------------------------------------------------------------------
+// light grid cells: sparse, 16 bit quantized distributions in a single pool
+
+#define kLightCellRange     (1 << 16)
+// keeps alias table arithmetic within 32 bits
+#define kLightCellMaxCount  (1 << 15)
+// seconds without movement before the light tree and the top level bvh
+// are rebuilt for tracing, see UpdateLights and SettleRtcScene
+#define kSceneSettleSec     1.0
+// direct mapped hit counters per thread, keeps hot entries off shared cache lines
+#define kLightTallyShift    10
+#define kLightTallySlots    (1 << kLightTallyShift)
+// direct mapped hits on emissives a cell lacks, per thread
+#define kLightMissShift     8
+#define kLightMissSlots     (1 << kLightMissShift)
+
+// quantizes weights into the entries' probability ranges, then bakes an
+// exact integer alias table from the same quantized ranges.
+// weights is scratch memory and is clobbered.
+static void LightCell_Bake(
+    PtLightEntry*const pim_noalias entries,
+    float*const pim_noalias weights,
+    i32 count)
 {
-    if (scene->rtcScene)
+    ASSERT(count <= kLightCellMaxCount);
+    if (count <= 0)
     {
-        RTCScene rtcScene = scene->rtcScene;
-        rtc.ReleaseScene(rtcScene);
-        scene->rtcScene = NULL;
+        return;
     }
 
-    Mem_Free(scene->positions);
-    Mem_Free(scene->normals);
-    Mem_Free(scene->uvs);
-    Mem_Free(scene->matIds);
-    Mem_Free(scene->vertToEmit);
-
-    Mem_Free(scene->materials);
-
-    Mem_Free(scene->emitToVert);
-
+    float sum = 0.0f;
+    for (i32 i = 0; i < count; ++i)
+    {
+        sum += weights[i];
+    }
+    const float rcpSum = (sum > 0.0f) ? (1.0f / sum) : 0.0f;
+
+    // every entry keeps at least 1/65536, the largest absorbs rounding
+    const u32 spare = kLightCellRange - count;
+    u32* const pim_noalias widths = (u32*)weights;
+    u32 total = 0;
+    i32 iLargest = 0;
+    for (i32 i = 0; i < count; ++i)
     {
-        const i32 gridLen = Grid_Len(&scene->lightGrid);
-        Dist1D* lightDists = scene->lightDists;
-        for (i32 i = 0; i < gridLen; ++i)
+        float p = (sum > 0.0f) ? (weights[i] * rcpSum) : (1.0f / count);
+        u32 width = 1 + (u32)f1_clamp(p * spare, 0.0f, (float)spare);
+        widths[i] = width;
+        total += width;
+        if (width > widths[iLargest])
         {
-            Dist1D_Del(lightDists + i);
+            iLargest = i;
         }
-        Mem_Free(scene->lightDists);
     }
+    widths[iLargest] = (u32)((i32)widths[iLargest] + (kLightCellRange - (i32)total));
+    ASSERT((i32)widths[iLargest] >= 1);
 
-    memset(scene, 0, sizeof(*scene));
-}
-
-PtScene* PtScene_New(void)
-{
-    ASSERT(ms_device);
-    if (!ms_device)
+    u32 start = 0;
+    for (i32 i = 0; i < count; ++i)
     {
-        return NULL;
+        entries[i].cdf = (u16)start;
+        entries[i].pdf = (u16)(widths[i] - 1);
+        entries[i].alias = (u16)i;
+        start += widths[i];
     }
-    PtScene* scene = Perm_Calloc(sizeof(*scene));
-    PtScene_Init(scene);
-    return scene;
-}
 
-void PtScene_Del(PtScene* scene)
-{
-    if (scene)
+    // each alias bin holds kLightCellRange units of width * count
+    u32* const pim_noalias prob = widths;
+    for (i32 i = 0; i < count; ++i)
     {
-        PtScene_Clear(scene);
-        Mem_Free(scene);
+        prob[i] = prob[i] * (u32)count;
     }
-}
-
-void PtScene_Gui(PtScene* scene)
-{
-    if (scene && igExCollapsingHeader1("pt scene"))
+    i32 scan = 0;
+    while ((scan < count) && (prob[scan] >= kLightCellRange))
     {
-        igIndent(0.0f);
-        igText("Vertex Count: %d", scene->vertCount);
-        igText("Material Count: %d", scene->matCount);
-        igText("Emissive Count: %d", scene->emissiveCount);
-        media_desc_gui(&scene->mediaDesc);
-        igUnindent(0.0f);
+        ++scan;
     }
-}
-
-void PtTrace_New(
-    PtTrace* trace,
-    PtScene* scene,
-    int2 imageSize)
-{
-    ASSERT(trace);
-    ASSERT(scene);
-    if (trace)
+    i32 large = 0;
+    while ((large < count) && (prob[large] < kLightCellRange))
     {
-        const i32 texelCount = imageSize.x * imageSize.y;
-        ASSERT(texelCount > 0);
-
-        trace->imageSize = imageSize;
-        trace->scene = scene;
-        trace->sampleWeight = 1.0f;
-        trace->color = Tex_Calloc(sizeof(trace->color[0]) * texelCount);
-        trace->albedo = Tex_Calloc(sizeof(trace->albedo[0]) * texelCount);
-        trace->normal = Tex_Calloc(sizeof(trace->normal[0]) * texelCount);
-        trace->denoised = Tex_Calloc(sizeof(trace->denoised[0]) * texelCount);
-        DofInfo_New(&trace->dofinfo);
+        ++large;
+    }
+    i32 small = scan;
+    while ((small < count) && (large < count))
+    {
+        entries[small].alias = (u16)large;
+        prob[large] -= kLightCellRange - prob[small];
+        if ((prob[large] < kLightCellRange) && (large < scan))
+        {
+            // large became small behind the scan; fill it next
+            small = large;
+            do { ++large; } while ((large < count) && (prob[large] < kLightCellRange));
+        }
+        else
+        {
+            if (prob[large] < kLightCellRange)
+            {
+                // ahead of the scan, picked up as a small later
+                do { ++large; } while ((large < count) && (prob[large] < kLightCellRange));
+            }
+            do { ++scan; } while ((scan < count) && (prob[scan] >= kLightCellRange));
+            small = scan;
+        }
+    }
+    for (i32 i = 0; i < count; ++i)
+    {
+        entries[i].aliasProb = (u16)i1_min((i32)prob[i], kLightCellRange - 1);
     }
 }
 
-void PtTrace_Del(PtTrace* trace)
+pim_inline float LightEntry_Pdf(const PtLightEntry* entry)
 {
-    if (trace)
-    {
-        Mem_Free(trace->color);
-        Mem_Free(trace->albedo);
-        Mem_Free(trace->normal);
-        Mem_Free(trace->denoised);
-        memset(trace, 0, sizeof(*trace));
-    }
+    return (entry->pdf + 1) * (1.0f / kLightCellRange);
 }
 
-void PtTrace_Gui(PtTrace* trace)
+// returns the entry of iEmit within the cell, or -1
+pim_inline i32 LightCell_Find(
+    PtLightEntry const *const pim_noalias entries,
+    i32 count,
+    i32 iEmit)
 {
-    if (trace && igExCollapsingHeader1("pt trace"))
+    i32 lo = 0;
+    i32 hi = count - 1;
+    while (lo <= hi)
     {
-        igIndent(0.0f);
-        DofInfo_Gui(&trace->dofinfo);
-        PtScene_Gui(trace->scene);
-        igUnindent(0.0f);
+        i32 mid = (lo + hi) >> 1;
+        i32 x = entries[mid].iEmit;
+        if (x < iEmit)
+        {
+            lo = mid + 1;
+        }
+        else if (x > iEmit)
+        {
+            hi = mid - 1;
+        }
+        else
+        {
+            return mid;
+        }
     }
+    return -1;
 }
 
-void DofInfo_New(PtDofInfo* dof)
+pim_inline i32 LightCell_Sample(
+    PtLightEntry const *const pim_noalias entries,
+    i32 count,
+    bool alias,
+    float u)
 {
-    if (dof)
+    if (alias)
     {
-        dof->aperture = 5.0f * kMilli;
-        dof->focalLength = 6.0f;
-        dof->bladeCount = 5;
-        dof->bladeRot = kPi / 10.0f;
-        dof->focalPlaneCurvature = 0.05f;
-        dof->autoFocus = true;
-        dof->autoFocusSpeed = 3.0f;
+        float x = u * count;
+        i32 i = i1_clamp((i32)x, 0, count - 1);
+        i32 t = i1_clamp((i32)((x - i) * kLightCellRange), 0, kLightCellRange - 1);
+        i32 j = entries[i].alias;
+        return ((j == i) || (t < entries[i].aliasProb)) ? i : j;
+    }
+    // last entry whose range starts at or before u
+    i32 target = i1_clamp((i32)(u * kLightCellRange), 0, kLightCellRange - 1);
+    i32 first = 0;
+    i32 len = count;
+    while (len > 0)
+    {
+        i32 half = len >> 1;
+        i32 middle = first + half;
+        if (entries[middle].cdf <= target)
+        {
+            first = middle + 1;
+            len = len - (half + 1);
+        }
+        else
+        {
+            len = half;
+        }
     }
+    return i1_clamp(first - 1, 0, count - 1);
 }
 
-void DofInfo_Gui(PtDofInfo* dof)
+// adapts the cell to its live hit counters, see Dist1D_Update
+static void LightCell_Update(
+    PtLightCell*const pim_noalias cell,
+    PtLightEntry*const pim_noalias entries,
+    float*const pim_noalias weights)
 {
-    if (dof && igExCollapsingHeader1("dofinfo"))
+    const i32 count = cell->count;
+    if (count > 0)
     {
-        float aperture = dof->aperture / kMilli;
-        igExSliderFloat("Aperture, millimeters", &aperture, 0.1f, 100.0f);
-        dof->aperture = aperture * kMilli;
-        igCheckbox("Autofocus", &dof->autoFocus);
-        if (dof->autoFocus)
+        u32 sum = 0;
+        for (i32 i = 0; i < count; ++i)
         {
-            igExSliderFloat("Autofocus Rate", &dof->autoFocusSpeed, 0.01f, 10.0f);
+            sum += entries[i].live;
         }
-        else
+        if (sum < 30)
         {
-            float focalLength = log2f(dof->focalLength);
-            igExSliderFloat("Focal Length, log2 meters", &focalLength, -5.0f, 10.0f);
-            dof->focalLength = exp2f(focalLength);
+            // less than 30 is a very very weak distribution
+            return;
         }
-        igText("Focal Length, meters: %f", dof->focalLength);
-        igExSliderFloat("Focal Plane Curvature", &dof->focalPlaneCurvature, 0.0f, 1.0f);
-        igExSliderInt("Blade Count", &dof->bladeCount, 3, 666);
-        igExSliderFloat("Blade Rotation", &dof->bladeRot, 0.0f, kTau);
+        const float scale = 1.0f / sum;
+        const u32 prevSum = cell->sum;
+        cell->sum = sum;
+        float alpha = 0.5f;
+        if (prevSum > 0)
+        {
+            double ratio = (double)sum / (double)prevSum;
+            alpha = f1_saturate((float)ratio) * 0.9f;
+            alpha = alpha * alpha;
+        }
+        for (i32 i = 0; i < count; ++i)
+        {
+            u32 ct = entries[i].live;
+            weights[i] = f1_lerp(LightEntry_Pdf(entries + i), ct * scale, alpha);
+            entries[i].live = (ct >> 1); // retain some memory from last update
+        }
+        LightCell_Bake(entries, weights, count);
     }
 }
 
-pim_inline float4 VEC_CALL GetPosition(
-    const PtScene *const pim_noalias scene,
-    PtRayHit hit)
+// per thread hit counters of a built or restored grid
+static void NewLightTallies(PtScene*const pim_noalias scene)
 {
-    float4 const *const pim_noalias positions = scene->positions;
-    return f4_blend(
-        positions[hit.iVert + 0],
-        positions[hit.iVert + 1],
-        positions[hit.iVert + 2],
-        hit.wuvt);
+    scene->lightTallies = Tex_Calloc(sizeof(scene->lightTallies[0]) * kMaxThreads * kLightTallySlots);
+    scene->lightMisses = Tex_Calloc(sizeof(scene->lightMisses[0]) * kMaxThreads * kLightMissSlots);
 }
 
-pim_inline float4 VEC_CALL GetNormal(
-    const PtScene *const pim_noalias scene,
-    PtRayHit hit)
+static i32 CmpLightMiss(const void* lhs, const void* rhs, void* usr)
 {
-    float4 const *const pim_noalias normals = scene->normals;
-    float4 N = f4_blend(
-        normals[hit.iVert + 0],
-        normals[hit.iVert + 1],
-        normals[hit.iVert + 2],
-        hit.wuvt);
+    PtLightMiss const *const a = lhs;
+    PtLightMiss const *const b = rhs;
+    if (a->cell != b->cell)
+    {
+        return (a->cell < b->cell) ? -1 : 1;
+    }
+    if (a->iEmit != b->iEmit)
+    {
+        return (a->iEmit < b->iEmit) ? -1 : 1;
+    }
+    return 0;
+}
+
+// adds the emissives that paths hit from cells whose probes missed them,
+// or that moved into view since the grid was built. existing entries keep
+// their probability, an added one starts with an even share of the cell.
+// repacks the pool, so no trace may be in flight.
+ProfileMark(pm_addlightmisses, AddLightMisses)
+static void AddLightMisses(PtScene*const pim_noalias scene)
+{
+    PtLightMiss *const pim_noalias misses = scene->lightMisses;
+    const i32 slotCount = kMaxThreads * kLightMissSlots;
+    i32 addCount = 0;
+    for (i32 i = 0; i < slotCount; ++i)
+    {
+        addCount += (misses[i].cell > 0) ? 1 : 0;
+    }
+    if (addCount == 0)
+    {
+        return;
+    }
+
+    ProfileBegin(pm_addlightmisses);
+
+    PtLightMiss *const pim_noalias adds = Tex_Alloc(sizeof(adds[0]) * addCount);
+    addCount = 0;
+    for (i32 i = 0; i < slotCount; ++i)
+    {
+        if (misses[i].cell > 0)
+        {
+            adds[addCount++] = misses[i];
+            misses[i].cell = 0;
+            misses[i].amt = 0;
+        }
+    }
+    QuickSort(adds, addCount, sizeof(adds[0]), CmpLightMiss, NULL);
+
+    PtLightCell *const pim_noalias cells = scene->lightCells;
+    PtLightEntry const *const pim_noalias prevEntries = scene->lightEntries;
+    const i32 len = Grid_Len(&scene->lightGrid);
+    PtLightEntry *const pim_noalias entries = Tex_Alloc(
+        sizeof(entries[0]) * (scene->lightEntryCount + addCount));
+    float *const pim_noalias weights = Tex_Alloc(sizeof(weights[0]) * kLightCellMaxCount);
+
+    i32 offset = 0;
+    i32 iAdd = 0;
+    for (i32 iCell = 0; iCell < len; ++iCell)
+    {
+        const PtLightCell cell = cells[iCell];
+        PtLightEntry const *const pim_noalias src = prevEntries + cell.offset;
+        PtLightEntry *const pim_noalias dst = entries + offset;
+        i32 count = 0;
+        i32 added = 0;
+        i32 j = 0;
+        // both are in ascending iEmit order, merge them
+        while (true)
+        {
+            const bool hasAdd = (iAdd < addCount) && (adds[iAdd].cell == iCell + 1);
+            if (!hasAdd && (j >= cell.count))
+            {
+                break;
+            }
+            if (hasAdd && ((j >= cell.count) || (adds[iAdd].iEmit < src[j].iEmit)))
+            {
+                if ((count + cell.count - j) < kLightCellMaxCount)
+                {
+                    memset(dst + count, 0, sizeof(dst[0]));
+                    dst[count].iEmit = adds[iAdd].iEmit;
+                    dst[count].live = adds[iAdd].amt;
+                    weights[count] = -1.0f;
+                    ++count;
+                    ++added;
+                }
+                ++iAdd;
+            }
+            else
+            {
+                dst[count] = src[j];
+                weights[count] = LightEntry_Pdf(src + j);
+                if (hasAdd && (adds[iAdd].iEmit == src[j].iEmit))
+                {
+                    dst[count].live += adds[iAdd].amt;
+                    ++iAdd;
+                }
+                ++count;
+                ++j;
+            }
+        }
+        if (added > 0)
+        {
+            for (i32 k = 0; k < count; ++k)
+            {
+                weights[k] = (weights[k] < 0.0f) ? (1.0f / count) : weights[k];
+            }
+            LightCell_Bake(dst, weights, count);
+        }
+        cells[iCell].offset = offset;
+        cells[iCell].count = count;
+        offset += count;
+    }
+    ASSERT(iAdd == addCount);
+
+    Mem_Free(weights);
+    Mem_Free(adds);
+    Mem_Free(scene->lightEntries);
+    scene->lightEntries = entries;
+    scene->lightEntryCount = offset;
+
+    ProfileEnd(pm_addlightmisses);
+}
+
+// entries of the cells a thread has built, until packed into the pool
+typedef struct PtLightGridStage_s
+{
+    PtLightEntry* entries;
+    i32 count;
+    i32 capacity;
+} PtLightGridStage;
+
+typedef struct task_SetupLightGrid
+{
+    Task task;
+    PtScene* scene;
+    // the stage holding each cell's entries, at the cell's offset
+    // [lightGrid.size]
+    u8* cellStage;
+    // [kMaxThreads]
+    PtLightGridStage stages[kMaxThreads];
+    // bsp visibility of the map, may be empty
+    Pvs const* pvs;
+    // pvs leafs on either side of each emissive member, 0: solid on both sides
+    // [emitTriCount]
+    int2* emitLeafs;
+} task_SetupLightGrid;
+
+// leafs on the front and back of each emissive member triangle.
+// a solid side takes the leaf of the other side.
+static int2* FindEmitLeafs(PtScene const *const pim_noalias scene, Pvs const *const pvs)
+{
+    if (Pvs_IsEmpty(pvs))
+    {
+        return NULL;
+    }
+    float4 const *const pim_noalias positions = scene->positions;
+    i32 const *const pim_noalias indices = scene->indices;
+    const i32 emitTriCount = scene->emitTriCount;
+    i32 const *const pim_noalias emitTris = scene->emitTris;
+
+    int2 *const pim_noalias emitLeafs = Tex_Alloc(sizeof(emitLeafs[0]) * i1_max(1, emitTriCount));
+    for (i32 i = 0; i < emitTriCount; ++i)
+    {
+        i32 const *const pim_noalias tri = indices + emitTris[i] * 3;
+        float4 A = positions[tri[0]];
+        float4 B = positions[tri[1]];
+        float4 C = positions[tri[2]];
+        float4 P = f4_blend(A, B, C, f4_s(1.0f / 3.0f));
+        float4 N = f4_normalize3(f4_cross3(f4_sub(B, A), f4_sub(C, A)));
+        N = f4_mulvs(N, kCenti);
+        int2 leafs;
+        leafs.x = Pvs_FindLeaf(pvs, f4_add(P, N));
+        leafs.y = Pvs_FindLeaf(pvs, f4_sub(P, N));
+        leafs.x = leafs.x ? leafs.x : leafs.y;
+        leafs.y = leafs.y ? leafs.y : leafs.x;
+        emitLeafs[i] = leafs;
+    }
+    return emitLeafs;
+}
+
+// leafs potentially visible from anywhere in a cell's ray origin box.
+// the box is sampled on a lattice, skipping solid points.
+static void CellPvsRow(
+    Pvs const *const pvs,
+    float4 position,
+    float extent,
+    u8 *const pim_noalias row)
+{
+    memset(row, 0, Pvs_RowSize(pvs));
+    bool any = false;
+    for (i32 z = -1; z <= 1; ++z)
+    {
+        for (i32 y = -1; y <= 1; ++y)
+        {
+            for (i32 x = -1; x <= 1; ++x)
+            {
+                float4 pt = f4_add(position, f4_mulvs(f4_v((float)x, (float)y, (float)z, 0.0f), extent));
+                i32 leaf = Pvs_FindLeaf(pvs, pt);
+                if (leaf > 0)
+                {
+                    Pvs_OrRow(pvs, leaf, row);
+                    any = true;
+                }
+            }
+        }
+    }
+    if (!any)
+    {
+        Pvs_OrRow(pvs, 0, row);
+    }
+}
+
+static void SetupLightGridFn(void* pbase, i32 begin, i32 end)
+{
+    task_SetupLightGrid* task = (task_SetupLightGrid*)pbase;
+
+    PtScene*const pim_noalias scene = task->scene;
+
+    const Grid grid = scene->lightGrid;
+    PtLightCell *const pim_noalias cells = scene->lightCells;
+    u8 *const pim_noalias cellStage = task->cellStage;
+    const i32 tid = Task_ThreadId();
+    PtLightGridStage *const pim_noalias stage = &task->stages[tid];
+
+    const i32 emissiveCount = scene->emissiveCount;
+    i32 const *const pim_noalias emitOffsets = scene->emitOffsets;
+
+    const float metersPerCell = ConVar_GetFloat(&cv_pt_dist_meters);
+    const float radius = metersPerCell * 0.666f;
+    PtSampler sampler = GetSampler();
+
+    float4 hamm[16];
+    for (i32 i = 0; i < NELEM(hamm); ++i)
+    {
+        float2 Xi = Hammersley2D(i, NELEM(hamm));
+        hamm[i] = SampleUnitSphere(Xi);
+    }
+
+    RTCScene rtScene = scene->rtcScene;
+
+    // scratch of the largest cell, kept out of the temp arena
+    const i32 maxCount = i1_min(emissiveCount, kLightCellMaxCount);
+    float*const pim_noalias weights = Tex_Alloc(sizeof(weights[0]) * i1_max(1, maxCount));
+    i32*const pim_noalias emits = Tex_Alloc(sizeof(emits[0]) * i1_max(1, maxCount));
+
+    Pvs const *const pvs = task->pvs;
+    int2 const *const pim_noalias emitLeafs = task->emitLeafs;
+    u8*const pim_noalias pvsRow = emitLeafs ? Tex_Alloc(Pvs_RowSize(pvs)) : NULL;
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        float4 position = Grid_Position(&grid, i);
+        position.w = radius + 0.01f * kMilli;
+        {
+            PointQueryUserData query = RtcPointQuery(scene, position);
+            if (query.distance > radius)
+            {
+                // far from a surface. might be inside or outside the map
+                // toss some rays and see if they are backfaces
+                float hitcount = 0.0f;
+                for (i32 j = 0; j < NELEM(hamm); ++j)
+                {
+                    PtRayHit hit = pt_intersect_local(scene, position, hamm[j], 0.0f, 1 << 20);
+                    if (hit.type == PtHit_Triangle)
+                    {
+                        ++hitcount;
+                    }
+                }
+                float hitratio = hitcount / NELEM(hamm);
+                if (hitratio < 0.5f)
+                {
+                    continue;
+                }
+            }
+        }
+
+        if (emitLeafs)
+        {
+            CellPvsRow(pvs, position, radius * 1.5f, pvsRow);
+        }
+
+        i32 count = 0;
+        for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+        {
+            if (count >= kLightCellMaxCount)
+            {
+                break;
+            }
+            if (emitLeafs)
+            {
+                // no side of any member is visible from the cell
+                bool visible = false;
+                for (i32 j = emitOffsets[iEmit]; (j < emitOffsets[iEmit + 1]) && !visible; ++j)
+                {
+                    const int2 leafs = emitLeafs[j];
+                    visible = Pvs_RowHas(pvs, pvsRow, leafs.x) || Pvs_RowHas(pvs, pvsRow, leafs.y);
+                }
+                if (!visible)
+                {
+                    continue;
+                }
+            }
+
+            i32 hits = 0;
+            float4 ros[16];
+            float4 rds[16];
+            bool visibles[16];
+            const i32 hitAttempts = 16;
+            const i32 loopIterations = hitAttempts / NELEM(ros);
+            for (i32 j = 0; j < loopIterations; ++j)
+            {
+                for (i32 k = 0; k < NELEM(ros); ++k)
+                {
+                    float4 t = f4_mulvs(f4_lerpsv(-1.5f, 1.5f, f4_rand(&sampler.rng)), radius);
+                    float4 ro = f4_add(position, t);
+                    ro.w = 0.0f;
+                    float4 at, wuv;
+                    SampleEmitPoint(&sampler, scene, iEmit, &at, &wuv);
+                    float4 rd = f4_sub(at, ro);
+                    float dist = f4_length3(rd);
+                    rd = f4_divvs(rd, dist);
+                    rd.w = dist - 0.01f * kMilli;
+                    ros[k] = ro;
+                    rds[k] = rd;
+                }
+                RtcOccluded16(rtScene, ros, rds, visibles, NELEM(ros));
+                for (i32 k = 0; k < NELEM(ros); ++k)
+                {
+                    hits += visibles[k] ? 1 : 0;
+                }
+            }
+            float hitPdf = (float)hits / (float)hitAttempts;
+
+            // only visible emissives are stored
+            if (hitPdf > 0.0f)
+            {
+                weights[count] = hitPdf;
+                emits[count] = iEmit;
+                ++count;
+            }
+        }
+
+        if (count > 0)
+        {
+            if ((stage->count + count) > stage->capacity)
+            {
+                stage->capacity = i1_max(stage->count + count, stage->capacity * 2);
+                stage->entries = Tex_Realloc(stage->entries, sizeof(stage->entries[0]) * stage->capacity);
+            }
+            PtLightEntry*const pim_noalias entries = stage->entries + stage->count;
+            memset(entries, 0, sizeof(entries[0]) * count);
+            for (i32 j = 0; j < count; ++j)
+            {
+                entries[j].iEmit = emits[j];
+            }
+            LightCell_Bake(entries, weights, count);
+            cells[i].offset = stage->count;
+            cells[i].count = count;
+            cellStage[i] = (u8)tid;
+            stage->count += count;
+        }
+    }
+    SetSampler(sampler);
+
+    Mem_Free(weights);
+    Mem_Free(emits);
+    Mem_Free(pvsRow);
+}
+
+static void SetupLightGrid(PtScene*const pim_noalias scene)
+{
+    if (scene->vertCount > 0)
+    {
+        Box3D bounds = box_from_pts(scene->positions, scene->vertCount);
+        float metersPerCell = ConVar_GetFloat(&cv_pt_dist_meters);
+        Grid grid;
+        Grid_New(&grid, bounds, 1.0f / metersPerCell);
+        const i32 len = Grid_Len(&grid);
+        scene->lightGrid = grid;
+        scene->lightAlias = ConVar_GetBool(&cv_pt_light_alias);
+        PtLightCell*const pim_noalias cells = Tex_Calloc(sizeof(cells[0]) * len);
+        scene->lightCells = cells;
+
+        task_SetupLightGrid* task = Tex_Calloc(sizeof(*task));
+        task->scene = scene;
+        task->cellStage = Tex_Calloc(sizeof(task->cellStage[0]) * len);
+        task->pvs = &Entities_Get()->pvs;
+        task->emitLeafs = FindEmitLeafs(scene, task->pvs);
+
+        // counts and bakes each cell's entries into its thread's stage
+        Task_Run(task, SetupLightGridFn, len);
+
+        i32 entryCount = 0;
+        for (i32 i = 0; i < kMaxThreads; ++i)
+        {
+            entryCount += task->stages[i].count;
+        }
+
+        // prefix sum the counts, then pack into the pool
+        PtLightEntry*const pim_noalias entries = Tex_Alloc(sizeof(entries[0]) * i1_max(1, entryCount));
+        i32 offset = 0;
+        for (i32 i = 0; i < len; ++i)
+        {
+            const i32 count = cells[i].count;
+            if (count > 0)
+            {
+                PtLightGridStage const *const stage = &task->stages[task->cellStage[i]];
+                memcpy(entries + offset, stage->entries + cells[i].offset, sizeof(entries[0]) * count);
+            }
+            cells[i].offset = offset;
+            offset += count;
+        }
+        ASSERT(offset == entryCount);
+
+        for (i32 i = 0; i < kMaxThreads; ++i)
+        {
+            Mem_Free(task->stages[i].entries);
+        }
+        Mem_Free(task->cellStage);
+        Mem_Free(task->emitLeafs);
+        Mem_Free(task);
+
+        scene->lightEntries = entries;
+        scene->lightEntryCount = entryCount;
+        NewLightTallies(scene);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// saved lights: emissives and light grid restored from a map crate,
+// skipping their rebuild when the scene is unchanged.
+
+static u64 HashTexGuid(TextureId id, u64 hash)
+{
+    Guid guid = { 0 };
+    Texture_GetGuid(id, &guid);
+    hash = Fnv64Qword(guid.a, hash);
+    hash = Fnv64Qword(guid.b, hash);
+    return hash;
+}
+
+// guids name textures, a re-imported texture keeps its guid.
+// materials share textures, so each is hashed once into contents.
+static u64 HashTexContent(Dict *const contents, TextureId id, u64 hash)
+{
+    u64 content = 0;
+    if (Dict_Get(contents, &id, &content))
+    {
+        return Fnv64Qword(content, hash);
+    }
+    content = HashTexGuid(id, Fnv64Bias);
+    Texture const *const tex = Texture_Get(id);
+    if (tex && tex->texels)
+    {
+        const i32 bytes = (tex->size.x * tex->size.y * vkrFormatToBpp(tex->format)) / 8;
+        content = Fnv64Bytes(&tex->size, sizeof(tex->size), content);
+        content = Fnv64Dword(tex->format, content);
+        content = Fnv64Bytes(tex->texels, bytes, content);
+    }
+    Dict_Set(contents, &id, &content);
+    return Fnv64Qword(content, hash);
+}
+
+// hash of everything the saved lights derive from
+static u64 HashLightInputs(PtScene const *const pim_noalias scene)
+{
+    u64 hash = Fnv64Bias;
+    hash = Fnv64Dword(kDiskPtLightsVersion, hash);
+    hash = Fnv64Dword(scene->vertCount, hash);
+    hash = Fnv64Dword(scene->indexCount, hash);
+    hash = Fnv64Bytes(scene->positions, sizeof(scene->positions[0]) * scene->vertCount, hash);
+    hash = Fnv64Bytes(scene->normals, sizeof(scene->normals[0]) * scene->vertCount, hash);
+    hash = Fnv64Bytes(scene->uvs, sizeof(scene->uvs[0]) * scene->vertCount, hash);
+    hash = Fnv64Bytes(scene->indices, sizeof(scene->indices[0]) * scene->indexCount, hash);
+    hash = Fnv64Bytes(scene->matIds, sizeof(scene->matIds[0]) * (scene->indexCount / 3), hash);
+    // texture ids differ between runs, their guids do not.
+    // emission and flux read albedo and rome texels, so those hash fully.
+    Dict contents;
+    Dict_New(&contents, sizeof(TextureId), sizeof(u64), EAlloc_Temp);
+    for (i32 i = 0; i < scene->matCount; ++i)
+    {
+        Material const *const mat = scene->materials + i;
+        hash = HashTexContent(&contents, mat->albedo, hash);
+        hash = HashTexContent(&contents, mat->rome, hash);
+        hash = HashTexGuid(mat->normal, hash);
+        hash = Fnv64Dword(mat->flags, hash);
+        hash = Fnv64Bytes(&mat->meanFreePath, sizeof(mat->meanFreePath), hash);
+        hash = Fnv64Bytes(&mat->ior, sizeof(mat->ior), hash);
+        hash = Fnv64Bytes(&mat->bumpiness, sizeof(mat->bumpiness), hash);
+    }
+    Dict_Del(&contents);
+    return hash;
+}
+
+static void LightBake_Del(PtLightBake *const bake)
+{
+    Mem_Free(bake->triToEmit);
+    Mem_Free(bake->emitOffsets);
+    Mem_Free(bake->emitTris);
+    Mem_Free(bake->emitCdfs);
+    Mem_Free(bake->emitAreas);
+    Mem_Free(bake->cells);
+    Mem_Free(bake->entries);
+    memset(bake, 0, sizeof(*bake));
+}
+
+// moves the held lights into the scene when they were saved from the same
+// geometry and materials. the grid is taken only under the same settings.
+ProfileMark(pm_restorelights, RestoreLights)
+static bool RestoreLights(PtScene *const pim_noalias scene)
+{
+    PtLightBake *const bake = &ms_lightBake;
+    if (!bake->triToEmit)
+    {
+        return false;
+    }
+
+    ProfileBegin(pm_restorelights);
+
+    DiskPtLights const hdr = bake->hdr;
+    const bool valid =
+        (hdr.triCount == scene->indexCount / 3) &&
+        (hdr.hash == HashLightInputs(scene));
+    if (valid)
+    {
+        scene->triToEmit = bake->triToEmit;
+        scene->emissiveCount = hdr.emissiveCount;
+        scene->emitTriCount = hdr.emitTriCount;
+        scene->emitOffsets = bake->emitOffsets;
+        scene->emitTris = bake->emitTris;
+        scene->emitCdfs = bake->emitCdfs;
+        scene->emitAreas = bake->emitAreas;
+        bake->triToEmit = NULL;
+        bake->emitOffsets = NULL;
+        bake->emitTris = NULL;
+        bake->emitCdfs = NULL;
+        bake->emitAreas = NULL;
+
+        const bool gridMatches =
+            (scene->lightSelect == PtLightSelect_Grid) &&
+            bake->cells &&
+            (hdr.grid.cellsPerMeter == 1.0f / ConVar_GetFloat(&cv_pt_dist_meters)) &&
+            (hdr.alias == (ConVar_GetBool(&cv_pt_light_alias) ? 1 : 0));
+        if (gridMatches)
+        {
+            scene->lightGrid = hdr.grid;
+            scene->lightAlias = hdr.alias != 0;
+            scene->lightCells = bake->cells;
+            scene->lightEntries = bake->entries;
+            scene->lightEntryCount = hdr.entryCount;
+            NewLightTallies(scene);
+            bake->cells = NULL;
+            bake->entries = NULL;
+        }
+        Con_Logf(LogSev_Info, "pt", "Restored %d saved emissives%s.",
+            hdr.emissiveCount, gridMatches ? " and light grid" : "");
+    }
+    // one scene build either uses the held lights or outdates them
+    LightBake_Del(bake);
+
+    ProfileEnd(pm_restorelights);
+    return valid;
+}
+
+bool PtScene_SaveLights(Crate* crate, PtScene const* scene)
+{
+    if (!scene || !scene->triToEmit)
+    {
+        return true;
+    }
+
+    const i32 triCount = scene->indexCount / 3;
+    const i32 gridLen = scene->lightCells ? Grid_Len(&scene->lightGrid) : 0;
+
+    DiskPtLights hdr = { 0 };
+    hdr.version = kDiskPtLightsVersion;
+    hdr.triCount = triCount;
+    hdr.hash = HashLightInputs(scene);
+    hdr.emissiveCount = scene->emissiveCount;
+    hdr.emitTriCount = scene->emitTriCount;
+    if (gridLen > 0)
+    {
+        hdr.entryCount = scene->lightEntryCount;
+        hdr.alias = scene->lightAlias ? 1 : 0;
+        hdr.grid = scene->lightGrid;
+    }
+
+    bool wrote = true;
+    wrote &= Crate_Set(crate, Guid_FromStr("ptlights"), &hdr, sizeof(hdr));
+    wrote &= Crate_Set(crate, Guid_FromStr("ptlights.triToEmit"),
+        scene->triToEmit, sizeof(scene->triToEmit[0]) * triCount);
+    wrote &= Crate_Set(crate, Guid_FromStr("ptlights.emitOffsets"),
+        scene->emitOffsets, sizeof(scene->emitOffsets[0]) * (scene->emissiveCount + 1));
+    if (scene->emissiveCount > 0)
+    {
+        wrote &= Crate_Set(crate, Guid_FromStr("ptlights.emitTris"),
+            scene->emitTris, sizeof(scene->emitTris[0]) * scene->emitTriCount);
+        wrote &= Crate_Set(crate, Guid_FromStr("ptlights.emitCdfs"),
+            scene->emitCdfs, sizeof(scene->emitCdfs[0]) * scene->emitTriCount);
+        wrote &= Crate_Set(crate, Guid_FromStr("ptlights.emitAreas"),
+            scene->emitAreas, sizeof(scene->emitAreas[0]) * scene->emissiveCount);
+    }
+    if (gridLen > 0)
+    {
+        wrote &= Crate_Set(crate, Guid_FromStr("ptlights.cells"),
+            scene->lightCells, sizeof(scene->lightCells[0]) * gridLen);
+        wrote &= Crate_Set(crate, Guid_FromStr("ptlights.entries"),
+            scene->lightEntries, sizeof(scene->lightEntries[0]) * hdr.entryCount);
+    }
+    return wrote;
+}
+
+// the stored blob holds at least bytes, bounding counts read from disk
+static bool HasLightBlob(Crate* crate, const char* name, i64 bytes)
+{
+    i32 offset = 0;
+    i32 size = 0;
+    return (bytes > 0) &&
+        Crate_Stat(crate, Guid_FromStr(name), &offset, &size) &&
+        (bytes <= size);
+}
+
+// ranges of the loaded emissives, their indices feed straight into lookups
+static bool ValidateLightBake(PtLightBake const *const bake)
+{
+    DiskPtLights const *const hdr = &bake->hdr;
+    for (i32 i = 0; i < hdr->triCount; ++i)
+    {
+        const i32 iEmit = bake->triToEmit[i];
+        if ((iEmit < -1) || (iEmit >= hdr->emissiveCount))
+        {
+            return false;
+        }
+    }
+    i32 const *const offsets = bake->emitOffsets;
+    if ((offsets[0] != 0) || (offsets[hdr->emissiveCount] != hdr->emitTriCount))
+    {
+        return false;
+    }
+    for (i32 i = 0; i < hdr->emissiveCount; ++i)
+    {
+        if (offsets[i + 1] <= offsets[i])
+        {
+            return false;
+        }
+    }
+    for (i32 i = 0; i < hdr->emitTriCount; ++i)
+    {
+        const i32 iTri = bake->emitTris[i];
+        if ((iTri < 0) || (iTri >= hdr->triCount))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ValidateLightGrid(PtLightBake const *const bake)
+{
+    DiskPtLights const *const hdr = &bake->hdr;
+    const i32 gridLen = Grid_Len(&hdr->grid);
+    for (i32 i = 0; i < gridLen; ++i)
+    {
+        const PtLightCell cell = bake->cells[i];
+        if ((cell.offset < 0) || (cell.count < 0) ||
+            (cell.count > kLightCellMaxCount) ||
+            (cell.offset > hdr->entryCount - cell.count))
+        {
+            return false;
+        }
+        for (i32 j = 0; j < cell.count; ++j)
+        {
+            const PtLightEntry entry = bake->entries[cell.offset + j];
+            if ((entry.iEmit < 0) || (entry.iEmit >= hdr->emissiveCount) ||
+                (hdr->alias && (entry.alias >= cell.count)))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool PtScene_LoadLights(Crate* crate)
+{
+    PtLightBake *const bake = &ms_lightBake;
+    LightBake_Del(bake);
+
+    DiskPtLights hdr = { 0 };
+    if (!Crate_Get(crate, Guid_FromStr("ptlights"), &hdr, sizeof(hdr)))
+    {
+        return false;
+    }
+    if ((hdr.version != kDiskPtLightsVersion) ||
+        (hdr.triCount <= 0) ||
+        (hdr.emissiveCount < 0) ||
+        (hdr.emitTriCount < hdr.emissiveCount) ||
+        (hdr.entryCount < 0))
+    {
+        return false;
+    }
+    if (!HasLightBlob(crate, "ptlights.triToEmit", sizeof(i32) * (i64)hdr.triCount) ||
+        !HasLightBlob(crate, "ptlights.emitOffsets", sizeof(i32) * ((i64)hdr.emissiveCount + 1)))
+    {
+        return false;
+    }
+    if ((hdr.emissiveCount > 0) &&
+        (!HasLightBlob(crate, "ptlights.emitTris", sizeof(i32) * (i64)hdr.emitTriCount) ||
+        !HasLightBlob(crate, "ptlights.emitCdfs", sizeof(float) * (i64)hdr.emitTriCount) ||
+        !HasLightBlob(crate, "ptlights.emitAreas", sizeof(float) * (i64)hdr.emissiveCount)))
+    {
+        return false;
+    }
+    if (hdr.entryCount > 0)
+    {
+        // a bad grid drops only the grid
+        const int3 size = hdr.grid.size;
+        const i64 gridLen = (i64)size.x * size.y * size.z;
+        const bool gridValid =
+            (size.x > 0) && (size.y > 0) && (size.z > 0) &&
+            HasLightBlob(crate, "ptlights.cells", sizeof(PtLightCell) * gridLen) &&
+            HasLightBlob(crate, "ptlights.entries", sizeof(PtLightEntry) * (i64)hdr.entryCount);
+        if (!gridValid)
+        {
+            hdr.entryCount = 0;
+        }
+    }
+
+    bake->hdr = hdr;
+    bake->triToEmit = Perm_Alloc(sizeof(bake->triToEmit[0]) * hdr.triCount);
+    bake->emitOffsets = Perm_Alloc(sizeof(bake->emitOffsets[0]) * (hdr.emissiveCount + 1));
+    bake->emitTris = Perm_Alloc(sizeof(bake->emitTris[0]) * i1_max(1, hdr.emitTriCount));
+    bake->emitCdfs = Perm_Alloc(sizeof(bake->emitCdfs[0]) * i1_max(1, hdr.emitTriCount));
+    bake->emitAreas = Perm_Alloc(sizeof(bake->emitAreas[0]) * i1_max(1, hdr.emissiveCount));
+
+    bool loaded = true;
+    loaded &= Crate_Get(crate, Guid_FromStr("ptlights.triToEmit"),
+        bake->triToEmit, sizeof(bake->triToEmit[0]) * hdr.triCount);
+    loaded &= Crate_Get(crate, Guid_FromStr("ptlights.emitOffsets"),
+        bake->emitOffsets, sizeof(bake->emitOffsets[0]) * (hdr.emissiveCount + 1));
+    if (hdr.emissiveCount > 0)
+    {
+        loaded &= Crate_Get(crate, Guid_FromStr("ptlights.emitTris"),
+            bake->emitTris, sizeof(bake->emitTris[0]) * hdr.emitTriCount);
+        loaded &= Crate_Get(crate, Guid_FromStr("ptlights.emitCdfs"),
+            bake->emitCdfs, sizeof(bake->emitCdfs[0]) * hdr.emitTriCount);
+        loaded &= Crate_Get(crate, Guid_FromStr("ptlights.emitAreas"),
+            bake->emitAreas, sizeof(bake->emitAreas[0]) * hdr.emissiveCount);
+    }
+
+    const i32 gridLen = (hdr.entryCount > 0) ? Grid_Len(&hdr.grid) : 0;
+    if (loaded && (gridLen > 0))
+    {
+        // the grid is optional, the emissives stand on their own
+        PtLightCell* cells = Tex_Alloc(sizeof(cells[0]) * gridLen);
+        PtLightEntry* entries = Tex_Alloc(sizeof(entries[0]) * hdr.entryCount);
+        bool gridLoaded = true;
+        gridLoaded &= Crate_Get(crate, Guid_FromStr("ptlights.cells"),
+            cells, sizeof(cells[0]) * gridLen);
+        gridLoaded &= Crate_Get(crate, Guid_FromStr("ptlights.entries"),
+            entries, sizeof(entries[0]) * hdr.entryCount);
+        if (gridLoaded)
+        {
+            bake->cells = cells;
+            bake->entries = entries;
+            if (!ValidateLightGrid(bake))
+            {
+                Con_Logf(LogSev_Error, "pt", "Dropping saved light grid, its ranges are invalid.");
+                Mem_Free(bake->cells);
+                Mem_Free(bake->entries);
+                bake->cells = NULL;
+                bake->entries = NULL;
+            }
+        }
+        else
+        {
+            Mem_Free(cells);
+            Mem_Free(entries);
+        }
+    }
+
+    if (loaded && !ValidateLightBake(bake))
+    {
+        Con_Logf(LogSev_Error, "pt", "Dropping saved lights, their ranges are invalid.");
+        loaded = false;
+    }
+    if (!loaded)
+    {
+        LightBake_Del(bake);
+    }
+    return loaded;
+}
+
+// ----------------------------------------------------------------------------
+// light tree: a bvh over the emissive triangles with bounding cones of
+// their normals, traversed stochastically in proportion to the estimated
+// importance of each subtree to a receiving point.
+// Importance Sampling of Many Lights with Adaptive Tree Splitting, Conty Estevez and Kulla 2018
+
+typedef struct task_CalcEmitterFlux
+{
+    Task task;
+    const PtScene* scene;
+    float* flux;
+    i32 attempts;
+} task_CalcEmitterFlux;
+
+// lowest flux of an emissive relative to its area at the mean radiance
+#define kMinFluxFraction 0.01f
+
+// estimated power of an emissive triangle, up to a constant factor
+static float EmitterFlux(
+    PtSampler*const pim_noalias sampler,
+    const PtScene*const pim_noalias scene,
+    i32 iVert,
+    i32 attempts)
+{
+    const float area = GetArea(scene, iVert);
+    const Material* mat = scene->materials + scene->matIds[iVert / 3];
+    const i32* pim_noalias tri = scene->indices + iVert;
+    const float4* pim_noalias positions = scene->positions;
+    const float4 A = positions[tri[0]];
+    const float4 B = positions[tri[1]];
+    const float4 C = positions[tri[2]];
+
+    if (mat->flags & MatFlag_Sky)
+    {
+        // looking through the sky polygon
+        float4 P = f4_blend(A, B, C, f4_s(1.0f / 3.0f));
+        float4 N = f4_normalize3(f4_cross3(f4_sub(A, B), f4_sub(C, A)));
+        return area * f4_avglum(GetSky(scene, P, f4_neg(N)));
+    }
+
+    Texture const *const albedoMap = Texture_Get(mat->albedo);
+    Texture const *const romeMap = Texture_Get(mat->rome);
+    if (!romeMap)
+    {
+        return 0.0f;
+    }
+
+    const float2* pim_noalias uvs = scene->uvs;
+    const float2 UA = uvs[tri[0]];
+    const float2 UB = uvs[tri[1]];
+    const float2 UC = uvs[tri[2]];
+
+    float sum = 0.0f;
+    for (i32 i = 0; i < attempts; ++i)
+    {
+        float4 wuv = SampleBaryCoord(Sample2D(sampler));
+        float2 uv = f2_blend(UA, UB, UC, wuv);
+        float4 albedo = f4_1;
+        if (albedoMap)
+        {
+            albedo = UvWrapPow2_c32(albedoMap->texels, albedoMap->size, uv);
+        }
+        float e = UvWrapPow2_c32(romeMap->texels, romeMap->size, uv).w;
+        sum += f4_avglum(UnpackEmission(albedo, e));
+    }
+    return area * (sum / attempts);
+}
+
+static void CalcEmitterFluxFn(void* pbase, i32 begin, i32 end)
+{
+    task_CalcEmitterFlux* task = (task_CalcEmitterFlux*)pbase;
+    const PtScene*const pim_noalias scene = task->scene;
+    const i32 attempts = task->attempts;
+    float* pim_noalias flux = task->flux;
+    i32 const *const pim_noalias emitOffsets = scene->emitOffsets;
+    i32 const *const pim_noalias emitTris = scene->emitTris;
+
+    PtSampler sampler = GetSampler();
+    for (i32 i = begin; i < end; ++i)
+    {
+        float sum = 0.0f;
+        for (i32 j = emitOffsets[i]; j < emitOffsets[i + 1]; ++j)
+        {
+            sum += EmitterFlux(&sampler, scene, emitTris[j] * 3, attempts);
+        }
+        flux[i] = sum;
+    }
+    SetSampler(sampler);
+}
+
+typedef struct LightCone_s
+{
+    float4 axis;
+    float thetaO;
+    float thetaE;
+} LightCone;
+
+// smallest cone containing both cones, Algorithm 1 of the paper
+pim_inline LightCone VEC_CALL LightCone_Union(LightCone a, LightCone b)
+{
+    if (b.thetaO > a.thetaO)
+    {
+        LightCone t = a;
+        a = b;
+        b = t;
+    }
+    const float thetaD = acosf(f1_clamp(f4_dot3(a.axis, b.axis), -1.0f, 1.0f));
+    const float thetaE = f1_max(a.thetaE, b.thetaE);
+    if (f1_min(thetaD + b.thetaO, kPi) <= a.thetaO)
+    {
+        a.thetaE = thetaE;
+        return a;
+    }
+    LightCone c;
+    c.thetaE = thetaE;
+    c.thetaO = (a.thetaO + thetaD + b.thetaO) * 0.5f;
+    if (c.thetaO >= kPi)
+    {
+        c.axis = a.axis;
+        c.thetaO = kPi;
+        return c;
+    }
+    // rotate a's axis towards b's by thetaR
+    const float thetaR = c.thetaO - a.thetaO;
+    const float sinD = sinf(thetaD);
+    if (sinD < kEpsilon)
+    {
+        c.axis = a.axis;
+        return c;
+    }
+    c.axis = f4_normalize3(f4_add(
+        f4_mulvs(a.axis, sinf(thetaD - thetaR) / sinD),
+        f4_mulvs(b.axis, sinf(thetaR) / sinD)));
+    return c;
+}
+
+typedef struct LightBuild_s
+{
+    PtLightNode* nodes;
+    i32* leaves;
+    const Box3D* bounds;
+    const LightCone* cones;
+    const float* flux;
+    i32 nodeCount;
+} LightBuild;
+
+typedef struct LightSortCtx_s
+{
+    const Box3D* bounds;
+    i32 axis;
+} LightSortCtx;
+
+static i32 LightCentroidCmp(i32 lhs, i32 rhs, void* usr)
+{
+    const LightSortCtx* ctx = usr;
+    float a = f4_get(box_center(ctx->bounds[lhs]), ctx->axis);
+    float b = f4_get(box_center(ctx->bounds[rhs]), ctx->axis);
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+// unions the children of an inner node
+static void LightTree_Refit(PtLightNode*const pim_noalias nodes, i32 iNode)
+{
+    PtLightNode* node = &nodes[iNode];
+    const PtLightNode* lnode = &nodes[node->children[0]];
+    const PtLightNode* rnode = &nodes[node->children[1]];
+    LightCone lcone = { lnode->axis, lnode->thetaO, lnode->thetaE };
+    LightCone rcone = { rnode->axis, rnode->thetaO, rnode->thetaE };
+    LightCone cone = LightCone_Union(lcone, rcone);
+    node->bounds = box_union(lnode->bounds, rnode->bounds);
+    node->axis = cone.axis;
+    node->thetaO = cone.thetaO;
+    node->thetaE = cone.thetaE;
+    node->energy = lnode->energy + rnode->energy;
+}
+
+// median split on the widest centroid axis; returns the node index
+static i32 LightTree_Build(LightBuild* build, i32* emits, i32 count, i32 parent)
+{
+    ASSERT(count > 0);
+    const i32 iNode = build->nodeCount++;
+    PtLightNode* node = &build->nodes[iNode];
+    node->parent = parent;
+    node->children[0] = -1;
+    node->children[1] = -1;
+    node->iEmit = -1;
+
+    if (count == 1)
+    {
+        const i32 iEmit = emits[0];
+        const LightCone cone = build->cones[iEmit];
+        node->bounds = build->bounds[iEmit];
+        node->axis = cone.axis;
+        node->thetaO = cone.thetaO;
+        node->thetaE = cone.thetaE;
+        node->energy = build->flux[iEmit];
+        node->iEmit = iEmit;
+        build->leaves[iEmit] = iNode;
+        return iNode;
+    }
+
+    Box3D centroids = box_empty();
+    for (i32 i = 0; i < count; ++i)
+    {
+        float4 c = box_center(build->bounds[emits[i]]);
+        centroids = box_union(centroids, box_new(c, c));
+    }
+    const float4 extent = box_size(centroids);
+    LightSortCtx ctx = { build->bounds, 0 };
+    if (extent.y > f4_get(extent, ctx.axis))
+    {
+        ctx.axis = 1;
+    }
+    if (extent.z > f4_get(extent, ctx.axis))
+    {
+        ctx.axis = 2;
+    }
+    QuickSort_Int(emits, count, LightCentroidCmp, &ctx);
+
+    const i32 half = count / 2;
+    const i32 left = LightTree_Build(build, emits, half, iNode);
+    const i32 right = LightTree_Build(build, emits + half, count - half, iNode);
+
+    node = &build->nodes[iNode];
+    node->children[0] = left;
+    node->children[1] = right;
+    LightTree_Refit(build->nodes, iNode);
+    return iNode;
+}
+
+static Box3D EmitterBounds(PtScene const *const pim_noalias scene, i32 iEmit)
+{
+    const float4* pim_noalias positions = scene->positions;
+    Box3D box = box_empty();
+    for (i32 j = scene->emitOffsets[iEmit]; j < scene->emitOffsets[iEmit + 1]; ++j)
+    {
+        const i32* pim_noalias tri = scene->indices + scene->emitTris[j] * 3;
+        box = box_union(box, box_new(
+            f4_min(positions[tri[0]], f4_min(positions[tri[1]], positions[tri[2]])),
+            f4_max(positions[tri[0]], f4_max(positions[tri[1]], positions[tri[2]]))));
+    }
+    return box;
+}
+
+// one sided emitters face along embree's geometric normal.
+// members are coplanar, so any one gives the axis.
+static LightCone EmitterCone(PtScene const *const pim_noalias scene, i32 iEmit)
+{
+    const float4* pim_noalias positions = scene->positions;
+    const i32* pim_noalias tri = scene->indices + scene->emitTris[scene->emitOffsets[iEmit]] * 3;
+    const float4 A = positions[tri[0]];
+    const float4 B = positions[tri[1]];
+    const float4 C = positions[tri[2]];
+    LightCone cone;
+    cone.axis = f4_normalize3(f4_cross3(f4_sub(A, B), f4_sub(C, A)));
+    cone.thetaO = 0.0f;
+    cone.thetaE = kPi * 0.5f;
+    return cone;
+}
+
+// replaces the tree with one built over the given leaves
+static void BuildLightTree(
+    PtScene*const pim_noalias scene,
+    Box3D const *const pim_noalias bounds,
+    LightCone const *const pim_noalias cones,
+    float const *const pim_noalias flux)
+{
+    const i32 emissiveCount = scene->emissiveCount;
+    i32* emits = Temp_Alloc(sizeof(emits[0]) * emissiveCount);
+    for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+    {
+        emits[iEmit] = iEmit;
+    }
+
+    LightBuild build = { 0 };
+    build.nodes = Perm_Calloc(sizeof(build.nodes[0]) * (emissiveCount * 2 - 1));
+    build.leaves = Perm_Calloc(sizeof(build.leaves[0]) * emissiveCount);
+    build.bounds = bounds;
+    build.cones = cones;
+    build.flux = flux;
+    LightTree_Build(&build, emits, emissiveCount, -1);
+    ASSERT(build.nodeCount == (emissiveCount * 2 - 1));
+
+    Mem_Free(scene->lightNodes);
+    Mem_Free(scene->lightLeaves);
+    scene->lightNodes = build.nodes;
+    scene->lightLeaves = build.leaves;
+    scene->lightNodeCount = build.nodeCount;
+}
+
+ProfileMark(pm_lighttree, SetupLightTree)
+static void SetupLightTree(PtScene*const pim_noalias scene)
+{
+    const i32 emissiveCount = scene->emissiveCount;
+    if (emissiveCount <= 0)
+    {
+        return;
+    }
+    ProfileBegin(pm_lighttree);
+
+    task_CalcEmitterFlux* task = Temp_Calloc(sizeof(*task));
+    task->scene = scene;
+    task->flux = Temp_Alloc(sizeof(task->flux[0]) * emissiveCount);
+    task->attempts = 64;
+    Task_Run(&task->task, CalcEmitterFluxFn, emissiveCount);
+
+    // a sparse emitter's estimate may miss all of its emissive texels;
+    // floor each at a fraction of its area times the mean radiance so that
+    // every emissive stays selectable.
+    float* pim_noalias flux = task->flux;
+    float fluxSum = 0.0f;
+    float areaSum = 0.0f;
+    for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+    {
+        fluxSum += flux[iEmit];
+        areaSum += scene->emitAreas[iEmit];
+    }
+    const float meanRadiance = (fluxSum > kEpsilon) ? (fluxSum / f1_max(areaSum, kEpsilon)) : 1.0f;
+    for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+    {
+        const float minFlux = f1_max(kEpsilon, kMinFluxFraction * meanRadiance * scene->emitAreas[iEmit]);
+        flux[iEmit] = f1_max(flux[iEmit], minFlux);
+    }
+
+    Box3D* bounds = Temp_Alloc(sizeof(bounds[0]) * emissiveCount);
+    LightCone* cones = Temp_Alloc(sizeof(cones[0]) * emissiveCount);
+    for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+    {
+        bounds[iEmit] = EmitterBounds(scene, iEmit);
+        cones[iEmit] = EmitterCone(scene, iEmit);
+    }
+    BuildLightTree(scene, bounds, cones, flux);
+
+    ProfileEnd(pm_lighttree);
+}
+
+// estimated contribution of a subtree to point P
+pim_inline float VEC_CALL LightNode_Importance(
+    PtLightNode const *const pim_noalias node,
+    float4 P)
+{
+    const float4 toP = f4_sub(P, box_center(node->bounds));
+    const float4 ext = box_extents(node->bounds);
+    const float radiusSq = f4_dot3(ext, ext);
+    const float distSq = f1_max(f4_dot3(toP, toP), radiusSq);
+    const float4 dir = f4_mulvs(toP, 1.0f / sqrtf(f1_max(distSq, kEpsilon)));
+    const float theta = acosf(f1_clamp(f4_dot3(node->axis, dir), -1.0f, 1.0f));
+    // angle subtended by the bounds, conservatively the whole sphere when inside
+    const float thetaU = asinf(f1_sat(sqrtf(radiusSq / f1_max(distSq, kEpsilon))));
+    const float thetaP = f1_max(0.0f, theta - node->thetaO - thetaU);
+    if (thetaP >= node->thetaE)
+    {
+        return 0.0f;
+    }
+    return node->energy * cosf(thetaP) / f1_max(distSq, kEpsilon);
+}
+
+pim_inline bool VEC_CALL LightTree_Select(
+    PtSampler*const pim_noalias sampler,
+    const PtScene*const pim_noalias scene,
+    float4 position,
+    i32* iEmitOut,
+    float* pdfOut)
+{
+    PtLightNode const *const pim_noalias nodes = scene->lightNodes;
+    float u = Sample1D(sampler);
+    float pdf = 1.0f;
+    i32 iNode = 0;
+    while (nodes[iNode].iEmit < 0)
+    {
+        const i32 left = nodes[iNode].children[0];
+        const i32 right = nodes[iNode].children[1];
+        const float wl = LightNode_Importance(&nodes[left], position);
+        const float wr = LightNode_Importance(&nodes[right], position);
+        const float total = wl + wr;
+        if (total <= 0.0f)
+        {
+            return false;
+        }
+        // reuse the one random number all the way down
+        const float pl = wl / total;
+        if (u < pl)
+        {
+            u = f1_min(u / pl, 1.0f - kEpsilon);
+            pdf *= pl;
+            iNode = left;
+        }
+        else
+        {
+            u = f1_min((u - pl) / (1.0f - pl), 1.0f - kEpsilon);
+            pdf *= 1.0f - pl;
+            iNode = right;
+        }
+    }
+    *iEmitOut = nodes[iNode].iEmit;
+    *pdfOut = pdf;
+    return pdf > kEpsilon;
+}
+
+pim_inline float VEC_CALL LightTree_Pdf(
+    const PtScene*const pim_noalias scene,
+    i32 iEmit,
+    float4 position)
+{
+    PtLightNode const *const pim_noalias nodes = scene->lightNodes;
+    float pdf = 1.0f;
+    i32 iNode = scene->lightLeaves[iEmit];
+    i32 iParent = nodes[iNode].parent;
+    while (iParent >= 0)
+    {
+        const i32 left = nodes[iParent].children[0];
+        const i32 right = nodes[iParent].children[1];
+        const float wl = LightNode_Importance(&nodes[left], position);
+        const float wr = LightNode_Importance(&nodes[right], position);
+        const float total = wl + wr;
+        if (total <= 0.0f)
+        {
+            return 0.0f;
+        }
+        pdf *= ((iNode == left) ? wl : wr) / total;
+        iNode = iParent;
+        iParent = nodes[iNode].parent;
+    }
+    return pdf;
+}
+
+static void PtScene_FindSky(PtScene* scene)
+{
+    scene->sky = NULL;
+    Guid skyname = Guid_FromStr("sky");
+    Cubemaps* maps = Cubemaps_Get();
+    i32 iSky = Cubemaps_Find(maps, skyname);
+    if (iSky >= 0)
+    {
+        scene->sky = &maps->cubemaps[iSky];
+    }
+}
+
+// true when entities only differ from the scene by their transforms
+static bool PtScene_CanMoveInstances(
+    const PtScene*const pim_noalias scene,
+    const Entities*const pim_noalias ents)
+{
+    if (!scene->rtcScene)
+    {
+        return false;
+    }
+    i32 drawCount = 0;
+    for (i32 i = 0; i < ents->count; ++i)
+    {
+        drawCount += Mesh_Exists(ents->meshes[i]) ? 1 : 0;
+    }
+    if (drawCount != scene->instCount)
+    {
+        return false;
+    }
+    const PtInstance* pim_noalias instances = scene->instances;
+    for (i32 i = 0; i < scene->instCount; ++i)
+    {
+        const i32 iEnt = instances[i].iEntity;
+        if (iEnt >= ents->count)
+        {
+            return false;
+        }
+        if (memcmp(&ents->meshes[iEnt], &instances[i].mesh, sizeof(MeshId)))
+        {
+            return false;
+        }
+        // material changes alter the emissives and light grid
+        if (memcmp(&ents->materials[iEnt], &scene->materials[i], sizeof(Material)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// re-commits the transforms of moved instances and re-transforms their
+// welded world space vertices in place. the lights are outdated by this,
+// see UpdateLights. returns true if anything moved.
+ProfileMark(pm_move_instances, PtScene_MoveInstances)
+static bool PtScene_MoveInstances(PtScene*const pim_noalias scene)
+{
+    ProfileBegin(pm_move_instances);
+
+    const Entities* ents = Entities_Get();
+    const float4x4* pim_noalias matrices = ents->matrices;
+    PtInstance* pim_noalias instances = scene->instances;
+    RTCScene rtcScene = scene->rtcScene;
+
+    i32 moved = 0;
+    for (i32 i = 0; i < scene->instCount; ++i)
+    {
+        PtInstance* inst = &instances[i];
+        const float4x4 M = matrices[inst->iEntity];
+        if (!memcmp(&M, &inst->matrix, sizeof(M)))
+        {
+            continue;
+        }
+        Mesh const *const mesh = Mesh_Get(inst->mesh);
+        if (!mesh)
+        {
+            continue;
+        }
+        ++moved;
+        inst->matrix = M;
+        inst->lightsMoved = true;
+
+        RTCGeometry geom = rtc.GetGeometry(rtcScene, i);
+        rtc.SetGeometryTransform(geom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, &inst->matrix);
+        rtc.CommitGeometry(geom);
+
+        const PtMesh pm = GetPtMesh(scene, inst->mesh, mesh);
+        ASSERT(pm.vertCount == inst->vertCount);
+        TransformPtMesh(&pm, mesh, M, scene->positions, scene->normals, inst->vertBase);
+    }
+
+    if (moved > 0)
+    {
+        if (!scene->rtcMoved)
+        {
+            rtc.SetSceneFlags(rtcScene, RTC_SCENE_FLAG_DYNAMIC);
+            rtc.SetSceneBuildQuality(rtcScene, RTC_BUILD_QUALITY_LOW);
+        }
+        scene->rtcMoved = Time_Now();
+        rtc.CommitScene(rtcScene);
+    }
+
+    ProfileEnd(pm_move_instances);
+    return moved > 0;
+}
+
+// rebuilds the top level bvh for tracing once instances stop moving
+// returns true on the update it settles
+static bool SettleRtcScene(PtScene*const pim_noalias scene)
+{
+    if (scene->rtcMoved && (Time_Sec(Time_Now() - scene->rtcMoved) >= kSceneSettleSec))
+    {
+        scene->rtcMoved = 0;
+        rtc.SetSceneFlags(scene->rtcScene, RTC_SCENE_FLAG_NONE);
+        rtc.SetSceneBuildQuality(scene->rtcScene, RTC_BUILD_QUALITY_MEDIUM);
+        rtc.CommitScene(scene->rtcScene);
+        return true;
+    }
+    return false;
+}
+
+ProfileMark(pm_scene_update, PtScene_Update)
+void PtScene_Update(PtScene* scene)
+{
+    ProfileBegin(pm_scene_update);
+
+    const Entities* ents = Entities_Get();
+    if (ConVar_GetInt(&cv_pt_light_select) != (i32)scene->lightSelect)
+    {
+        PtScene_Clear(scene);
+        PtScene_Init(scene);
+    }
+    else if (ents->modtime != scene->modtime)
+    {
+        if (PtScene_CanMoveInstances(scene, ents))
+        {
+            if (PtScene_MoveInstances(scene))
+            {
+                ClearCache(scene);
+                ClearGuide(scene);
+                scene->lightsMoved = Time_Now();
+            }
+            scene->modtime = ents->modtime;
+        }
+        else
+        {
+            PtScene_Clear(scene);
+            PtScene_Init(scene);
+        }
+    }
+    else
+    {
+        // transforms are recomputed every frame without touching modtime
+        if (PtScene_MoveInstances(scene))
+        {
+            ClearCache(scene);
+            ClearGuide(scene);
+            scene->lightsMoved = Time_Now();
+        }
+    }
+    PtScene_FindSky(scene);
+    if (SettleRtcScene(scene))
+    {
+        RefitMajorants(scene);
+    }
+    UpdateLights(scene);
+    UpdateDists(scene);
+    if (scene->mediaPreset[0])
+    {
+        media_desc_load(&scene->mediaDesc, &scene->mediaVolume, scene->mediaPreset);
+        scene->mediaPreset[0] = 0;
+        scene->mediaEdit = scene->mediaDesc;
+    }
+    else
+    {
+        // trace workers read mediaDesc, gui edits land here between traces
+        scene->mediaDesc = scene->mediaEdit;
+    }
+
+    UpdateCache(scene);
+    UpdateGuide(scene);
+    UpdateMediaVolume(scene);
+    UpdateMajorants(scene);
+
+    ProfileEnd(pm_scene_update);
+}
+
+static void PtScene_Init(PtScene* scene)
+{
+    PtScene_FindSky(scene);
+    Dict_New(&scene->meshes, sizeof(MeshId), sizeof(PtMesh), EAlloc_Perm);
+    FlattenDrawables(scene);
+    SetupMatTexs(scene);
+    scene->lightSelect = (PtLightSelect)i1_clamp(
+        ConVar_GetInt(&cv_pt_light_select), 0, PtLightSelect_COUNT - 1);
+    if (!RestoreLights(scene))
+    {
+        SetupEmissives(scene);
+    }
+    media_desc_new(&scene->mediaDesc);
+    scene->mediaEdit = scene->mediaDesc;
+    UpdateMediaVolume(scene);
+    UpdateMajorants(scene);
+    scene->rtcScene = RtcNewScene(scene);
+    if (scene->lightSelect == PtLightSelect_Tree)
+    {
+        SetupLightTree(scene);
+    }
+    else if (!scene->lightCells)
+    {
+        SetupLightGrid(scene);
+    }
+
+    scene->modtime = Entities_Get()->modtime;
+}
+
+static void ClearLights(PtScene*const pim_noalias scene)
+{
+    Mem_Free(scene->triToEmit);
+    scene->triToEmit = NULL;
+    Mem_Free(scene->emitOffsets);
+    scene->emitOffsets = NULL;
+    Mem_Free(scene->emitTris);
+    scene->emitTris = NULL;
+    Mem_Free(scene->emitCdfs);
+    scene->emitCdfs = NULL;
+    Mem_Free(scene->emitAreas);
+    scene->emitAreas = NULL;
+    scene->emissiveCount = 0;
+    scene->emitTriCount = 0;
+
+    Mem_Free(scene->lightNodes);
+    scene->lightNodes = NULL;
+    Mem_Free(scene->lightLeaves);
+    scene->lightLeaves = NULL;
+    scene->lightNodeCount = 0;
+
+    Mem_Free(scene->lightCells);
+    scene->lightCells = NULL;
+    Mem_Free(scene->lightEntries);
+    scene->lightEntries = NULL;
+    Mem_Free(scene->lightTallies);
+    scene->lightTallies = NULL;
+    Mem_Free(scene->lightMisses);
+    scene->lightMisses = NULL;
+    scene->lightEntryCount = 0;
+}
+
+// area and member cdf of an emissive, after its instance was scaled
+static void UpdateEmitArea(PtScene*const pim_noalias scene, i32 iEmit)
+{
+    const i32 begin = scene->emitOffsets[iEmit];
+    const i32 end = scene->emitOffsets[iEmit + 1];
+    float*const pim_noalias emitCdfs = scene->emitCdfs;
+    float area = 0.0f;
+    for (i32 i = begin; i < end; ++i)
+    {
+        area += GetArea(scene, scene->emitTris[i] * 3);
+        emitCdfs[i] = area;
+    }
+    const float rcpArea = (area > 0.0f) ? (1.0f / area) : 0.0f;
+    for (i32 i = begin; i < end; ++i)
+    {
+        emitCdfs[i] *= rcpArea;
+    }
+    emitCdfs[end - 1] = 1.0f;
+    scene->emitAreas[iEmit] = area;
+}
+
+// the leaves of the tree, rebuilt over their current bounds and flux
+static void RebuildLightTree(PtScene*const pim_noalias scene)
+{
+    const i32 emissiveCount = scene->emissiveCount;
+    PtLightNode const *const pim_noalias nodes = scene->lightNodes;
+    Box3D* bounds = Temp_Alloc(sizeof(bounds[0]) * emissiveCount);
+    LightCone* cones = Temp_Alloc(sizeof(cones[0]) * emissiveCount);
+    float* flux = Temp_Alloc(sizeof(flux[0]) * emissiveCount);
+    for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+    {
+        const PtLightNode leaf = nodes[scene->lightLeaves[iEmit]];
+        bounds[iEmit] = leaf.bounds;
+        cones[iEmit].axis = leaf.axis;
+        cones[iEmit].thetaO = leaf.thetaO;
+        cones[iEmit].thetaE = leaf.thetaE;
+        flux[iEmit] = leaf.energy;
+    }
+    BuildLightTree(scene, bounds, cones, flux);
+}
+
+// follows moved instances with their emissives only.
+// emissives never span drawables, and a drawable moves rigidly, so the
+// grouping into emissives holds; their areas and tree leaves are refit.
+// the grid keeps its cells, AddLightMisses picks up emissives moving into
+// view and the live counters fade those moving out of it.
+// once movement settles the tree's topology is rebuilt over its leaves.
+ProfileMark(pm_update_lights, UpdateLights)
+static void UpdateLights(PtScene*const pim_noalias scene)
+{
+    if (!scene->lightsMoved)
+    {
+        return;
+    }
+
+    ProfileBegin(pm_update_lights);
+
+    const i32 emissiveCount = scene->emissiveCount;
+    const i32 triCount = scene->indexCount / 3;
+    const i32 instCount = scene->instCount;
+    PtInstance*const pim_noalias instances = scene->instances;
+    i32 const *const pim_noalias triToEmit = scene->triToEmit;
+    PtLightNode*const pim_noalias nodes = scene->lightNodes;
+    u8*const pim_noalias dirty = nodes ? Temp_Calloc(scene->lightNodeCount) : NULL;
+    u8*const pim_noalias refit = Temp_Calloc(i1_max(1, emissiveCount));
+    for (i32 i = 0; i < instCount; ++i)
+    {
+        if (!instances[i].lightsMoved)
+        {
+            continue;
+        }
+        instances[i].lightsMoved = false;
+        const i32 first = instances[i].indexBase / 3;
+        const i32 last = (i + 1 < instCount) ? (instances[i + 1].indexBase / 3) : triCount;
+        for (i32 iTri = first; iTri < last; ++iTri)
+        {
+            const i32 iEmit = triToEmit[iTri];
+            if ((iEmit < 0) || refit[iEmit])
+            {
+                continue;
+            }
+            refit[iEmit] = 1;
+            const float prevArea = scene->emitAreas[iEmit];
+            UpdateEmitArea(scene, iEmit);
+            if (nodes)
+            {
+                // flux scales with area, radiance is unchanged
+                i32 iNode = scene->lightLeaves[iEmit];
+                PtLightNode* leaf = &nodes[iNode];
+                const LightCone cone = EmitterCone(scene, iEmit);
+                leaf->bounds = EmitterBounds(scene, iEmit);
+                leaf->axis = cone.axis;
+                leaf->energy *= (prevArea > 0.0f) ? (scene->emitAreas[iEmit] / prevArea) : 1.0f;
+                iNode = leaf->parent;
+                while ((iNode >= 0) && !dirty[iNode])
+                {
+                    dirty[iNode] = 1;
+                    iNode = nodes[iNode].parent;
+                }
+            }
+        }
+    }
+    if (nodes)
+    {
+        // children come after their parents
+        for (i32 iNode = scene->lightNodeCount - 1; iNode >= 0; --iNode)
+        {
+            if (dirty[iNode])
+            {
+                LightTree_Refit(nodes, iNode);
+            }
+        }
+    }
+
+    if (Time_Sec(Time_Now() - scene->lightsMoved) >= kSceneSettleSec)
+    {
+        scene->lightsMoved = 0;
+        if (nodes)
+        {
+            RebuildLightTree(scene);
+        }
+    }
+
+    ProfileEnd(pm_update_lights);
+}
+
+static void PtScene_Clear(PtScene* scene)
+{
+    if (scene->rtcScene)
+    {
+        RTCScene rtcScene = scene->rtcScene;
+        rtc.ReleaseScene(rtcScene);
+        scene->rtcScene = NULL;
+    }
+    {
+        Dict* meshes = &scene->meshes;
+        const u32 width = Dict_GetWidth(meshes);
+        for (u32 i = 0; i < width; ++i)
+        {
+            PtMesh pm;
+            if (Dict_GetValueAt(meshes, i, &pm))
+            {
+                if (pm.rtcScene)
+                {
+                    rtc.ReleaseScene(pm.rtcScene);
+                }
+                Mem_Free(pm.indices);
+                Mem_Free(pm.corners);
+            }
+        }
+        Dict_Del(meshes);
+    }
+    Mem_Free(scene->instances);
+
+    Mem_Free(scene->positions);
+    Mem_Free(scene->normals);
+    Mem_Free(scene->uvs);
+    Mem_Free(scene->indices);
+    Mem_Free(scene->matIds);
+
+    Mem_Free(scene->materials);
+    for (i32 i = 0; i < scene->matTexCount; ++i)
+    {
+        Mem_Free(scene->matTexs[i].texels);
+    }
+    Mem_Free(scene->matTexs);
+    Mem_Free(scene->matToTex);
+
+    ClearLights(scene);
+
+    Mem_Free(scene->mediaVolume.density);
+    Mem_Free(scene->majorantMfps);
+    Mem_Free(scene->cache);
+    ClearGuide(scene);
+    Mem_Free(scene->guideCells);
+
+    memset(scene, 0, sizeof(*scene));
+}
+
+PtScene* PtScene_New(void)
+{
+    ASSERT(ms_device);
+    if (!ms_device)
+    {
+        return NULL;
+    }
+    PtScene* scene = Perm_Calloc(sizeof(*scene));
+    PtScene_Init(scene);
+    return scene;
+}
+
+void PtScene_Del(PtScene* scene)
+{
+    if (scene)
+    {
+        PtScene_Clear(scene);
+        Mem_Free(scene);
+    }
+}
+
+void PtScene_Gui(PtScene* scene)
+{
+    if (scene && igExCollapsingHeader1("pt scene"))
+    {
+        igIndent(0.0f);
+        igText("Vertex Count: %d", scene->vertCount);
+        igText("Triangle Count: %d", scene->indexCount / 3);
+        igText("Instance Count: %d", scene->instCount);
+        igText("Unique Mesh Count: %d", Dict_GetCount(&scene->meshes));
+        igText("Material Count: %d", scene->matCount);
+        igText("Emissive Count: %d", scene->emissiveCount);
+        igText("Emissive Triangle Count: %d", scene->emitTriCount);
+        igText("Light Tree Nodes: %d", scene->lightNodeCount);
+        igText("Light Grid Entries: %d", scene->lightEntryCount);
+        media_desc_gui(&scene->mediaEdit, &scene->mediaVolume, scene->mediaPreset);
+        igUnindent(0.0f);
+    }
+}
+
+void PtTrace_New(
+    PtTrace* trace,
+    PtScene* scene,
+    int2 imageSize)
+{
+    ASSERT(trace);
+    ASSERT(scene);
+    if (trace)
+    {
+        const i32 texelCount = imageSize.x * imageSize.y;
+        ASSERT(texelCount > 0);
+
+        trace->imageSize = imageSize;
+        trace->scene = scene;
+        trace->sampleWeight = 1.0f;
+        trace->color = Tex_Calloc(sizeof(trace->color[0]) * texelCount);
+        trace->albedo = Tex_Calloc(sizeof(trace->albedo[0]) * texelCount);
+        trace->normal = Tex_Calloc(sizeof(trace->normal[0]) * texelCount);
+        trace->denoised = Tex_Calloc(sizeof(trace->denoised[0]) * texelCount);
+        trace->moment2 = Tex_Calloc(sizeof(trace->moment2[0]) * texelCount);
+        trace->sampleCount = Tex_Calloc(sizeof(trace->sampleCount[0]) * texelCount);
+        trace->depth = Tex_Calloc(sizeof(trace->depth[0]) * texelCount);
+        trace->histColor = Tex_Calloc(sizeof(trace->histColor[0]) * texelCount);
+        trace->histAlbedo = Tex_Calloc(sizeof(trace->histAlbedo[0]) * texelCount);
+        trace->histNormal = Tex_Calloc(sizeof(trace->histNormal[0]) * texelCount);
+        trace->histMoment2 = Tex_Calloc(sizeof(trace->histMoment2[0]) * texelCount);
+        trace->histSampleCount = Tex_Calloc(sizeof(trace->histSampleCount[0]) * texelCount);
+        trace->histDepth = Tex_Calloc(sizeof(trace->histDepth[0]) * texelCount);
+        DofInfo_New(&trace->dofinfo);
+    }
+}
+
+void PtTrace_Del(PtTrace* trace)
+{
+    if (trace)
+    {
+        Pt_TraceCancel(trace);
+        Mem_Free(trace->color);
+        Mem_Free(trace->albedo);
+        Mem_Free(trace->normal);
+        Mem_Free(trace->denoised);
+        Mem_Free(trace->moment2);
+        Mem_Free(trace->sampleCount);
+        Mem_Free(trace->depth);
+        Mem_Free(trace->histColor);
+        Mem_Free(trace->histAlbedo);
+        Mem_Free(trace->histNormal);
+        Mem_Free(trace->histMoment2);
+        Mem_Free(trace->histSampleCount);
+        Mem_Free(trace->histDepth);
+        memset(trace, 0, sizeof(*trace));
+    }
+}
+
+void PtTrace_Gui(PtTrace* trace)
+{
+    if (trace && igExCollapsingHeader1("pt trace"))
+    {
+        igIndent(0.0f);
+        igText("Extension Rays: %.2f M/s", trace->raysPerSecond * 1e-6f);
+        igText("Converged Pixels: %.1f%%", trace->convergedFraction * 100.0f);
+        DofInfo_Gui(&trace->dofinfo);
+        PtScene_Gui(trace->scene);
+        igUnindent(0.0f);
+    }
+}
+
+void DofInfo_New(PtDofInfo* dof)
+{
+    if (dof)
+    {
+        dof->aperture = 5.0f * kMilli;
+        dof->focalLength = 6.0f;
+        dof->bladeCount = 5;
+        dof->bladeRot = kPi / 10.0f;
+        dof->focalPlaneCurvature = 0.05f;
+        dof->autoFocus = true;
+        dof->autoFocusSpeed = 3.0f;
+    }
+}
+
+void DofInfo_Gui(PtDofInfo* dof)
+{
+    if (dof && igExCollapsingHeader1("dofinfo"))
+    {
+        float aperture = dof->aperture / kMilli;
+        igExSliderFloat("Aperture, millimeters", &aperture, 0.1f, 100.0f);
+        dof->aperture = aperture * kMilli;
+        igCheckbox("Autofocus", &dof->autoFocus);
+        if (dof->autoFocus)
+        {
+            igExSliderFloat("Autofocus Rate", &dof->autoFocusSpeed, 0.01f, 10.0f);
+        }
+        else
+        {
+            float focalLength = log2f(dof->focalLength);
+            igExSliderFloat("Focal Length, log2 meters", &focalLength, -5.0f, 10.0f);
+            dof->focalLength = exp2f(focalLength);
+        }
+        igText("Focal Length, meters: %f", dof->focalLength);
+        igExSliderFloat("Focal Plane Curvature", &dof->focalPlaneCurvature, 0.0f, 1.0f);
+        igExSliderInt("Blade Count", &dof->bladeCount, 3, 666);
+        igExSliderFloat("Blade Rotation", &dof->bladeRot, 0.0f, kTau);
+    }
+}
+
+pim_inline float4 VEC_CALL GetPosition(
+    const PtScene *const pim_noalias scene,
+    PtRayHit hit)
+{
+    float4 const *const pim_noalias positions = scene->positions;
+    i32 const *const pim_noalias tri = scene->indices + hit.iVert;
+    return f4_blend(
+        positions[tri[0]],
+        positions[tri[1]],
+        positions[tri[2]],
+        hit.wuvt);
+}
+
+pim_inline float4 VEC_CALL GetNormal(
+    const PtScene *const pim_noalias scene,
+    PtRayHit hit)
+{
+    float4 const *const pim_noalias normals = scene->normals;
+    i32 const *const pim_noalias tri = scene->indices + hit.iVert;
+    float4 N = f4_blend(
+        normals[tri[0]],
+        normals[tri[1]],
+        normals[tri[2]],
+        hit.wuvt);
     N = (f4_dot3(hit.normal, N) > 0.0f) ? N : f4_neg(N);
     return f4_normalize3(N);
 }
@@ -1084,10 +3553,11 @@ pim_inline float2 VEC_CALL GetUV(
     PtRayHit hit)
 {
     float2 const *const pim_noalias uvs = scene->uvs;
+    i32 const *const pim_noalias tri = scene->indices + hit.iVert;
     return f2_blend(
-        uvs[hit.iVert + 0],
-        uvs[hit.iVert + 1],
-        uvs[hit.iVert + 2],
+        uvs[tri[0]],
+        uvs[tri[1]],
+        uvs[tri[2]],
         hit.wuvt);
 }
 
@@ -1095,8 +3565,9 @@ pim_inline float VEC_CALL GetArea(const PtScene *const pim_noalias scene, i32 iV
 {
     float4 const *const pim_noalias positions = scene->positions;
     ASSERT(iVert >= 0);
-    ASSERT((iVert + 2) < scene->vertCount);
-    return TriArea3D(positions[iVert + 0], positions[iVert + 1], positions[iVert + 2]);
+    ASSERT((iVert + 2) < scene->indexCount);
+    i32 const *const pim_noalias tri = scene->indices + iVert;
+    return TriArea3D(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
 }
 
 pim_inline Material const *const pim_noalias VEC_CALL GetMaterial(
@@ -1105,8 +3576,8 @@ pim_inline Material const *const pim_noalias VEC_CALL GetMaterial(
 {
     i32 iVert = hit.iVert;
     ASSERT(iVert >= 0);
-    ASSERT(iVert < scene->vertCount);
-    i32 matIndex = scene->matIds[iVert];
+    ASSERT(iVert < scene->indexCount);
+    i32 matIndex = scene->matIds[iVert / 3];
     ASSERT(matIndex >= 0);
     ASSERT(matIndex < scene->matCount);
     return &scene->materials[matIndex];
@@ -1158,6 +3629,63 @@ pim_inline float4 VEC_CALL GetSky(
     return f4_0;
 }
 
+// filtered texel of a packed material
+typedef struct PtMatSample_s
+{
+    float4 albedo;
+    float4 rome;
+    float4 normal;      // tangent space
+} PtMatSample;
+
+pim_inline PtMatSample VEC_CALL SampleMatTexMip(
+    PtMatTex const *const pim_noalias matTex,
+    float2 uv,
+    i32 m)
+{
+    const int2 size = CalcMipSize(matTex->size, m);
+    PtTexel const *const pim_noalias texels = matTex->texels + CalcMipOffset(matTex->size, m);
+    const bilinear_t b = BilinearWrapMortonPow2(size, uv);
+    const PtTexel t0 = texels[b.a];
+    const PtTexel t1 = texels[b.b];
+    const PtTexel t2 = texels[b.c];
+    const PtTexel t3 = texels[b.d];
+    PtMatSample sample;
+    sample.albedo = BilinearBlend_c32(t0.albedo, t1.albedo, t2.albedo, t3.albedo, b.frac);
+    sample.rome = BilinearBlend_c32(t0.rome, t1.rome, t2.rome, t3.rome, b.frac);
+    sample.normal = BilinearBlend_xy16(t0.normal, t1.normal, t2.normal, t3.normal, b.frac);
+    return sample;
+}
+
+// mip: level of detail in texels of matTex, <= 0 for mip 0
+pim_inline PtMatSample VEC_CALL SampleMatTex(
+    PtMatTex const *const pim_noalias matTex,
+    float2 uv,
+    float mip)
+{
+    if (mip <= 0.0f)
+    {
+        return SampleMatTexMip(matTex, uv, 0);
+    }
+    mip = f1_min(mip, CalcMipCount(matTex->size) - 1.0f);
+    i32 m0 = (i32)f1_floor(mip);
+    i32 m1 = (i32)f1_ceil(mip);
+    float t = f1_frac(mip);
+    PtMatSample s0 = SampleMatTexMip(matTex, uv, m0);
+    PtMatSample s1 = SampleMatTexMip(matTex, uv, m1);
+    s0.albedo = f4_lerpvs(s0.albedo, s1.albedo, t);
+    s0.rome = f4_lerpvs(s0.rome, s1.rome, t);
+    s0.normal = f4_normalize3(f4_lerpvs(s0.normal, s1.normal, t));
+    return s0;
+}
+
+pim_inline PtMatTex const *const pim_noalias VEC_CALL GetMatTex(
+    const PtScene *const pim_noalias scene,
+    PtRayHit hit)
+{
+    i32 iTex = scene->matToTex[scene->matIds[hit.iVert / 3]];
+    return (iTex >= 0) ? &scene->matTexs[iTex] : NULL;
+}
+
 pim_inline float4 VEC_CALL GetEmission(
     const PtScene*const pim_noalias scene,
     float4 ro,
@@ -1171,48 +3699,52 @@ pim_inline float4 VEC_CALL GetEmission(
     }
     else
     {
-        Material const *const pim_noalias mat = GetMaterial(scene, hit);
-        float2 uv = GetUV(scene, hit);
-        float4 albedo = f4_1;
-        {
-            Texture const *const tex = Texture_Get(mat->albedo);
-            if (tex)
-            {
-                albedo = UvBilinearWrapPow2_c32(tex->texels, tex->size, uv);
-            }
-        }
-        float e = 0.0f;
+        PtMatTex const *const pim_noalias matTex = GetMatTex(scene, hit);
+        if (matTex)
         {
-            Texture const *const tex = Texture_Get(mat->rome);
-            if (tex)
-            {
-                e = UvBilinearWrapPow2_c32(tex->texels, tex->size, uv).w;
-            }
+            PtMatSample sample = SampleMatTex(matTex, GetUV(scene, hit), 0.0f);
+            return UnpackEmission(sample.albedo, sample.rome.w);
         }
-        return UnpackEmission(albedo, e);
+        return UnpackEmission(f4_1, 0.0f);
     }
 }
 
-pim_inline float4 VEC_CALL SampleAlbedo(const Material* mat, float2 uv)
+// ray cone texture lod, from "Texture Level of Detail Strategies for
+// Real-Time Ray Tracing" (Akenine-Moller et al, Ray Tracing Gems ch. 20).
+// returns the mip of a 1x1 texel texture; add CalcTexelLod for a texture.
+pim_inline float VEC_CALL CalcConeLod(
+    const PtScene *const pim_noalias scene,
+    PtRayHit hit,
+    float4 rd,
+    float coneWidth)
 {
-    float4 value = f4_1;
-    Texture const *const pim_noalias tex = Texture_Get(mat->albedo);
-    if (tex)
+    if (coneWidth <= 0.0f)
+    {
+        return -kMaxConeLod;
+    }
+    float4 const *const pim_noalias positions = scene->positions;
+    float2 const *const pim_noalias uvs = scene->uvs;
+    i32 const *const pim_noalias tri = scene->indices + hit.iVert;
+    float4 p0 = positions[tri[0]];
+    float2 u0 = uvs[tri[0]];
+    float worldArea = f4_length3(f4_cross3(
+        f4_sub(positions[tri[1]], p0),
+        f4_sub(positions[tri[2]], p0)));
+    float2 e1 = f2_sub(uvs[tri[1]], u0);
+    float2 e2 = f2_sub(uvs[tri[2]], u0);
+    float uvArea = f1_abs(e1.x * e2.y - e1.y * e2.x);
+    float cosTheta = f1_abs(f4_dot3(hit.normal, rd));
+    if ((worldArea < kEpsilon * kEpsilon) || (uvArea < kEpsilon * kEpsilon) || (cosTheta < kEpsilon))
     {
-        value = UvBilinearWrapPow2_c32(tex->texels, tex->size, uv);
+        return -kMaxConeLod;
     }
-    return value;
+    float lod = 0.5f * log2f(uvArea / worldArea) + log2f(coneWidth / cosTheta);
+    return f1_clamp(lod, -kMaxConeLod, kMaxConeLod);
 }
 
-pim_inline float4 VEC_CALL SampleRome(const Material* mat, float2 uv)
+pim_inline float VEC_CALL CalcTexelLod(int2 size)
 {
-    float4 value = f4_v(0.5f, 1.0f, 0.0f, 0.0f);
-    Texture const *const pim_noalias tex = Texture_Get(mat->rome);
-    if (tex)
-    {
-        value = UvBilinearWrapPow2_c32(tex->texels, tex->size, uv);
-    }
-    return value;
+    return 0.5f * log2f((float)(size.x * size.y));
 }
 
 // M: geometry normal
@@ -1224,23 +3756,13 @@ pim_inline float4 VEC_CALL FixShadingNormal(float4 M, float4 N)
     return N;
 }
 
-pim_inline float4 VEC_CALL SampleNormal(const Material* mat, float2 uv, float4 N)
-{
-    Texture const *const pim_noalias tex = Texture_Get(mat->normal);
-    if (tex)
-    {
-        float4 Nts = UvBilinearWrapPow2_xy16(tex->texels, tex->size, uv);
-        N = FixShadingNormal(N, TanToWorld(N, Nts));
-    }
-    return N;
-}
-
+// coneWidth: ray cone width at the hit, 0 to sample mip 0
 pim_inline PtSurfHit VEC_CALL GetSurface(
     const PtScene *const pim_noalias scene,
     float4 ro,
     float4 rd,
     PtRayHit hit,
-    i32 bounce)
+    float coneWidth)
 {
     PtSurfHit surf;
     surf.type = hit.type;
@@ -1268,9 +3790,17 @@ pim_inline PtSurfHit VEC_CALL GetSurface(
     }
     else
     {
-        surf.N = SampleNormal(mat, uv, surf.N);
-        surf.albedo = SampleAlbedo(mat, uv);
-        float4 rome = SampleRome(mat, uv);
+        float4 rome = f4_v(0.5f, 1.0f, 0.0f, 0.0f);
+        surf.albedo = f4_1;
+        PtMatTex const *const pim_noalias matTex = GetMatTex(scene, hit);
+        if (matTex)
+        {
+            float mip = CalcConeLod(scene, hit, rd, coneWidth) + CalcTexelLod(matTex->size);
+            PtMatSample sample = SampleMatTex(matTex, uv, mip);
+            surf.N = FixShadingNormal(surf.N, TanToWorld(surf.N, sample.normal));
+            surf.albedo = sample.albedo;
+            rome = sample.rome;
+        }
         surf.emission = UnpackEmission(surf.albedo, rome.w);
         surf.roughness = rome.x;
         surf.occlusion = rome.y;
@@ -1280,27 +3810,31 @@ pim_inline PtSurfHit VEC_CALL GetSurface(
     return surf;
 }
 
-pim_inline PtRayHit VEC_CALL pt_intersect_local(
+// converts an embree hit record into a PtRayHit
+// hit record of a known triangle, as if a ray along rd struck it
+pim_inline PtRayHit VEC_CALL TriToRayHit(
     const PtScene *const pim_noalias scene,
-    float4 ro,
     float4 rd,
-    float tNear,
-    float tFar)
+    i32 iVert,
+    float u,
+    float v,
+    float t)
 {
     PtRayHit hit = { 0 };
-    hit.wuvt.w = -1.0f;
-    hit.iVert = -1;
+    ASSERT(iVert >= 0);
+    ASSERT(iVert < scene->indexCount);
 
-    RTCRayHit rtcHit = RtcIntersect(scene->rtcScene, ro, rd, tNear, tFar);
-    hit.normal = f4_v(rtcHit.hit.Ng_x, rtcHit.hit.Ng_y, rtcHit.hit.Ng_z, 0.0f);
-    bool hitNothing =
-        (rtcHit.hit.geomID == RTC_INVALID_GEOMETRY_ID) ||
-        (rtcHit.ray.tfar <= 0.0f);
-    if (hitNothing)
+    // embree reports Ng in instance space; rebuild it in world space
+    // with embree's winding: (v0 - v1) x (v2 - v0)
     {
-        hit.type = PtHit_Nothing;
-        return hit;
+        float4 const *const pim_noalias positions = scene->positions;
+        i32 const *const pim_noalias tri = scene->indices + iVert;
+        float4 A = positions[tri[0]];
+        float4 B = positions[tri[1]];
+        float4 C = positions[tri[2]];
+        hit.normal = f4_cross3(f4_sub(A, B), f4_sub(C, A));
     }
+
     hit.type = PtHit_Triangle;
     if (f4_dot3(hit.normal, rd) > 0.0f)
     {
@@ -1309,20 +3843,87 @@ pim_inline PtRayHit VEC_CALL pt_intersect_local(
     }
     hit.normal = f4_normalize3(hit.normal);
 
-    ASSERT(rtcHit.hit.primID != RTC_INVALID_GEOMETRY_ID);
-    i32 iVert = rtcHit.hit.primID * 3;
-    ASSERT(iVert >= 0);
-    ASSERT(iVert < scene->vertCount);
-    float u = f1_sat(rtcHit.hit.u);
-    float v = f1_sat(rtcHit.hit.v);
-    float w = f1_sat(1.0f - (u + v));
-    float t = rtcHit.ray.tfar;
+    u = f1_sat(u);
+    v = f1_sat(v);
+    float w = f1_sat(1.0f - (u + v));
+
+    hit.iVert = iVert;
+    hit.wuvt = f4_v(w, u, v, t);
+    hit.flags = GetMaterial(scene, hit)->flags;
+
+    return hit;
+}
+
+pim_inline PtRayHit VEC_CALL RtcToRayHit(
+    const PtScene *const pim_noalias scene,
+    float4 rd,
+    u32 geomID,
+    u32 instID,
+    u32 primID,
+    float u,
+    float v,
+    float t)
+{
+    bool hitNothing =
+        (geomID == RTC_INVALID_GEOMETRY_ID) ||
+        (t <= 0.0f);
+    if (hitNothing)
+    {
+        PtRayHit hit = { 0 };
+        hit.wuvt.w = -1.0f;
+        hit.iVert = -1;
+        hit.type = PtHit_Nothing;
+        return hit;
+    }
+
+    ASSERT(primID != RTC_INVALID_GEOMETRY_ID);
+    ASSERT(instID < (u32)scene->instCount);
+    i32 iVert = scene->instances[instID].indexBase + primID * 3;
+    return TriToRayHit(scene, rd, iVert, u, v, t);
+}
 
-    hit.iVert = iVert;
-    hit.wuvt = f4_v(w, u, v, t);
-    hit.flags = GetMaterial(scene, hit)->flags;
+pim_inline PtRayHit VEC_CALL pt_intersect_local(
+    const PtScene *const pim_noalias scene,
+    float4 ro,
+    float4 rd,
+    float tNear,
+    float tFar)
+{
+    RTCRayHit rtcHit = RtcIntersect(scene->rtcScene, ro, rd, tNear, tFar);
+    return RtcToRayHit(
+        scene,
+        rd,
+        rtcHit.hit.geomID,
+        rtcHit.hit.instID[0],
+        rtcHit.hit.primID,
+        rtcHit.hit.u,
+        rtcHit.hit.v,
+        rtcHit.ray.tfar);
+}
 
-    return hit;
+// ros[i].w = tNear
+// rds[i].w = tFar
+pim_inline void VEC_CALL pt_intersect16_local(
+    const PtScene *const pim_noalias scene,
+    float4 const *const pim_noalias ros,
+    float4 const *const pim_noalias rds,
+    PtRayHit *const pim_noalias hitsOut,
+    i32 count)
+{
+    ASSERT(count <= 16);
+    RTCRayHit16 rtcHit = RtcIntersect16(scene->rtcScene, ros, rds, count);
+    for (i32 i = 0; i < count; ++i)
+    {
+        hitsOut[i] = RtcToRayHit(
+            scene,
+            rds[i],
+            rtcHit.hit.geomID[i],
+            rtcHit.hit.instID[0][i],
+            rtcHit.hit.primID[i],
+            rtcHit.hit.u[i],
+            rtcHit.hit.v[i],
+            rtcHit.ray.tfar[i]);
+    }
 }
 
 PtRayHit VEC_CALL Pt_Intersect(
@@ -1568,16 +4169,52 @@ pim_inline void VEC_CALL LightOnHit(
     {
         return;
     }
+    if (!scene->lightCells)
+    {
+        return;
+    }
     float loglum = log2f(lum) - kLog2Epsilon;
     u32 amt = (u32)(loglum * 16.0f + 0.5f);
     i32 iGrid = Grid_Index(&scene->lightGrid, ro);
-    i32 iEmit = scene->vertToEmit[iVert];
+    i32 iEmit = scene->triToEmit[iVert / 3];
     if (iEmit >= 0)
     {
-        Dist1D* pim_noalias dist = &scene->lightDists[iGrid];
-        if (dist->length)
+        const PtLightCell cell = scene->lightCells[iGrid];
+        PtLightEntry* pim_noalias entries = scene->lightEntries + cell.offset;
+        i32 i = LightCell_Find(entries, cell.count, iEmit);
+        if (i >= 0)
+        {
+            // tally into this thread's slot, only a colliding entry is
+            // flushed to the shared counter
+            const i32 entry = cell.offset + i + 1;
+            const u32 slot = ((u32)entry * 2654435761u) >> (32 - kLightTallyShift);
+            PtLightTally *const pim_noalias tally =
+                scene->lightTallies + Task_ThreadId() * kLightTallySlots + slot;
+            if (tally->entry != entry)
+            {
+                if (tally->entry > 0)
+                {
+                    fetch_add_u32(&scene->lightEntries[tally->entry - 1].live, tally->amt, MO_Relaxed);
+                }
+                tally->entry = entry;
+                tally->amt = 0;
+            }
+            tally->amt += amt;
+        }
+        else
         {
-            fetch_add_u32(&dist->live[iEmit], amt, MO_Relaxed);
+            // the cell's probes missed it, UpdateDists adds it to the cell
+            const u32 key = ((u32)iGrid * 2654435761u) ^ ((u32)iEmit * 2246822519u);
+            const u32 slot = key >> (32 - kLightMissShift);
+            PtLightMiss *const pim_noalias miss =
+                scene->lightMisses + Task_ThreadId() * kLightMissSlots + slot;
+            if ((miss->cell != iGrid + 1) || (miss->iEmit != iEmit))
+            {
+                miss->cell = iGrid + 1;
+                miss->iEmit = iEmit;
+                miss->amt = 0;
+            }
+            miss->amt += amt;
         }
     }
 }
@@ -1586,29 +4223,41 @@ pim_inline bool VEC_CALL LightSelect(
     PtSampler*const pim_noalias sampler,
     PtScene*const pim_noalias scene,
     float4 position,
-    i32* iVertOut,
+    i32* iEmitOut,
     float* pdfOut)
 {
     if (scene->emissiveCount == 0)
     {
-        *iVertOut = -1;
+        *iEmitOut = -1;
         *pdfOut = 0.0f;
         return false;
     }
 
-    i32 iCell = Grid_Index(&scene->lightGrid, position);
-    const Dist1D* dist = scene->lightDists + iCell;
-    if (!dist->length)
+    if (scene->lightNodes)
     {
+        i32 iEmit = -1;
+        float pdf = 0.0f;
+        if (LightTree_Select(sampler, scene, position, &iEmit, &pdf))
+        {
+            *iEmitOut = iEmit;
+            *pdfOut = pdf;
+            return true;
+        }
         return false;
     }
 
-    i32 iEmit = Dist1D_SampleD(dist, Sample1D(sampler));
-    float pdf = Dist1D_PdfD(dist, iEmit);
+    i32 iCell = Grid_Index(&scene->lightGrid, position);
+    const PtLightCell cell = scene->lightCells[iCell];
+    if (!cell.count)
+    {
+        return false;
+    }
 
-    i32 iVert = scene->emitToVert[iEmit];
+    PtLightEntry const *const pim_noalias entries = scene->lightEntries + cell.offset;
+    i32 i = LightCell_Sample(entries, cell.count, scene->lightAlias, Sample1D(sampler));
+    float pdf = LightEntry_Pdf(entries + i);
 
-    *iVertOut = iVert;
+    *iEmitOut = entries[i].iEmit;
     *pdfOut = pdf;
     return pdf > kEpsilon;
 }
@@ -1619,14 +4268,20 @@ pim_inline float VEC_CALL LightSelectPdf(
     float4 ro)
 {
     float selectPdf = 1.0f;
+    i32 iEmit = scene->triToEmit[iVert / 3];
+    if ((iEmit >= 0) && scene->lightNodes)
+    {
+        return LightTree_Pdf(scene, iEmit, ro);
+    }
     i32 iGrid = Grid_Index(&scene->lightGrid, ro);
-    i32 iEmit = scene->vertToEmit[iVert];
     if (iEmit >= 0)
     {
-        const Dist1D* pim_noalias dist = &scene->lightDists[iGrid];
-        if (dist->length)
+        const PtLightCell cell = scene->lightCells[iGrid];
+        if (cell.count)
         {
-            selectPdf = Dist1D_PdfD(dist, iEmit);
+            PtLightEntry const *const pim_noalias entries = scene->lightEntries + cell.offset;
+            i32 i = LightCell_Find(entries, cell.count, iEmit);
+            selectPdf = (i >= 0) ? LightEntry_Pdf(entries + i) : 0.0f;
         }
     }
     return selectPdf;
@@ -1636,19 +4291,14 @@ pim_inline PtLightSample VEC_CALL SampleLight(
     PtSampler *const pim_noalias sampler,
     PtScene *const pim_noalias scene,
     float4 ro,
-    i32 iVert,
+    i32 iEmit,
     i32 bounce)
 {
     PtLightSample sample = { 0 };
 
-    float4 wuv = SampleBaryCoord(Sample2D(sampler));
-
-    const float4* pim_noalias positions = scene->positions;
-    float4 A = positions[iVert + 0];
-    float4 B = positions[iVert + 1];
-    float4 C = positions[iVert + 2];
-    float4 pt = f4_blend(A, B, C, wuv);
-    float area = TriArea3D(A, B, C);
+    float4 pt, wuv;
+    SampleEmitPoint(sampler, scene, iEmit, &pt, &wuv);
+    float area = scene->emitAreas[iEmit];
 
     float4 rd = f4_sub(pt, ro);
     float distSq = f4_dot3(rd, rd);
@@ -1660,7 +4310,7 @@ pim_inline PtLightSample VEC_CALL SampleLight(
     sample.wuvt = wuv;
 
     PtRayHit hit = pt_intersect_local(scene, ro, rd, 0.0f, distance + 0.01f * kMilli);
-    if ((hit.type != PtHit_Nothing) && (hit.iVert == iVert))
+    if ((hit.type != PtHit_Nothing) && (hit.iVert >= 0) && (scene->triToEmit[hit.iVert / 3] == iEmit))
     {
         float cosTheta = f1_abs(f4_dot3(rd, hit.normal));
         sample.pdf = LightPdf(area, cosTheta, distSq);
@@ -1676,6 +4326,93 @@ pim_inline PtLightSample VEC_CALL SampleLight(
     return sample;
 }
 
+// samples up to 16 lights, resolving visibility with a single packet of
+// shadow rays. invisible or degenerate samples have a zero pdf.
+// luminance already has CalcTransmittance applied.
+pim_inline void VEC_CALL SampleLights16(
+    PtSampler *const pim_noalias sampler,
+    PtScene *const pim_noalias scene,
+    float4 ro,
+    i32 srcVert,
+    i32 bounce,
+    i32 count,
+    PtLightSample *const pim_noalias samples,
+    float *const pim_noalias selectPdfs)
+{
+    ASSERT(count <= 16);
+    float4 ros[16];
+    float4 rds[16];
+    bool visibles[16];
+    i32 iVerts[16];
+    i32 iEmits[16];
+
+    // the source surface's own light is coplanar with it
+    const i32 srcEmit = (srcVert >= 0) ? scene->triToEmit[srcVert / 3] : -1;
+    for (i32 i = 0; i < count; ++i)
+    {
+        PtLightSample sample = { 0 };
+        float selectPdf = 0.0f;
+        i32 iEmit = -1;
+        i32 iVert = -1;
+        ros[i] = ro;
+        ros[i].w = 0.0f;
+        rds[i] = f4_v(0.0f, 0.0f, 1.0f, 0.0f);
+        if (LightSelect(sampler, scene, ro, &iEmit, &selectPdf) && (iEmit != srcEmit))
+        {
+            float4 pt, wuv;
+            iVert = SampleEmitPoint(sampler, scene, iEmit, &pt, &wuv);
+            float4 rd = f4_sub(pt, ro);
+            float distance = f4_length3(rd);
+            if (distance > kEpsilon)
+            {
+                rd = f4_divvs(rd, distance);
+                wuv.w = distance;
+                sample.direction = rd;
+                sample.wuvt = wuv;
+                rds[i] = rd;
+                rds[i].w = f1_max(0.0f, distance - kMilli);
+            }
+            else
+            {
+                iVert = -1;
+            }
+        }
+        else
+        {
+            iVert = -1;
+        }
+        iVerts[i] = iVert;
+        iEmits[i] = iEmit;
+        samples[i] = sample;
+        selectPdfs[i] = selectPdf;
+    }
+
+    RtcOccluded16(scene->rtcScene, ros, rds, visibles, count);
+
+    for (i32 i = 0; i < count; ++i)
+    {
+        const i32 iVert = iVerts[i];
+        if ((iVert < 0) || !visibles[i])
+        {
+            continue;
+        }
+        PtLightSample sample = samples[i];
+        float4 rd = sample.direction;
+        float distance = sample.wuvt.w;
+        PtRayHit hit = TriToRayHit(scene, rd, iVert, sample.wuvt.y, sample.wuvt.z, distance);
+        float cosTheta = f1_abs(f4_dot3(rd, hit.normal));
+        sample.pdf = LightPdf(scene->emitAreas[iEmits[i]], cosTheta, distance * distance);
+        sample.luminance = GetEmission(scene, ro, rd, hit, bounce);
+        if (f4_hmax3(sample.luminance) > kEpsilon)
+        {
+            float4 Tr = CalcTransmittance(sampler, scene, ro, rd, distance);
+            sample.luminance = f4_mul(sample.luminance, Tr);
+        }
+        ASSERT(f4_hmin3(sample.luminance) >= 0.0f);
+        samples[i] = sample;
+    }
+}
+
 pim_inline float VEC_CALL LightEvalPdf(
     PtSampler *const pim_noalias sampler,
     PtScene *const pim_noalias scene,
@@ -1689,7 +4426,7 @@ pim_inline float VEC_CALL LightEvalPdf(
     if (hit.type != PtHit_Nothing)
     {
         float cosTheta = f1_abs(f4_dot3(rd, hit.normal));
-        float area = GetArea(scene, hit.iVert);
+        float area = GetLightArea(scene, hit.iVert);
         float distSq = f1_max(kEpsilon, hit.wuvt.w * hit.wuvt.w);
         pdf = LightPdf(area, cosTheta, distSq);
     }
@@ -1718,30 +4455,29 @@ pim_inline float4 VEC_CALL EstimateDirect(
     const float pSmooth = 1.0f - pRough;
     if (Sample1D(sampler) < pRough)
     {
-        i32 iVert;
-        float selectPdf;
-        if (LightSelect(sampler, scene, surf->P, &iVert, &selectPdf))
+        // each light sample is an independent estimate; average them
+        const i32 count = ms_lightSamples;
+        PtLightSample samples[16];
+        float selectPdfs[16];
+        SampleLights16(sampler, scene, ro, srcHit->iVert, bounce, count, samples, selectPdfs);
+        for (i32 i = 0; i < count; ++i)
         {
-            if (srcHit->iVert != iVert)
+            float4 rd = samples[i].direction;
+            float4 Li = samples[i].luminance;
+            float lightPdf = samples[i].pdf * selectPdfs[i] * pRough;
+            if ((lightPdf > kEpsilon) && (f4_hmax3(Li) > kEpsilon))
             {
-                // already has CalcTransmittance applied
-                PtLightSample sample = SampleLight(sampler, scene, ro, iVert, bounce);
-                float4 rd = sample.direction;
-                float4 Li = sample.luminance;
-                float lightPdf = sample.pdf * selectPdf * pRough;
-                if ((lightPdf > kEpsilon) && (f4_hmax3(Li) > kEpsilon))
+                float4 brdf = BrdfEval(sampler, I, surf, rd);
+                Li = f4_mul(Li, brdf);
+                float brdfPdf = brdf.w * pSmooth;
+                if (brdfPdf > kEpsilon)
                 {
-                    float4 brdf = BrdfEval(sampler, I, surf, rd);
-                    Li = f4_mul(Li, brdf);
-                    float brdfPdf = brdf.w * pSmooth;
-                    if (brdfPdf > kEpsilon)
-                    {
-                        Li = f4_mulvs(Li, PowerHeuristic(lightPdf, brdfPdf) / lightPdf);
-                        result = f4_add(result, Li);
-                    }
+                    Li = f4_mulvs(Li, PowerHeuristic(lightPdf, brdfPdf) / lightPdf);
+                    result = f4_add(result, Li);
                 }
             }
         }
+        result = f4_divvs(result, (float)count);
     }
     else
     {
@@ -1777,11 +4513,11 @@ pim_inline bool VEC_CALL EvaluateLight(
     float4 *const pim_noalias dirOut,
     i32 bounce)
 {
-    i32 iVert;
+    i32 iEmit;
     float selectPdf;
-    if (LightSelect(sampler, scene, P, &iVert, &selectPdf))
+    if (LightSelect(sampler, scene, P, &iEmit, &selectPdf))
     {
-        PtLightSample sample = SampleLight(sampler, scene, P, iVert, bounce);
+        PtLightSample sample = SampleLight(sampler, scene, P, iEmit, bounce);
         if (sample.pdf > kEpsilon)
         {
             *lightOut = f4_divvs(sample.luminance, sample.pdf * selectPdf);
@@ -1838,7 +4574,7 @@ static void media_desc_update(PtMediaDesc *const desc)
     desc->rcpMajorant = 1.0f / f4_hmax3(CalcMajorant(desc));
 }
 
-static void media_desc_load(PtMediaDesc *const desc, const char* name)
+static void media_desc_load(PtMediaDesc *const desc, PtMediaVolume *const vol, const char* name)
 {
     if (!desc || !name)
     {
@@ -1872,9 +4608,40 @@ static void media_desc_load(PtMediaDesc *const desc, const char* name)
         media_desc_new(desc);
     }
     SerObj_Del(root);
+
+    // optional baked density, UpdateMediaVolume discards it on a hash mismatch
+    SPrintf(ARGS(filename), "%s.media", name);
+    FStream file = FStream_Open(filename, "rb");
+    if (vol && FStream_IsOpen(file))
+    {
+        PtMediaVolume loaded = { 0 };
+        bool ok = FStream_Read(file, &loaded.hash, sizeof(loaded.hash)) == sizeof(loaded.hash);
+        ok = ok && (FStream_Read(file, &loaded.grid, sizeof(loaded.grid)) == sizeof(loaded.grid));
+        const i32 len = ok ? Grid_Len(&loaded.grid) : 0;
+        ok = ok && (len > 0);
+        if (ok)
+        {
+            loaded.density = Perm_Alloc(len);
+            ok = FStream_Read(file, loaded.density, len) == len;
+        }
+        if (ok)
+        {
+            Mem_Free(vol->density);
+            *vol = loaded;
+        }
+        else
+        {
+            Mem_Free(loaded.density);
+            Con_Logf(LogSev_Error, "pt", "Failed to load media volume '%s'", filename);
+        }
+    }
+    FStream_Close(&file);
 }
 
-static void media_desc_save(PtMediaDesc const *const desc, const char* name)
+static void media_desc_save(
+    PtMediaDesc const *const desc,
+    PtMediaVolume const *const vol,
+    const char* name)
 {
     if (!desc || !name)
     {
@@ -1905,9 +4672,29 @@ static void media_desc_save(PtMediaDesc const *const desc, const char* name)
         }
         SerObj_Del(root);
     }
+
+    if (vol && vol->density)
+    {
+        SPrintf(ARGS(filename), "%s.media", name);
+        FStream file = FStream_Open(filename, "wb");
+        bool ok = FStream_IsOpen(file);
+        if (ok)
+        {
+            const i32 len = Grid_Len(&vol->grid);
+            ok = FStream_Write(file, &vol->hash, sizeof(vol->hash)) == sizeof(vol->hash);
+            ok = ok && (FStream_Write(file, &vol->grid, sizeof(vol->grid)) == sizeof(vol->grid));
+            ok = ok && (FStream_Write(file, vol->density, len) == len);
+            FStream_Close(&file);
+        }
+        if (!ok)
+        {
+            Con_Logf(LogSev_Error, "pt", "Failed to save media volume '%s'", filename);
+        }
+    }
 }
 
-static void media_desc_gui(PtMediaDesc *const desc)
+// pendingLoad: preset name for PtScene_Update to load, between traces
+static void media_desc_gui(PtMediaDesc *const desc, PtMediaVolume *const vol, char* pendingLoad)
 {
     const u32 ldrPicker =
         ImGuiColorEditFlags_Float |
@@ -1930,11 +4717,11 @@ static void media_desc_gui(PtMediaDesc *const desc)
         igInputText("Preset Name", name, sizeof(name), 0, NULL, NULL);
         if (igExButton("Load Preset"))
         {
-            media_desc_load(desc, name);
+            StrCpy(pendingLoad, PIM_PATH, name);
         }
         if (igExButton("Save Preset"))
         {
-            media_desc_save(desc, name);
+            media_desc_save(desc, vol, name);
         }
 
         const float kMinMfp = 0.1f;
@@ -1995,8 +4782,74 @@ static void media_desc_gui(PtMediaDesc *const desc)
     }
 }
 
+// height density of the noise slab, at most 1
+pim_inline float VEC_CALL Media_NoiseDensity(
+    PtMediaDesc const *const desc,
+    float4 P)
+{
+    float noiseFreq = desc->noiseFreq;
+    float noise = stb_perlinf_fbm_noise3(
+        P.x * noiseFreq,
+        P.y * noiseFreq,
+        P.z * noiseFreq,
+        desc->noiseLacunarity,
+        desc->noiseGain,
+        desc->noiseOctaves);
+    float noiseScale = desc->noiseScale;
+    float height = desc->noiseHeight + noiseScale * noise;
+    float dist = f1_distance(P.y, height) / noiseScale;
+    return f1_sat(1.0f - dist);
+}
+
+// trilinear fetch of the baked height density
+// returns false when P lies outside of the volume
+pim_inline bool VEC_CALL MediaVolume_Sample(
+    PtMediaVolume const *const pim_noalias vol,
+    float4 P,
+    float *const pim_noalias densityOut)
+{
+    u8 const *const pim_noalias density = vol->density;
+    if (!density)
+    {
+        return false;
+    }
+    const Grid grid = vol->grid;
+    const Box3D bounds = grid.bounds;
+    if ((P.x < bounds.lo.x) || (P.y < bounds.lo.y) || (P.z < bounds.lo.z) ||
+        (P.x > bounds.hi.x) || (P.y > bounds.hi.y) || (P.z > bounds.hi.z))
+    {
+        return false;
+    }
+
+    // voxels store their center value
+    const int3 size = grid.size;
+    float4 c = f4_subvs(f4_mulvs(f4_sub(P, bounds.lo), grid.cellsPerMeter), 0.5f);
+    c.x = f1_clamp(c.x, 0.0f, size.x - 1.0f);
+    c.y = f1_clamp(c.y, 0.0f, size.y - 1.0f);
+    c.z = f1_clamp(c.z, 0.0f, size.z - 1.0f);
+    const i32 x0 = (i32)c.x;
+    const i32 y0 = (i32)c.y;
+    const i32 z0 = (i32)c.z;
+    const i32 dx = (x0 + 1 < size.x) ? 1 : 0;
+    const i32 dy = (y0 + 1 < size.y) ? size.x : 0;
+    const i32 dz = (z0 + 1 < size.z) ? size.x * size.y : 0;
+    const float fx = c.x - x0;
+    const float fy = c.y - y0;
+    const float fz = c.z - z0;
+
+    u8 const *const pim_noalias p = density + x0 + y0 * size.x + z0 * size.x * size.y;
+    float a = f1_lerp(p[0], p[dx], fx);
+    float b = f1_lerp(p[dy], p[dy + dx], fx);
+    float d = f1_lerp(p[dz], p[dz + dx], fx);
+    float e = f1_lerp(p[dz + dy], p[dz + dy + dx], fx);
+    float value = f1_lerp(f1_lerp(a, b, fy), f1_lerp(d, e, fy), fz);
+    *densityOut = value * (1.0f / 255.0f);
+    return true;
+}
+
 pim_inline PtMedia VEC_CALL Media_Sample(
     PtMediaDesc const *const desc,
+    PtMediaVolume const *const vol,
     float4 P)
 {
     PtMedia hit;
@@ -2007,18 +4860,11 @@ pim_inline PtMedia VEC_CALL Media_Sample(
 
     if (f1_distance(P.y, desc->noiseHeight) <= desc->noiseRange)
     {
-        float noiseFreq = desc->noiseFreq;
-        float noise = stb_perlinf_fbm_noise3(
-            P.x * noiseFreq,
-            P.y * noiseFreq,
-            P.z * noiseFreq,
-            desc->noiseLacunarity,
-            desc->noiseGain,
-            desc->noiseOctaves);
-        float noiseScale = desc->noiseScale;
-        float height = desc->noiseHeight + noiseScale * noise;
-        float dist = f1_distance(P.y, height) / noiseScale;
-        float heightDensity = f1_sat(1.0f - dist);
+        float heightDensity;
+        if (!MediaVolume_Sample(vol, P, &heightDensity))
+        {
+            heightDensity = Media_NoiseDensity(desc, P);
+        }
         float4 mu = f4_mulvs(desc->noiseMu, heightDensity);
         hit.scattering = f4_add(hit.scattering, mu);
     }
@@ -2065,6 +4911,438 @@ pim_inline float4 VEC_CALL SamplePhaseDir(
     return L;
 }
 
+// ----------------------------------------------------------------------------
+// majorant grid: piecewise constant majorants over the scene bounds,
+// walked with a 3D DDA so free paths are sampled against local majorants.
+// outside of the grid the global majorant applies.
+
+// kMajorantMeters cells over the padded bounds, coarsened to kMajorantMaxCells.
+// a single cell when the noise slab misses the scene, as the media is uniform.
+static Grid MajorantGrid_New(Box3D bounds, PtMediaDesc const *const desc)
+{
+    // flat scenes still get a cell of thickness
+    const float4 pad = f4_mulvs(
+        f4_max(f4_sub(f4_s(kMajorantMeters), f4_sub(bounds.hi, bounds.lo)), f4_0),
+        0.5f);
+    bounds.lo = f4_sub(bounds.lo, pad);
+    bounds.hi = f4_add(bounds.hi, pad);
+    const float4 range = f4_sub(bounds.hi, bounds.lo);
+
+    Grid grid;
+    const float slabLo = desc->noiseHeight - desc->noiseRange;
+    const float slabHi = desc->noiseHeight + desc->noiseRange;
+    if ((slabHi < bounds.lo.y) || (slabLo > bounds.hi.y))
+    {
+        Grid_New(&grid, bounds, 0.999f / f4_hmax3(range));
+        return grid;
+    }
+
+    float cellsPerMeter = 1.0f / kMajorantMeters;
+    float4 size = f4_ceil(f4_mulvs(range, cellsPerMeter));
+    float len = size.x * size.y * size.z;
+    // ceil rounds each axis up, so this can take a few steps
+    while (len > kMajorantMaxCells)
+    {
+        cellsPerMeter *= f1_clamp(cbrtf(kMajorantMaxCells / len), 0.01f, 0.9f);
+        size = f4_ceil(f4_mulvs(range, cellsPerMeter));
+        len = size.x * size.y * size.z;
+    }
+    Grid_New(&grid, bounds, cellsPerMeter);
+    return grid;
+}
+
+// allocates the grid over the current scene bounds, see RefitMajorants
+static bool EnsureMajorantGrid(PtScene *const pim_noalias scene)
+{
+    if (!scene->majorantMfps && (scene->vertCount > 0))
+    {
+        Box3D bounds = box_from_pts(scene->positions, scene->vertCount);
+        Grid grid = MajorantGrid_New(bounds, &scene->mediaDesc);
+        scene->majorantGrid = grid;
+        scene->majorantMfps = Tex_Alloc(sizeof(scene->majorantMfps[0]) * Grid_Len(&grid));
+        scene->majorantVolHash = 0;
+        memset(&scene->majorantDesc, 0, sizeof(scene->majorantDesc));
+    }
+    return scene->majorantMfps != NULL;
+}
+
+static void ClearMajorants(PtScene *const pim_noalias scene)
+{
+    Mem_Free(scene->majorantMfps);
+    scene->majorantMfps = NULL;
+}
+
+// majorants hold anywhere, the grid only covers the bounds for tighter ones.
+// so moving instances keep the grid until they settle, then it refits once.
+static void RefitMajorants(PtScene *const pim_noalias scene)
+{
+    if (scene->majorantMfps)
+    {
+        Box3D bounds = box_from_pts(scene->positions, scene->vertCount);
+        Grid grid = MajorantGrid_New(bounds, &scene->mediaDesc);
+        if (memcmp(&grid, &scene->majorantGrid, sizeof(grid)))
+        {
+            ClearMajorants(scene);
+        }
+    }
+}
+
+typedef struct task_UpdateMajorants
+{
+    Task task;
+    PtScene* scene;
+} task_UpdateMajorants;
+
+// largest baked density that trilinear filtering can produce within [lo, hi]
+static float MediaVolume_MaxDensity(PtMediaVolume const *const vol, float4 lo, float4 hi)
+{
+    const Grid grid = vol->grid;
+    const int3 size = grid.size;
+    const float4 a = f4_subvs(f4_mulvs(f4_sub(lo, grid.bounds.lo), grid.cellsPerMeter), 0.5f);
+    const float4 b = f4_subvs(f4_mulvs(f4_sub(hi, grid.bounds.lo), grid.cellsPerMeter), 0.5f);
+    const i32 x0 = i1_clamp((i32)floorf(a.x), 0, size.x - 1);
+    const i32 y0 = i1_clamp((i32)floorf(a.y), 0, size.y - 1);
+    const i32 z0 = i1_clamp((i32)floorf(a.z), 0, size.z - 1);
+    const i32 x1 = i1_clamp((i32)floorf(b.x) + 1, 0, size.x - 1);
+    const i32 y1 = i1_clamp((i32)floorf(b.y) + 1, 0, size.y - 1);
+    const i32 z1 = i1_clamp((i32)floorf(b.z) + 1, 0, size.z - 1);
+    u8 const *const pim_noalias density = vol->density;
+    u8 maxValue = 0;
+    for (i32 z = z0; z <= z1; ++z)
+    {
+        for (i32 y = y0; y <= y1; ++y)
+        {
+            u8 const *const pim_noalias row = density + y * size.x + z * size.x * size.y;
+            for (i32 x = x0; x <= x1; ++x)
+            {
+                maxValue = (row[x] > maxValue) ? row[x] : maxValue;
+            }
+        }
+    }
+    return maxValue * (1.0f / 255.0f);
+}
+
+static void UpdateMajorantsFn(void* pbase, i32 begin, i32 end)
+{
+    task_UpdateMajorants const *const task = pbase;
+    PtScene *const pim_noalias scene = task->scene;
+    PtMediaDesc const *const pim_noalias desc = &scene->mediaDesc;
+    PtMediaVolume const *const pim_noalias vol = &scene->mediaVolume;
+
+    // Media_Sample only adds noise within noiseRange of noiseHeight,
+    // where the height density is at most 1, or at most the baked voxels
+    const float a = 1.0f + desc->absorption;
+    const float4 constantMu = f4_mulvs(desc->constantMu, a);
+    const float4 noiseMu = f4_mulvs(desc->noiseMu, a);
+    const float constantMaj = f4_hmax3(constantMu);
+    const float slabLo = desc->noiseHeight - desc->noiseRange;
+    const float slabHi = desc->noiseHeight + desc->noiseRange;
+
+    const Grid grid = scene->majorantGrid;
+    const float halfCell = 0.5f / grid.cellsPerMeter;
+    float *const pim_noalias mfps = scene->majorantMfps;
+    for (i32 i = begin; i < end; ++i)
+    {
+        const float4 center = Grid_Position(&grid, i);
+        const float4 lo = f4_subvs(center, halfCell);
+        const float4 hi = f4_addvs(center, halfCell);
+        float maj = constantMaj;
+        if ((hi.y >= slabLo) && (lo.y <= slabHi))
+        {
+            float density = 1.0f;
+            if (vol->density)
+            {
+                density = MediaVolume_MaxDensity(vol, lo, hi);
+            }
+            maj = f4_hmax3(f4_add(constantMu, f4_mulvs(noiseMu, density)));
+        }
+        mfps[i] = 1.0f / f1_max(maj, kEpsilon);
+    }
+}
+
+// per cell maxima of the media; taken from the baked volume when present
+ProfileMark(pm_updatemajorants, UpdateMajorants)
+static void UpdateMajorants(PtScene *const pim_noalias scene)
+{
+    if (!EnsureMajorantGrid(scene))
+    {
+        return;
+    }
+    PtMediaDesc const *const pim_noalias desc = &scene->mediaDesc;
+    const u32 volHash = scene->mediaVolume.density ? scene->mediaVolume.hash : 0;
+    bool dirty = memcmp(desc, &scene->majorantDesc, sizeof(*desc)) ||
+        (volHash != scene->majorantVolHash);
+    if (!dirty)
+    {
+        return;
+    }
+    ProfileBegin(pm_updatemajorants);
+
+    // the slab moving on or off the scene changes the grid
+    Grid grid = MajorantGrid_New(scene->majorantGrid.bounds, desc);
+    if (memcmp(&grid, &scene->majorantGrid, sizeof(grid)))
+    {
+        Mem_Free(scene->majorantMfps);
+        scene->majorantGrid = grid;
+        scene->majorantMfps = Tex_Alloc(sizeof(scene->majorantMfps[0]) * Grid_Len(&grid));
+    }
+    scene->majorantDesc = *desc;
+    scene->majorantVolHash = volHash;
+
+    task_UpdateMajorants* task = Temp_Calloc(sizeof(*task));
+    task->scene = scene;
+    Task_Run(&task->task, UpdateMajorantsFn, Grid_Len(&scene->majorantGrid));
+
+    ProfileEnd(pm_updatemajorants);
+}
+
+// ----------------------------------------------------------------------------
+// media volume: the noise slab baked into a u8 3D texture,
+// so free path sampling reads a texel instead of evaluating fbm.
+
+typedef struct task_BakeMedia
+{
+    Task task;
+    PtMediaDesc desc;
+    Grid grid;
+    u8* density;
+} task_BakeMedia;
+
+static void BakeMediaFn(void* pbase, i32 begin, i32 end)
+{
+    task_BakeMedia *const pim_noalias task = pbase;
+    PtMediaDesc const *const pim_noalias desc = &task->desc;
+    const Grid grid = task->grid;
+    u8 *const pim_noalias density = task->density;
+    for (i32 i = begin; i < end; ++i)
+    {
+        float4 P = Grid_Position(&grid, i);
+        float value = Media_NoiseDensity(desc, P);
+        density[i] = (u8)(value * 255.0f + 0.5f);
+    }
+}
+
+static u32 HashMediaVolume(PtMediaDesc const *const desc, Grid const *const grid)
+{
+    u32 hash = Fnv32Bias;
+    hash = Fnv32Bytes(&desc->noiseOctaves, sizeof(desc->noiseOctaves), hash);
+    hash = Fnv32Bytes(&desc->noiseGain, sizeof(desc->noiseGain), hash);
+    hash = Fnv32Bytes(&desc->noiseLacunarity, sizeof(desc->noiseLacunarity), hash);
+    hash = Fnv32Bytes(&desc->noiseFreq, sizeof(desc->noiseFreq), hash);
+    hash = Fnv32Bytes(&desc->noiseHeight, sizeof(desc->noiseHeight), hash);
+    hash = Fnv32Bytes(&desc->noiseScale, sizeof(desc->noiseScale), hash);
+    hash = Fnv32Bytes(grid, sizeof(*grid), hash);
+    return hash;
+}
+
+ProfileMark(pm_updatemediavolume, UpdateMediaVolume)
+static void UpdateMediaVolume(PtScene *const pim_noalias scene)
+{
+    PtMediaVolume *const pim_noalias vol = &scene->mediaVolume;
+    if (!ConVar_GetBool(&cv_pt_media_bake) || !EnsureMajorantGrid(scene))
+    {
+        Mem_Free(vol->density);
+        vol->density = NULL;
+        vol->hash = 0;
+        return;
+    }
+
+    // only the slab around noiseHeight carries noise
+    PtMediaDesc const *const pim_noalias desc = &scene->mediaDesc;
+    Box3D bounds = scene->majorantGrid.bounds;
+    bounds.lo.y = f1_max(bounds.lo.y, desc->noiseHeight - desc->noiseRange);
+    bounds.hi.y = f1_min(bounds.hi.y, desc->noiseHeight + desc->noiseRange);
+    Grid grid = { 0 };
+    if (bounds.lo.y < bounds.hi.y)
+    {
+        Grid_New(&grid, bounds, 1.0f / ConVar_GetFloat(&cv_pt_media_voxel));
+    }
+    const i32 len = Grid_Len(&grid);
+    if ((len <= 0) || (len > kMediaMaxVoxels))
+    {
+        Mem_Free(vol->density);
+        vol->density = NULL;
+        vol->hash = 0;
+        return;
+    }
+
+    const u32 hash = HashMediaVolume(desc, &grid);
+    if (vol->density && (vol->hash == hash))
+    {
+        return;
+    }
+    ProfileBegin(pm_updatemediavolume);
+
+    Mem_Free(vol->density);
+    vol->grid = grid;
+    vol->hash = hash;
+    vol->density = Perm_Alloc(len);
+
+    task_BakeMedia* task = Temp_Calloc(sizeof(*task));
+    task->desc = *desc;
+    task->grid = grid;
+    task->density = vol->density;
+    Task_Run(&task->task, BakeMediaFn, len);
+
+    ProfileEnd(pm_updatemediavolume);
+}
+
+// segments of a ray with a constant majorant
+typedef struct MajorantIter_s
+{
+    float t0;       // segment start
+    float t1;       // segment end
+    float mfp;      // 1 / majorant of the segment
+    float rayLen;
+    float tIn;      // ray range within the grid
+    float tOut;
+    float4 tMax;    // ray time of the next cell boundary per axis
+    float4 tDelta;  // ray time across a cell per axis
+    int3 cell;
+    int3 step;
+    i32 phase;      // 0: before grid, 1: in grid, 2: after grid, 3: done
+} MajorantIter;
+
+pim_inline MajorantIter VEC_CALL Majorant_Begin(
+    const PtScene *const pim_noalias scene,
+    float4 ro,
+    float4 rd,
+    float rayLen)
+{
+    MajorantIter it = { 0 };
+    it.rayLen = rayLen;
+    it.tIn = rayLen;
+    it.tOut = rayLen;
+    if (!scene->majorantMfps)
+    {
+        return it;
+    }
+
+    const Grid grid = scene->majorantGrid;
+    const float metersPerCell = 1.0f / grid.cellsPerMeter;
+    const float4 lo = grid.bounds.lo;
+    const float4 hi = f4_add(lo, f4_mulvs(f4_v((float)grid.size.x, (float)grid.size.y, (float)grid.size.z, 0.0f), metersPerCell));
+    float4 rcpRd;
+    rcpRd.x = (f1_abs(rd.x) > 1e-20f) ? (1.0f / rd.x) : (rd.x < 0.0f ? -1e20f : 1e20f);
+    rcpRd.y = (f1_abs(rd.y) > 1e-20f) ? (1.0f / rd.y) : (rd.y < 0.0f ? -1e20f : 1e20f);
+    rcpRd.z = (f1_abs(rd.z) > 1e-20f) ? (1.0f / rd.z) : (rd.z < 0.0f ? -1e20f : 1e20f);
+    rcpRd.w = 0.0f;
+    float4 ta = f4_mul(f4_sub(lo, ro), rcpRd);
+    float4 tb = f4_mul(f4_sub(hi, ro), rcpRd);
+    float4 tNear = f4_min(ta, tb);
+    float4 tFar = f4_max(ta, tb);
+    float tIn = f1_max(f1_max(tNear.x, tNear.y), f1_max(tNear.z, 0.0f));
+    float tOut = f1_min(f1_min(tFar.x, tFar.y), f1_min(tFar.z, rayLen));
+    if (tIn >= tOut)
+    {
+        return it;
+    }
+    it.tIn = tIn;
+    it.tOut = tOut;
+
+    float4 P = f4_sub(f4_add(ro, f4_mulvs(rd, tIn)), lo);
+    float4 c = f4_mulvs(P, grid.cellsPerMeter);
+    it.cell.x = i1_clamp((i32)floorf(c.x), 0, grid.size.x - 1);
+    it.cell.y = i1_clamp((i32)floorf(c.y), 0, grid.size.y - 1);
+    it.cell.z = i1_clamp((i32)floorf(c.z), 0, grid.size.z - 1);
+    it.step.x = (rd.x < 0.0f) ? -1 : 1;
+    it.step.y = (rd.y < 0.0f) ? -1 : 1;
+    it.step.z = (rd.z < 0.0f) ? -1 : 1;
+    float4 next = f4_v(
+        (it.cell.x + (it.step.x > 0 ? 1 : 0)) * metersPerCell,
+        (it.cell.y + (it.step.y > 0 ? 1 : 0)) * metersPerCell,
+        (it.cell.z + (it.step.z > 0 ? 1 : 0)) * metersPerCell,
+        0.0f);
+    it.tMax = f4_add(f4_mul(f4_sub(next, P), rcpRd), f4_s(tIn));
+    it.tDelta = f4_abs(f4_mulvs(rcpRd, metersPerCell));
+    return it;
+}
+
+// advances to the next segment, returns false past the end of the ray
+pim_inline bool VEC_CALL Majorant_Next(
+    const PtScene *const pim_noalias scene,
+    MajorantIter *const pim_noalias it)
+{
+    const float globalMfp = scene->mediaDesc.rcpMajorant;
+    while (it->phase < 3)
+    {
+        switch (it->phase)
+        {
+        case 0:
+        {
+            it->phase = 1;
+            if (it->tIn > 0.0f)
+            {
+                it->t0 = 0.0f;
+                it->t1 = it->tIn;
+                it->mfp = globalMfp;
+                return true;
+            }
+        }
+        break;
+        case 1:
+        {
+            if (it->tIn >= it->tOut)
+            {
+                it->phase = 2;
+                break;
+            }
+            const Grid* grid = &scene->majorantGrid;
+            const int3 size = grid->size;
+            const int3 cell = it->cell;
+            it->t0 = it->tIn;
+            it->mfp = scene->majorantMfps[cell.x + cell.y * size.x + cell.z * size.x * size.y];
+            float4 tMax = it->tMax;
+            if ((tMax.x <= tMax.y) && (tMax.x <= tMax.z))
+            {
+                it->t1 = tMax.x;
+                it->cell.x += it->step.x;
+                it->tMax.x += it->tDelta.x;
+                it->phase = ((u32)it->cell.x < (u32)size.x) ? 1 : 2;
+            }
+            else if (tMax.y <= tMax.z)
+            {
+                it->t1 = tMax.y;
+                it->cell.y += it->step.y;
+                it->tMax.y += it->tDelta.y;
+                it->phase = ((u32)it->cell.y < (u32)size.y) ? 1 : 2;
+            }
+            else
+            {
+                it->t1 = tMax.z;
+                it->cell.z += it->step.z;
+                it->tMax.z += it->tDelta.z;
+                it->phase = ((u32)it->cell.z < (u32)size.z) ? 1 : 2;
+            }
+            it->t1 = f1_clamp(it->t1, it->t0, it->tOut);
+            if (it->t1 >= it->tOut)
+            {
+                it->phase = 2;
+            }
+            it->tIn = it->t1;
+            if (it->t1 > it->t0)
+            {
+                return true;
+            }
+        }
+        break;
+        case 2:
+        {
+            it->phase = 3;
+            if (it->tOut < it->rayLen)
+            {
+                it->t0 = it->tOut;
+                it->t1 = it->rayLen;
+                it->mfp = globalMfp;
+                return true;
+            }
+        }
+        break;
+        }
+    }
+    return false;
+}
+
 pim_inline float4 VEC_CALL CalcTransmittance(
     PtSampler *const pim_noalias sampler,
     const PtScene *const pim_noalias scene,
@@ -2073,22 +5351,27 @@ pim_inline float4 VEC_CALL CalcTransmittance(
     float rayLen)
 {
     PtMediaDesc const *const pim_noalias desc = &scene->mediaDesc;
-    const float rcpMaj = desc->rcpMajorant;
-    float t = 0.0f;
+    PtMediaVolume const *const pim_noalias vol = &scene->mediaVolume;
     float4 attenuation = f4_1;
-    while (true)
+    MajorantIter it = Majorant_Begin(scene, ro, rd, rayLen);
+    while (Majorant_Next(scene, &it))
     {
-        float dt = SampleFreePath(Sample1D(sampler), rcpMaj);
-        if ((t + dt) >= rayLen)
+        const float rcpMaj = it.mfp;
+        float t = it.t0;
+        while (true)
         {
-            break;
+            // free paths are memoryless, so restart at each segment
+            t += SampleFreePath(Sample1D(sampler), rcpMaj);
+            if (t >= it.t1)
+            {
+                break;
+            }
+            // ratio tracking
+            // https://jannovak.info/publications/VolumeCourse/novak18monte-sig-slides-4.2-transmittance-notes.pdf#page=7
+            PtMedia media = Media_Sample(desc, vol, f4_add(ro, f4_mulvs(rd, t)));
+            float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
+            attenuation = f4_mul(attenuation, ratio);
         }
-        // ratio tracking
-        // https://jannovak.info/publications/VolumeCourse/novak18monte-sig-slides-4.2-transmittance-notes.pdf#page=7
-        PtMedia media = Media_Sample(desc, f4_add(ro, f4_mulvs(rd, t)));
-        float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
-        attenuation = f4_mul(attenuation, ratio);
-        t += dt;
     }
     return attenuation;
 }
@@ -2105,158 +5388,780 @@ pim_inline PtScatter VEC_CALL ScatterRay(
     result.pdf = 0.0f;
 
     PtMediaDesc const *const pim_noalias desc = &scene->mediaDesc;
-    const float rcpMaj = desc->rcpMajorant;
+    PtMediaVolume const *const pim_noalias vol = &scene->mediaVolume;
 
-    float t = 0.0f;
     result.attenuation = f4_1;
-    while (true)
+    MajorantIter it = Majorant_Begin(scene, ro, rd, rayLen);
+    while (Majorant_Next(scene, &it))
     {
-        float dt = SampleFreePath(Sample1D(sampler), rcpMaj);
-        t += dt;
-        if (t >= rayLen)
+        const float rcpMaj = it.mfp;
+        float t = it.t0;
+        while (true)
         {
-            break;
-        }
-
-        float4 P = f4_add(ro, f4_mulvs(rd, t));
-        PtMedia media = Media_Sample(desc, P);
-        float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
-        result.attenuation = f4_mul(result.attenuation, ratio);
+            // free paths are memoryless, so restart at each segment
+            t += SampleFreePath(Sample1D(sampler), rcpMaj);
+            if (t >= it.t1)
+            {
+                break;
+            }
 
-        float scatterProb = f4_hmax3(media.scattering) * rcpMaj;
-        if (Sample1D(sampler) < scatterProb)
-        {
-            float4 lum;
-            float4 L;
-            if (EvaluateLight(sampler, scene, P, &lum, &L, bounce))
+            // weighted delta tracking, independent of the majorant
+            float4 P = f4_add(ro, f4_mulvs(rd, t));
+            PtMedia media = Media_Sample(desc, vol, P);
+            float maxScattering = f4_hmax3(media.scattering);
+            float scatterProb = f1_sat(maxScattering * rcpMaj);
+            if (Sample1D(sampler) < scatterProb)
             {
-                float ph = CalcPhase(media, f4_dot3(rd, L));
-                lum = f4_mulvs(lum, ph * dt);
-                lum = f4_mul(result.attenuation, lum);
-                result.luminance = lum;
+                float4 albedo = f4_divvs(media.scattering, maxScattering);
+                result.attenuation = f4_mul(result.attenuation, albedo);
+
+                float4 lum;
+                float4 L;
+                if (EvaluateLight(sampler, scene, P, &lum, &L, bounce))
+                {
+                    float ph = CalcPhase(media, f4_dot3(rd, L));
+                    lum = f4_mulvs(lum, ph);
+                    lum = f4_mul(result.attenuation, lum);
+                    result.luminance = lum;
+                }
+
+                result.pos = P;
+                result.dir = SamplePhaseDir(sampler, media, rd);
+                result.pdf = result.dir.w;
+                float ph = CalcPhase(media, f4_dot3(rd, result.dir));
+                result.attenuation = f4_mulvs(result.attenuation, ph);
+                return result;
             }
 
-            result.pos = P;
-            result.dir = SamplePhaseDir(sampler, media, rd);
-            result.pdf = result.dir.w;
-            float ph = CalcPhase(media, f4_dot3(rd, result.dir));
-            result.attenuation = f4_mulvs(result.attenuation, ph);
-            break;
+            // null collision
+            float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
+            ratio = f4_divvs(ratio, 1.0f - scatterProb);
+            result.attenuation = f4_mul(result.attenuation, ratio);
         }
     }
 
     return result;
 }
 
-PtResult VEC_CALL Pt_TraceRay(
-    PtSampler *const pim_noalias sampler,
-    PtScene *const pim_noalias scene,
-    float4 ro,
-    float4 rd)
+// ----------------------------------------------------------------------------
+// radiance cache: a hash grid of the radiance reflected off surfaces,
+// keyed by quantized position and face normal. finished paths fill it
+// and deep paths on rough surfaces are terminated with its estimate.
+
+ProfileMark(pm_updatecache, UpdateCache)
+static void UpdateCache(PtScene *const pim_noalias scene)
 {
-    PtResult result = { 0 };
-    float resultWeight = 0.0f;
-    float4 luminance = f4_0;
-    float4 attenuation = f4_1;
-    u32 prevFlags = 0;
+    ProfileBegin(pm_updatecache);
+    if (ms_cacheBounce > 0)
+    {
+        if (!scene->cache)
+        {
+            scene->cache = Tex_Calloc(sizeof(scene->cache[0]) * kCacheCapacity);
+            scene->cacheMeters = ms_cacheMeters;
+        }
+        if (scene->cacheMeters != ms_cacheMeters)
+        {
+            ClearCache(scene);
+            scene->cacheMeters = ms_cacheMeters;
+        }
+    }
+    else if (scene->cache)
+    {
+        Mem_Free(scene->cache);
+        scene->cache = NULL;
+    }
+    ProfileEnd(pm_updatecache);
+}
+
+static void ClearCache(PtScene *const pim_noalias scene)
+{
+    if (scene->cache)
+    {
+        memset(scene->cache, 0, sizeof(scene->cache[0]) * kCacheCapacity);
+    }
+}
+
+pim_inline u32 VEC_CALL Cache_Hash(const PtScene *const pim_noalias scene, float4 P, float4 N)
+{
+    const float s = 1.0f / scene->cacheMeters;
+    float4 a = f4_abs(N);
+    u32 face = (a.x > a.y) ? ((a.x > a.z) ? 0u : 2u) : ((a.y > a.z) ? 1u : 2u);
+    face = face * 2u + ((f4_get(N, face) < 0.0f) ? 1u : 0u);
+    u32 h = HashU32(face);
+    h = HashU32(h ^ (u32)(i32)floorf(P.x * s));
+    h = HashU32(h ^ (u32)(i32)floorf(P.y * s));
+    h = HashU32(h ^ (u32)(i32)floorf(P.z * s));
+    return h;
+}
+
+pim_inline u32 VEC_CALL Cache_Key(u32 hash)
+{
+    // never 0, which marks an empty cell
+    return HashU32(hash ^ 0x68e31da4u) | 1u;
+}
+
+pim_inline float VEC_CALL F32_FromBits(u32 x)
+{
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+pim_inline u32 VEC_CALL F32_ToBits(float f)
+{
+    u32 x;
+    memcpy(&x, &f, sizeof(x));
+    return x;
+}
 
-    for (i32 b = 0; b < 666; ++b)
+pim_inline void VEC_CALL F32_AtomicAdd(u32 *const pim_noalias atom, float x)
+{
+    u32 prev = load_u32(atom, MO_Relaxed);
+    while (!cmpex_u32(atom, &prev, F32_ToBits(F32_FromBits(prev) + x), MO_Relaxed))
+    {
+    }
+}
+
+pim_inline bool VEC_CALL Cache_Get(
+    const PtScene *const pim_noalias scene,
+    u32 hash,
+    float4 *const pim_noalias radianceOut)
+{
+    PtCacheCell *const pim_noalias cells = scene->cache;
+    const u32 key = Cache_Key(hash);
+    for (u32 i = 0; i < kCacheProbes; ++i)
     {
+        PtCacheCell *const pim_noalias cell = cells + ((hash + i) & (kCacheCapacity - 1));
+        u32 cellKey = load_u32(&cell->key, MO_Relaxed);
+        if (cellKey == key)
         {
-            float p = f1_sat(f4_avglum(attenuation));
-            if (Sample1D(sampler) < p)
+            u32 count = load_u32(&cell->count, MO_Acquire);
+            if (count < kCacheMinSamples)
             {
-                attenuation = f4_divvs(attenuation, p);
+                return false;
             }
-            else
+            float4 sum = f4_v(
+                F32_FromBits(load_u32(&cell->sum[0], MO_Relaxed)),
+                F32_FromBits(load_u32(&cell->sum[1], MO_Relaxed)),
+                F32_FromBits(load_u32(&cell->sum[2], MO_Relaxed)),
+                0.0f);
+            *radianceOut = f4_divvs(sum, (float)count);
+            return true;
+        }
+        if (cellKey == 0)
+        {
+            break;
+        }
+    }
+    return false;
+}
+
+static void Cache_Add(PtScene *const pim_noalias scene, u32 hash, float4 radiance)
+{
+    PtCacheCell *const pim_noalias cells = scene->cache;
+    const u32 key = Cache_Key(hash);
+    for (u32 i = 0; i < kCacheProbes; ++i)
+    {
+        PtCacheCell *const pim_noalias cell = cells + ((hash + i) & (kCacheCapacity - 1));
+        u32 cellKey = load_u32(&cell->key, MO_Relaxed);
+        if (cellKey == 0)
+        {
+            if (cmpex_u32(&cell->key, &cellKey, key, MO_AcqRel))
             {
-                break;
+                cellKey = key;
+            }
+        }
+        if (cellKey == key)
+        {
+            if (load_u32(&cell->count, MO_Relaxed) < kCacheMaxSamples)
+            {
+                F32_AtomicAdd(&cell->sum[0], radiance.x);
+                F32_AtomicAdd(&cell->sum[1], radiance.y);
+                F32_AtomicAdd(&cell->sum[2], radiance.z);
+                inc_u32(&cell->count, MO_Release);
             }
+            return;
         }
+    }
+}
 
-        PtRayHit hit = pt_intersect_local(scene, ro, rd, 0.0f, 1 << 20);
-        if (hit.type == PtHit_Nothing)
+// records a vertex whose reflected radiance is known once the path ends
+pim_inline void VEC_CALL PtPath_CacheRecord(
+    PtPath *const pim_noalias path,
+    u32 hash)
+{
+    if (path->cacheCount < kPtCacheVerts)
+    {
+        PtCacheVert *const pim_noalias vert = &path->cacheVerts[path->cacheCount++];
+        vert->luminance = path->luminance;
+        vert->attenuation = path->attenuation;
+        vert->hash = hash;
+    }
+}
+
+// adds the finished path's recorded vertices to the radiance cache
+static void PtPath_CacheFlush(
+    PtScene *const pim_noalias scene,
+    PtPath *const pim_noalias path)
+{
+    if (!scene->cache)
+    {
+        return;
+    }
+    const float4 luminance = path->luminance;
+    for (i32 i = 0; i < path->cacheCount; ++i)
+    {
+        const PtCacheVert vert = path->cacheVerts[i];
+        if (f4_hmin3(vert.attenuation) > kEpsilon)
         {
-            // TODO: toggle this off for lightmaps, on otherwise.
-            // luminance = f4_add(luminance, f4_mul(attenuation, GetSky(scene, ro, rd)));
-            break;
+            float4 radiance = f4_div(f4_sub(luminance, vert.luminance), vert.attenuation);
+            radiance = f4_max(radiance, f4_0);
+            if (f4_isfinite3(radiance))
+            {
+                Cache_Add(scene, vert.hash, radiance);
+            }
         }
-        if ((hit.type == PtHit_Backface) && !(hit.flags & MatFlag_Refractive))
+    }
+    path->cacheCount = 0;
+}
+
+// ----------------------------------------------------------------------------
+// path guide: a grid of directional quadtrees of incident flux, learned
+// online from finished paths and mixed with brdf sampling when choosing
+// where a path continues.
+// Practical Path Guiding for Efficient Light-Transport Simulation, Muller et al. 2017
+
+// equal area mapping between the unit sphere and the unit square
+pim_inline float2 VEC_CALL Guide_DirToSquare(float4 dir)
+{
+    float cosTheta = f1_clamp(dir.z, -1.0f, 1.0f);
+    float phi = atan2f(dir.y, dir.x);
+    phi = (phi < 0.0f) ? (phi + kTau) : phi;
+    return f2_v(
+        f1_sat((cosTheta + 1.0f) * 0.5f),
+        f1_sat(phi * (1.0f / kTau)));
+}
+
+pim_inline float4 VEC_CALL Guide_SquareToDir(float2 p)
+{
+    float cosTheta = 2.0f * p.x - 1.0f;
+    float sinTheta = sqrtf(f1_max(0.0f, 1.0f - cosTheta * cosTheta));
+    float phi = kTau * p.y;
+    return f4_v(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta, 0.0f);
+}
+
+// quadrant of p, and p rescaled to the quadrant
+pim_inline i32 VEC_CALL Guide_Quadrant(float2* pim_noalias p)
+{
+    i32 qx = (p->x >= 0.5f) ? 1 : 0;
+    i32 qy = (p->y >= 0.5f) ? 1 : 0;
+    p->x = f1_sat(p->x * 2.0f - qx);
+    p->y = f1_sat(p->y * 2.0f - qy);
+    return qx + 2 * qy;
+}
+
+pim_inline float VEC_CALL GuideNode_Total(PtGuideNode const *const pim_noalias node, float sums[4])
+{
+    float total = 0.0f;
+    for (i32 i = 0; i < 4; ++i)
+    {
+        sums[i] = F32_FromBits(node->sum[i]);
+        total += sums[i];
+    }
+    return total;
+}
+
+// solid angle pdf of dir
+pim_inline float VEC_CALL GuideTree_Pdf(PtGuideTree const *const pim_noalias tree, float4 dir)
+{
+    float2 p = Guide_DirToSquare(dir);
+    float pdf = 1.0f / (4.0f * kPi);
+    i32 iNode = 0;
+    do
+    {
+        PtGuideNode const *const pim_noalias node = &tree->nodes[iNode];
+        float sums[4];
+        float total = GuideNode_Total(node, sums);
+        if (total <= 0.0f)
         {
             break;
         }
+        i32 q = Guide_Quadrant(&p);
+        pdf *= 4.0f * sums[q] / total;
+        iNode = node->child[q];
+    } while (iNode != 0);
+    return pdf;
+}
 
+pim_inline float4 VEC_CALL GuideTree_Sample(
+    PtGuideTree const *const pim_noalias tree,
+    float u,
+    float2 Xi,
+    float* pim_noalias pdfOut)
+{
+    float2 lo = f2_0;
+    float size = 1.0f;
+    float pdf = 1.0f / (4.0f * kPi);
+    i32 iNode = 0;
+    do
+    {
+        PtGuideNode const *const pim_noalias node = &tree->nodes[iNode];
+        float sums[4];
+        float total = GuideNode_Total(node, sums);
+        if (total <= 0.0f)
+        {
+            break;
+        }
+        // pick a quadrant, reusing u for the levels below
+        i32 q = 0;
+        float target = u * total;
+        float cdf = 0.0f;
+        for (; q < 3; ++q)
         {
-            PtScatter scatter = ScatterRay(sampler, scene, ro, rd, hit.wuvt.w, b);
-            if (scatter.pdf > kEpsilon)
+            if ((target < cdf + sums[q]) && (sums[q] > 0.0f))
             {
-                luminance = f4_add(luminance, f4_mul(attenuation, scatter.luminance));
-                attenuation = f4_mul(attenuation, f4_divvs(scatter.attenuation, scatter.pdf));
-                {
-                    float4 a = f4_mulvs(attenuation, 1.0f / kTau);
-                    float w = f1_sat(1.0f - f4_avglum(a));
-                    resultWeight += w;
-                    result.albedo = f3_add(result.albedo, f3_mulvs(f4_f3(a), w));
-                    result.normal = f3_add(result.normal, f3_mulvs(f4_f3(f4_neg(rd)), w));
-                }
-                ro = scatter.pos;
-                rd = scatter.dir;
-                prevFlags = 0;
-                continue;
+                break;
             }
-            else
+            cdf += sums[q];
+        }
+        if (sums[q] <= 0.0f)
+        {
+            // rounding error stepped onto an empty quadrant
+            for (q = 3; (q > 0) && (sums[q] <= 0.0f); --q) {}
+            cdf = total - sums[q];
+        }
+        u = f1_sat((target - cdf) / sums[q]);
+        pdf *= 4.0f * sums[q] / total;
+        size *= 0.5f;
+        lo.x += (q & 1) ? size : 0.0f;
+        lo.y += (q & 2) ? size : 0.0f;
+        iNode = node->child[q];
+    } while (iNode != 0);
+    *pdfOut = pdf;
+    return Guide_SquareToDir(f2_add(lo, f2_mulvs(Xi, size)));
+}
+
+static void GuideTree_Add(PtGuideTree *const pim_noalias tree, float4 dir, float flux)
+{
+    float2 p = Guide_DirToSquare(dir);
+    i32 iNode = 0;
+    do
+    {
+        PtGuideNode *const pim_noalias node = &tree->nodes[iNode];
+        i32 q = Guide_Quadrant(&p);
+        F32_AtomicAdd(&node->sum[q], flux);
+        iNode = node->child[q];
+    } while (iNode != 0);
+}
+
+// copies the subtree of src at iSrc into dst, splitting quadrants that
+// hold more than kGuideSplit of the total flux and merging the rest.
+// sums of dst are zeroed for training.
+static void GuideTree_Refine(
+    PtGuideTree const *const pim_noalias src,
+    i32 iSrc,
+    PtGuideTree *const pim_noalias dst,
+    i32 iDst,
+    float fraction)
+{
+    PtGuideNode *const pim_noalias node = &dst->nodes[iDst];
+    memset(node, 0, sizeof(*node));
+    float sums[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float total = (iSrc >= 0) ? GuideNode_Total(&src->nodes[iSrc], sums) : 0.0f;
+    for (i32 q = 0; q < 4; ++q)
+    {
+        float childFraction = (total > 0.0f) ? (fraction * sums[q] / total) : (fraction * 0.25f);
+        if ((childFraction > kGuideSplit) && (dst->nodeCount < kPtGuideNodes))
+        {
+            i32 iChild = dst->nodeCount++;
+            node->child[q] = (u16)iChild;
+            i32 iSrcChild = ((iSrc >= 0) && src->nodes[iSrc].child[q]) ? src->nodes[iSrc].child[q] : -1;
+            GuideTree_Refine(src, iSrcChild, dst, iChild, childFraction);
+        }
+    }
+}
+
+typedef struct task_UpdateGuide
+{
+    Task task;
+    PtScene* scene;
+} task_UpdateGuide;
+
+static void UpdateGuideFn(void* pbase, i32 begin, i32 end)
+{
+    task_UpdateGuide *const pim_noalias task = pbase;
+    PtGuideCell **const pim_noalias cells = task->scene->guideCells;
+    for (i32 i = begin; i < end; ++i)
+    {
+        PtGuideCell *const pim_noalias cell = cells[i];
+        if (!cell || (cell->count < cell->threshold))
+        {
+            continue;
+        }
+        // the training tree becomes the sampling tree
+        cell->sampling = cell->training;
+        cell->ready = true;
+        cell->training.nodeCount = 1;
+        GuideTree_Refine(&cell->sampling, 0, &cell->training, 0, 1.0f);
+        cell->count = 0;
+        cell->threshold = i1_min(cell->threshold * 2, kGuideMaxSamples);
+    }
+}
+
+ProfileMark(pm_updateguide, UpdateGuide)
+static void UpdateGuide(PtScene *const pim_noalias scene)
+{
+    ProfileBegin(pm_updateguide);
+    if (ms_guide)
+    {
+        if (!scene->guideCells && (scene->vertCount > 0))
+        {
+            Box3D bounds = box_from_pts(scene->positions, scene->vertCount);
+            Grid grid;
+            Grid_New(&grid, bounds, 1.0f / ConVar_GetFloat(&cv_pt_guide_meters));
+            scene->guideGrid = grid;
+            scene->guideCells = Perm_Calloc(sizeof(scene->guideCells[0]) * Grid_Len(&grid));
+        }
+        if (scene->guideCells)
+        {
+            task_UpdateGuide *const pim_noalias task = Temp_Calloc(sizeof(*task));
+            task->scene = scene;
+            Task_Run(task, UpdateGuideFn, Grid_Len(&scene->guideGrid));
+        }
+    }
+    else if (scene->guideCells)
+    {
+        ClearGuide(scene);
+        Mem_Free(scene->guideCells);
+        scene->guideCells = NULL;
+    }
+    ProfileEnd(pm_updateguide);
+}
+
+// releases all learned distributions
+static void ClearGuide(PtScene *const pim_noalias scene)
+{
+    PtGuideCell **const pim_noalias cells = scene->guideCells;
+    if (cells)
+    {
+        const i32 len = Grid_Len(&scene->guideGrid);
+        for (i32 i = 0; i < len; ++i)
+        {
+            Mem_Free(cells[i]);
+            cells[i] = NULL;
+        }
+    }
+}
+
+pim_inline PtGuideCell* VEC_CALL Guide_GetCell(PtScene *const pim_noalias scene, float4 P)
+{
+    PtGuideCell *const *const pim_noalias cells = scene->guideCells;
+    if (!cells)
+    {
+        return NULL;
+    }
+    i32 i = Grid_Index(&scene->guideGrid, P);
+    PtGuideCell* cell = LoadPtr(PtGuideCell, cells[i], MO_Acquire);
+    if (!cell)
+    {
+        PtGuideCell* newCell = Perm_Calloc(sizeof(*newCell));
+        newCell->training.nodeCount = 1;
+        newCell->threshold = kGuideMinSamples;
+        PtGuideCell* expected = NULL;
+        if (CmpExPtr(PtGuideCell, scene->guideCells[i], expected, newCell, MO_AcqRel))
+        {
+            cell = newCell;
+        }
+        else
+        {
+            Mem_Free(newCell);
+            cell = expected;
+        }
+    }
+    return cell;
+}
+
+// one sample mixture of brdf and guide sampling, for path continuation
+pim_inline PtScatter VEC_CALL GuidedScatter(
+    PtSampler *const pim_noalias sampler,
+    PtScene *const pim_noalias scene,
+    const PtSurfHit* surf,
+    float4 I,
+    PtGuideCell const *const pim_noalias cell)
+{
+    bool guided = cell && cell->ready &&
+        !(surf->flags & MatFlag_Refractive) &&
+        (surf->roughness >= 0.25f);
+    if (!guided)
+    {
+        return BrdfScatter(sampler, scene, surf, I);
+    }
+
+    PtGuideTree const *const pim_noalias tree = &cell->sampling;
+    if (Sample1D(sampler) < kGuideProb)
+    {
+        PtScatter result = { 0 };
+        result.pos = surf->P;
+        float guidePdf = 0.0f;
+        float u = Sample1D(sampler);
+        float4 L = GuideTree_Sample(tree, u, Sample2D(sampler), &guidePdf);
+        float4 brdf = BrdfEval(sampler, I, surf, L);
+        result.dir = L;
+        result.pdf = kGuideProb * guidePdf + (1.0f - kGuideProb) * brdf.w;
+        brdf.w = 0.0f;
+        result.attenuation = brdf;
+        return result;
+    }
+
+    PtScatter result = BrdfScatter(sampler, scene, surf, I);
+    if (result.pdf > 0.0f)
+    {
+        result.pdf = (1.0f - kGuideProb) * result.pdf + kGuideProb * GuideTree_Pdf(tree, result.dir);
+    }
+    return result;
+}
+
+// records a scattering event whose incident radiance is known once the path ends
+pim_inline void VEC_CALL PtPath_GuideRecord(
+    PtPath *const pim_noalias path,
+    PtGuideCell *const pim_noalias cell,
+    float4 luminance,
+    float4 dir,
+    float pdf)
+{
+    if (cell && (path->guideCount < kPtGuideVerts))
+    {
+        PtGuideVert *const pim_noalias vert = &path->guideVerts[path->guideCount++];
+        vert->luminance = luminance;
+        vert->attenuation = path->attenuation;
+        vert->dir = dir;
+        vert->dir.w = pdf;
+        vert->cell = cell;
+    }
+}
+
+// trains the guide with the finished path's recorded scattering events
+static void PtPath_GuideFlush(PtPath *const pim_noalias path)
+{
+    const float4 luminance = path->luminance;
+    for (i32 i = 0; i < path->guideCount; ++i)
+    {
+        const PtGuideVert vert = path->guideVerts[i];
+        float flux = 0.0f;
+        if ((f4_hmin3(vert.attenuation) > kEpsilon) && (vert.dir.w > kEpsilon))
+        {
+            float4 Li = f4_div(f4_sub(luminance, vert.luminance), vert.attenuation);
+            flux = f1_max(0.0f, f4_avglum(Li)) / vert.dir.w;
+            flux = isfinite(flux) ? flux : 0.0f;
+        }
+        if (flux > 0.0f)
+        {
+            GuideTree_Add(&vert.cell->training, vert.dir, flux);
+        }
+        inc_u32(&vert.cell->count, MO_Relaxed);
+    }
+    path->guideCount = 0;
+}
+
+// spread: ray cone spread angle, 0 to disable texture lod
+pim_inline PtPath VEC_CALL PtPath_New(float4 ro, float4 rd, float spread)
+{
+    PtPath path = { 0 };
+    path.ro = ro;
+    path.rd = rd;
+    path.attenuation = f4_1;
+    path.coneSpread = spread;
+    return path;
+}
+
+// russian roulette; returns false when the path is terminated
+pim_inline bool VEC_CALL PtPath_Roulette(
+    PtSampler *const pim_noalias sampler,
+    PtPath *const pim_noalias path)
+{
+    float p = f1_sat(f4_avglum(path->attenuation));
+    if (Sample1D(sampler) < p)
+    {
+        path->attenuation = f4_divvs(path->attenuation, p);
+        return true;
+    }
+    return false;
+}
+
+// shades the hit found along path->ro, path->rd
+// and selects the next ray of the path.
+// returns false when the path is terminated
+pim_inline bool VEC_CALL PtPath_Shade(
+    PtSampler *const pim_noalias sampler,
+    PtScene *const pim_noalias scene,
+    PtPath *const pim_noalias path,
+    PtRayHit hit,
+    i32 b)
+{
+    const float4 ro = path->ro;
+    const float4 rd = path->rd;
+    float4 luminance = path->luminance;
+    float4 attenuation = path->attenuation;
+    const float coneWidth = path->coneWidth + path->coneSpread * hit.wuvt.w;
+    if (b == 0)
+    {
+        path->depth = (hit.type != PtHit_Nothing) ? hit.wuvt.w : 0.0f;
+    }
+
+    if (hit.type == PtHit_Nothing)
+    {
+        // TODO: toggle this off for lightmaps, on otherwise.
+        // luminance = f4_add(luminance, f4_mul(attenuation, GetSky(scene, ro, rd)));
+        return false;
+    }
+    if ((hit.type == PtHit_Backface) && !(hit.flags & MatFlag_Refractive))
+    {
+        return false;
+    }
+
+    {
+        PtScatter scatter = ScatterRay(sampler, scene, ro, rd, hit.wuvt.w, b);
+        if (scatter.pdf > kEpsilon)
+        {
+            luminance = f4_add(luminance, f4_mul(attenuation, scatter.luminance));
+            attenuation = f4_mul(attenuation, f4_divvs(scatter.attenuation, scatter.pdf));
             {
-                attenuation = f4_mul(attenuation, scatter.attenuation);
+                float4 a = f4_mulvs(attenuation, 1.0f / kTau);
+                float w = f1_sat(1.0f - f4_avglum(a));
+                path->resultWeight += w;
+                path->albedo = f3_add(path->albedo, f3_mulvs(f4_f3(a), w));
+                path->normal = f3_add(path->normal, f3_mulvs(f4_f3(f4_neg(rd)), w));
             }
+            path->coneWidth += path->coneSpread * f4_distance3(ro, scatter.pos);
+            path->coneSpread += kConeSpreadMedia;
+            path->ro = scatter.pos;
+            path->rd = scatter.dir;
+            path->prevFlags = 0;
+            path->luminance = luminance;
+            path->attenuation = attenuation;
+            return true;
         }
-
-        PtSurfHit surf = GetSurface(scene, ro, rd, hit, b);
-        if (b > 0)
+        else
         {
-            LightOnHit(sampler, scene, ro, surf.emission, hit.iVert);
+            attenuation = f4_mul(attenuation, scatter.attenuation);
         }
+    }
+
+    PtSurfHit surf = GetSurface(scene, ro, rd, hit, coneWidth);
+    if (b > 0)
+    {
+        LightOnHit(sampler, scene, ro, surf.emission, hit.iVert);
+    }
+
+    if ((b == 0) || (path->prevFlags & MatFlag_Refractive))
+    {
+        luminance = f4_add(luminance, f4_mul(surf.emission, attenuation));
+    }
+    path->luminance = luminance;
+    path->attenuation = attenuation;
+    if (hit.flags & MatFlag_Sky)
+    {
+        return false;
+    }
 
-        if ((b == 0) || (prevFlags & MatFlag_Refractive))
+    if (scene->cache && ms_cacheBounce > 0)
+    {
+        const u32 hash = Cache_Hash(scene, surf.P, hit.normal);
+        bool cacheable = !(surf.flags & MatFlag_Refractive) && (surf.roughness >= 0.5f);
+        float4 Lr;
+        if (cacheable && (b >= ms_cacheBounce) && Cache_Get(scene, hash, &Lr))
         {
-            luminance = f4_add(luminance, f4_mul(surf.emission, attenuation));
+            path->luminance = f4_add(luminance, f4_mul(Lr, attenuation));
+            return false;
         }
-        if (hit.flags & MatFlag_Sky)
+        if (cacheable)
         {
-            break;
+            PtPath_CacheRecord(path, hash);
         }
+    }
 
-        {
-            float4 Li = EstimateDirect(sampler, scene, &surf, &hit, rd, b);
-            luminance = f4_add(luminance, f4_mul(Li, attenuation));
-        }
+    {
+        float4 Li = EstimateDirect(sampler, scene, &surf, &hit, rd, b);
+        luminance = f4_add(luminance, f4_mul(Li, attenuation));
+        path->luminance = luminance;
+    }
+
+    PtGuideCell *const pim_noalias guideCell = ms_guide ? Guide_GetCell(scene, surf.P) : NULL;
+    PtScatter scatter = GuidedScatter(sampler, scene, &surf, rd, guideCell);
+    if (scatter.pdf < kEpsilon)
+    {
+        return false;
+    }
+
+    attenuation = f4_mul(attenuation, f4_divvs(scatter.attenuation, scatter.pdf));
+    path->ro = scatter.pos;
+    path->rd = scatter.dir;
+    path->attenuation = attenuation;
+    path->prevFlags = surf.flags;
+    // curvature is ignored; rough lobes widen the cone by about alpha radians
+    path->coneWidth = coneWidth;
+    path->coneSpread += surf.roughness * surf.roughness;
+    if (!(surf.flags & MatFlag_Refractive))
+    {
+        PtPath_GuideRecord(path, guideCell, luminance, scatter.dir, scatter.pdf);
+    }
 
-        PtScatter scatter = BrdfScatter(sampler, scene, &surf, rd);
-        if (scatter.pdf < kEpsilon)
+    {
+        float4 a = f4_mulvs(attenuation, 1.0f / kPi);
+        float w = f1_sat(1.0f - f4_avglum(a));
+        path->resultWeight += w;
+        path->albedo = f3_add(path->albedo, f3_mulvs(f4_f3(surf.albedo), w));
+        path->normal = f3_add(path->normal, f3_mulvs(f4_f3(surf.N), w));
+    }
+
+    return true;
+}
+
+pim_inline PtResult VEC_CALL PtPath_Result(PtPath const *const pim_noalias path)
+{
+    PtResult result;
+    float s = 1.0f / f1_max(path->resultWeight, kEpsilon);
+    result.color = f4_f3(path->luminance);
+    result.albedo = f3_mulvs(path->albedo, s);
+    result.depth = path->depth;
+    result.normal = f3_mulvs(path->normal, s);
+    return result;
+}
+
+// traces a path to completion, returns the number of extension rays
+pim_inline i32 VEC_CALL PtPath_Trace(
+    PtSampler *const pim_noalias sampler,
+    PtScene *const pim_noalias scene,
+    PtPath *const pim_noalias path)
+{
+    i32 b = 0;
+    while (b < kMaxBounces)
+    {
+        if (!PtPath_Roulette(sampler, path))
         {
             break;
         }
-        ro = scatter.pos;
-        rd = scatter.dir;
-
-        attenuation = f4_mul(attenuation, f4_divvs(scatter.attenuation, scatter.pdf));
-        prevFlags = surf.flags;
-
+        PtRayHit hit = pt_intersect_local(scene, path->ro, path->rd, 0.0f, 1 << 20);
+        ++b;
+        if (!PtPath_Shade(sampler, scene, path, hit, b - 1))
         {
-            float4 a = f4_mulvs(attenuation, 1.0f / kPi);
-            float w = f1_sat(1.0f - f4_avglum(a));
-            resultWeight += w;
-            result.albedo = f3_add(result.albedo, f3_mulvs(f4_f3(surf.albedo), w));
-            result.normal = f3_add(result.normal, f3_mulvs(f4_f3(surf.N), w));
+            break;
         }
     }
+    PtPath_CacheFlush(scene, path);
+    PtPath_GuideFlush(path);
+    return b;
+}
 
-    {
-        float s = 1.0f / f1_max(resultWeight, kEpsilon);
-        result.color = f4_f3(luminance);
-        result.albedo = f3_mulvs(result.albedo, s);
-        result.normal = f3_mulvs(result.normal, s);
-    }
-    return result;
+PtResult VEC_CALL Pt_TraceRay(
+    PtSampler *const pim_noalias sampler,
+    PtScene *const pim_noalias scene,
+    float4 ro,
+    float4 rd)
+{
+    PtPath path = PtPath_New(ro, rd, 0.0f);
+    PtPath_Trace(sampler, scene, &path);
+    return PtPath_Result(&path);
 }
 
 pim_inline Ray VEC_CALL CalculateDof(
@@ -2305,20 +6210,40 @@ static void UpdateDistsFn(void* pbase, i32 begin, i32 end)
 {
     TaskUpdateDists*const pim_noalias task = pbase;
     PtScene*const pim_noalias scene = task->scene;
-    Dist1D*const pim_noalias dists = scene->lightDists;
+    PtLightCell*const pim_noalias cells = scene->lightCells;
+    PtLightEntry*const pim_noalias entries = scene->lightEntries;
+    // scratch of the largest cell, kept out of the temp arena
+    float*const pim_noalias weights = Tex_Alloc(sizeof(weights[0]) * kLightCellMaxCount);
     for (i32 i = begin; i < end; ++i)
     {
-        Dist1D_Update(&dists[i]);
+        LightCell_Update(cells + i, entries + cells[i].offset, weights);
     }
+    Mem_Free(weights);
 }
 
 ProfileMark(pm_updatedists, UpdateDists)
 static void UpdateDists(PtScene*const pim_noalias scene)
 {
     i32 worklen = Grid_Len(&scene->lightGrid);
-    if (worklen > 0)
+    if ((worklen > 0) && scene->lightTallies)
     {
         ProfileBegin(pm_updatedists);
+
+        // no trace is in flight here, merge the threads' tallies
+        PtLightTally *const pim_noalias tallies = scene->lightTallies;
+        PtLightEntry *const pim_noalias entries = scene->lightEntries;
+        for (i32 i = 0; i < kMaxThreads * kLightTallySlots; ++i)
+        {
+            if (tallies[i].entry > 0)
+            {
+                entries[tallies[i].entry - 1].live += tallies[i].amt;
+                tallies[i].entry = 0;
+                tallies[i].amt = 0;
+            }
+        }
+        // after the merge, tallies index the pool as it was
+        AddLightMisses(scene);
+
         TaskUpdateDists *const pim_noalias task = Temp_Calloc(sizeof(*task));
         task->scene = scene;
         Task_Run(task, UpdateDistsFn, worklen);
@@ -2349,57 +6274,485 @@ typedef struct trace_task_s
     Task task;
     PtTrace* trace;
     Camera camera;
+    // pixel space origins of tiles, in morton order
+    int2* tiles;
+    i32 tileSize;
+    i32 cancel;         // nonzero: skip the remaining tiles, see Pt_TraceCancel
+    bool reproject;
+    u64 start;
+    u64 rayCount;
+    u64 convergedCount;
 } trace_task_t;
 
+pim_inline u32 VEC_CALL Morton2D_Compact(u32 x)
+{
+    x &= 0x55555555u;
+    x = (x ^ (x >> 1)) & 0x33333333u;
+    x = (x ^ (x >> 2)) & 0x0f0f0f0fu;
+    x = (x ^ (x >> 4)) & 0x00ff00ffu;
+    x = (x ^ (x >> 8)) & 0x0000ffffu;
+    return x;
+}
+
+// splits the image into square tiles and orders them along a Z curve,
+// so that each task chunk covers a compact region of the screen
+static int2* NewTileOrder(int2 size, i32 tileSize, i32* countOut)
+{
+    const i32 tilesX = (size.x + tileSize - 1) / tileSize;
+    const i32 tilesY = (size.y + tileSize - 1) / tileSize;
+    const u32 side = NextPow2((u32)i1_max(tilesX, tilesY));
+    int2* tiles = Perm_Alloc(sizeof(tiles[0]) * tilesX * tilesY);
+    i32 count = 0;
+    for (u32 code = 0; code < (side * side); ++code)
+    {
+        i32 x = (i32)Morton2D_Compact(code);
+        i32 y = (i32)Morton2D_Compact(code >> 1);
+        if ((x < tilesX) && (y < tilesY))
+        {
+            tiles[count] = i2_v(x * tileSize, y * tileSize);
+            ++count;
+        }
+    }
+    ASSERT(count == tilesX * tilesY);
+    *countOut = count;
+    return tiles;
+}
+
+// number of pixels within a tile, which may be clipped by the image edge
+pim_inline int2 VEC_CALL GetTileExtent(int2 size, i32 tileSize, int2 tile)
+{
+    return i2_v(
+        i1_min(tileSize, size.x - tile.x),
+        i1_min(tileSize, size.y - tile.y));
+}
+
+pim_inline i32 VEC_CALL GetTilePixel(int2 size, int2 tile, int2 extent, i32 i)
+{
+    i32 x = tile.x + i % extent.x;
+    i32 y = tile.y + i / extent.x;
+    return x + y * size.x;
+}
+
+typedef struct CameraRayGen_s
+{
+    float4 eye;
+    float4 right;
+    float4 up;
+    float4 fwd;
+    float2 slope;
+    float2 rcpSize;
+    int2 size;
+    float spread;   // angle subtended by a pixel
+    PtDofInfo dof;
+} CameraRayGen;
+
+pim_inline CameraRayGen VEC_CALL CameraRayGen_New(
+    PtTrace const *const pim_noalias trace,
+    Camera const *const pim_noalias camera)
+{
+    const int2 size = trace->imageSize;
+    const quat rot = camera->rotation;
+    CameraRayGen gen;
+    gen.eye = camera->position;
+    gen.right = quat_right(rot);
+    gen.up = quat_up(rot);
+    gen.fwd = quat_fwd(rot);
+    gen.slope = proj_slope(f1_radians(camera->fovy), (float)size.x / (float)size.y);
+    gen.rcpSize = f2_rcp(i2_f2(size));
+    gen.size = size;
+    gen.spread = atanf(2.0f * gen.slope.y * gen.rcpSize.y);
+    gen.dof = trace->dofinfo;
+    return gen;
+}
+
+pim_inline Ray VEC_CALL CameraRayGen_Ray(
+    CameraRayGen const *const pim_noalias gen,
+    PtSampler *const pim_noalias sampler,
+    i32 iPixel)
+{
+    const int2 size = gen->size;
+    int2 coord = { iPixel % size.x, iPixel / size.x };
+
+    // gaussian AA filter
+    float2 uv = { (coord.x + 0.5f), (coord.y + 0.5f) };
+    float2 Xi = SampleGaussPixelFilter(Sample2D(sampler));
+    uv = f2_snorm(f2_mul(f2_add(uv, Xi), gen->rcpSize));
+
+    Ray ray = { gen->eye, proj_dir(gen->right, gen->up, gen->fwd, gen->slope, uv) };
+    return CalculateDof(sampler, &gen->dof, gen->right, gen->up, gen->fwd, ray);
+}
+
+// running mean of each pixel, weighted by its own sample count
+pim_inline void VEC_CALL AccumulateResult(
+    PtTrace *const pim_noalias trace,
+    i32 i,
+    PtResult result)
+{
+    const i32 sampleCount = ++trace->sampleCount[i];
+    const float sampleWeight = 1.0f / sampleCount;
+    trace->color[i] = f3_lerpvs(trace->color[i], result.color, sampleWeight);
+    trace->albedo[i] = f3_lerpvs(trace->albedo[i], result.albedo, sampleWeight);
+    trace->normal[i] = f3_lerpvs(trace->normal[i], result.normal, sampleWeight);
+    trace->depth[i] = f1_lerp(trace->depth[i], result.depth, sampleWeight);
+    const float lum = f4_avglum(f3_f4(result.color, 0.0f));
+    trace->moment2[i] = f1_lerp(trace->moment2[i], lum * lum, sampleWeight);
+}
+
+typedef struct PtAdaptive_s
+{
+    float targetError;  // <= 0: adaptive sampling disabled
+    i32 maxSamples;
+    i32 revisit;        // frames between samples of a converged pixel
+    u32 frame;
+} PtAdaptive;
+
+pim_inline PtAdaptive VEC_CALL PtAdaptive_Get(PtTrace const *const pim_noalias trace)
+{
+    PtAdaptive adaptive;
+    adaptive.targetError = ConVar_GetFloat(&cv_pt_adaptive);
+    adaptive.maxSamples = ConVar_GetInt(&cv_pt_adaptive_max);
+    adaptive.revisit = i1_max(1, ConVar_GetInt(&cv_pt_adaptive_revisit));
+    adaptive.frame = trace->frame;
+    return adaptive;
+}
+
+// number of samples to take for a pixel this frame.
+// once the relative standard error of its mean luminance is on target,
+// 0 except for one sample every adaptive.revisit frames, staggered by pixel;
+// a zero variance estimate may just not have found a light path yet.
+pim_inline i32 VEC_CALL GetPixelSampleCount(
+    PtTrace const *const pim_noalias trace,
+    PtAdaptive adaptive,
+    i32 i)
+{
+    const i32 n = trace->sampleCount[i];
+    if ((adaptive.targetError <= 0.0f) || (n < kAdaptiveMinSamples))
+    {
+        return 1;
+    }
+    const float mean = f4_avglum(f3_f4(trace->color[i], 0.0f));
+    const float variance = f1_max(0.0f, trace->moment2[i] - mean * mean);
+    const float error = sqrtf(variance / n) / f1_max(mean, 1e-3f);
+    const float ratio = error / adaptive.targetError;
+    if (ratio <= 1.0f)
+    {
+        return (((u32)i + adaptive.frame) % (u32)adaptive.revisit) ? 0 : 1;
+    }
+    return i1_clamp((i32)ratio, 1, adaptive.maxSamples);
+}
+
 static void TraceFn(void* pbase, i32 begin, i32 end)
 {
     trace_task_t *const pim_noalias task = pbase;
 
     PtTrace *const pim_noalias trace = task->trace;
-    const Camera camera = task->camera;
+    PtScene *const pim_noalias scene = trace->scene;
+    const CameraRayGen gen = CameraRayGen_New(trace, &task->camera);
+
+    const int2 size = gen.size;
+    const i32 tileSize = task->tileSize;
+    int2 const *const pim_noalias tiles = task->tiles;
+
+    const PtAdaptive adaptive = PtAdaptive_Get(trace);
+
+    u64 rayCount = 0;
+    u64 convergedCount = 0;
+    PtSampler sampler = GetSampler();
+    for (i32 iTile = begin; iTile < end; ++iTile)
+    {
+        if (load_i32(&task->cancel, MO_Relaxed))
+        {
+            break;
+        }
+        const int2 tile = tiles[iTile];
+        const int2 extent = GetTileExtent(size, tileSize, tile);
+        const i32 pixelCount = extent.x * extent.y;
+        for (i32 j = 0; j < pixelCount; ++j)
+        {
+            const i32 i = GetTilePixel(size, tile, extent, j);
+            const i32 sampleCount = GetPixelSampleCount(trace, adaptive, i);
+            convergedCount += sampleCount ? 0 : 1;
+            for (i32 k = 0; k < sampleCount; ++k)
+            {
+                StartSample(&sampler, i, trace->sampleCount[i]);
+                Ray ray = CameraRayGen_Ray(&gen, &sampler, i);
+                PtPath path = PtPath_New(ray.ro, ray.rd, gen.spread);
+                rayCount += PtPath_Trace(&sampler, scene, &path);
+                AccumulateResult(trace, i, PtPath_Result(&path));
+            }
+        }
+    }
+    SetSampler(sampler);
+
+    fetch_add_u64(&task->rayCount, rayCount, MO_Relaxed);
+    fetch_add_u64(&task->convergedCount, convergedCount, MO_Relaxed);
+}
+
+pim_inline PtWave *const pim_noalias VEC_CALL GetWave(void)
+{
+    i32 tid = Task_ThreadId();
+    PtWave* wave = ms_waves[tid];
+    if (!wave)
+    {
+        wave = Perm_Calloc(sizeof(*wave));
+        ms_waves[tid] = wave;
+    }
+    return wave;
+}
+
+// wavefront variant of TraceFn:
+// advances kWaveSize paths one bounce at a time,
+// compacting the live paths after each stage so that extension rays
+// can be intersected as coherent 16-wide packets.
+static void TraceWaveFn(void* pbase, i32 begin, i32 end)
+{
+    trace_task_t *const pim_noalias task = pbase;
 
+    PtTrace *const pim_noalias trace = task->trace;
     PtScene *const pim_noalias scene = trace->scene;
-    float3 *const pim_noalias colors = trace->color;
-    float3 *const pim_noalias albedos = trace->albedo;
-    float3 *const pim_noalias normals = trace->normal;
+    const CameraRayGen gen = CameraRayGen_New(trace, &task->camera);
 
-    const int2 size = trace->imageSize;
-    const float2 rcpSize = f2_rcp(i2_f2(size));
-    const float sampleWeight = trace->sampleWeight;
+    const int2 size = gen.size;
+    const i32 tileSize = task->tileSize;
+    int2 const *const pim_noalias tiles = task->tiles;
+
+    PtWave *const pim_noalias wave = GetWave();
+    PtPath *const pim_noalias paths = wave->paths;
+    PtRayHit *const pim_noalias hits = wave->hits;
+    float4 *const pim_noalias ros = wave->ros;
+    float4 *const pim_noalias rds = wave->rds;
+    i32 *const pim_noalias queue = wave->queue;
+    i32 *const pim_noalias pixels = wave->pixels;
+    PtSampler *const pim_noalias samplers = wave->samplers;
 
-    const quat rot = camera.rotation;
-    const float4 eye = camera.position;
-    const float4 right = quat_right(rot);
-    const float4 up = quat_up(rot);
-    const float4 fwd = quat_fwd(rot);
-    const float2 slope = proj_slope(f1_radians(camera.fovy), (float)size.x / (float)size.y);
-    const PtDofInfo dof = trace->dofinfo;
+    const PtAdaptive adaptive = PtAdaptive_Get(trace);
 
+    u64 rayCount = 0;
+    u64 convergedCount = 0;
     PtSampler sampler = GetSampler();
-    for (i32 i = begin; i < end; ++i)
+    i32 iTile = begin;
+    i32 iTilePixel = 0;
+    i32 iPixelSample = 0;
+    i32 pixelSamples = -1; // -1: not yet scheduled
+    while ((iTile < end) && !load_i32(&task->cancel, MO_Relaxed))
     {
-        int2 coord = { i % size.x, i / size.x };
+        // fill the wave with samples of pixels from consecutive tiles.
+        // a pixel may span waves, so its sample count is fixed on first visit.
+        i32 count = 0;
+        while ((count < kWaveSize) && (iTile < end))
+        {
+            const int2 tile = tiles[iTile];
+            const int2 extent = GetTileExtent(size, tileSize, tile);
+            const i32 pixelCount = extent.x * extent.y;
+            while ((count < kWaveSize) && (iTilePixel < pixelCount))
+            {
+                const i32 iPixel = GetTilePixel(size, tile, extent, iTilePixel);
+                if (pixelSamples < 0)
+                {
+                    pixelSamples = GetPixelSampleCount(trace, adaptive, iPixel);
+                    convergedCount += pixelSamples ? 0 : 1;
+                }
+                while ((count < kWaveSize) && (iPixelSample < pixelSamples))
+                {
+                    samplers[count].rng.state = Prng_uint4(&sampler.rng);
+                    StartSample(&samplers[count], iPixel, trace->sampleCount[iPixel] + iPixelSample);
+                    pixels[count] = iPixel;
+                    ++count;
+                    ++iPixelSample;
+                }
+                if (iPixelSample >= pixelSamples)
+                {
+                    ++iTilePixel;
+                    iPixelSample = 0;
+                    pixelSamples = -1;
+                }
+            }
+            if (iTilePixel >= pixelCount)
+            {
+                ++iTile;
+                iTilePixel = 0;
+            }
+        }
+
+        for (i32 i = 0; i < count; ++i)
+        {
+            Ray ray = CameraRayGen_Ray(&gen, &samplers[i], pixels[i]);
+            paths[i] = PtPath_New(ray.ro, ray.rd, gen.spread);
+            queue[i] = i;
+        }
+
+        i32 liveCount = count;
+        for (i32 b = 0; (b < kMaxBounces) && (liveCount > 0); ++b)
+        {
+            i32 liveRays = 0;
+            for (i32 i = 0; i < liveCount; ++i)
+            {
+                const i32 iPath = queue[i];
+                if (PtPath_Roulette(&samplers[iPath], &paths[iPath]))
+                {
+                    float4 ro = paths[iPath].ro;
+                    float4 rd = paths[iPath].rd;
+                    ro.w = 0.0f;
+                    rd.w = 1 << 20;
+                    queue[liveRays] = iPath;
+                    ros[liveRays] = ro;
+                    rds[liveRays] = rd;
+                    ++liveRays;
+                }
+            }
 
-        // gaussian AA filter
-        float2 uv = { (coord.x + 0.5f), (coord.y + 0.5f) };
-        float2 Xi = SampleGaussPixelFilter(Sample2D(&sampler));
-        uv = f2_snorm(f2_mul(f2_add(uv, Xi), rcpSize));
+            for (i32 i = 0; i < liveRays; i += 16)
+            {
+                pt_intersect16_local(scene, ros + i, rds + i, hits + i, i1_min(16, liveRays - i));
+            }
+            rayCount += liveRays;
 
-        Ray ray = { eye, proj_dir(right, up, fwd, slope, uv) };
-        ray = CalculateDof(&sampler, &dof, right, up, fwd, ray);
+            liveCount = 0;
+            for (i32 i = 0; i < liveRays; ++i)
+            {
+                const i32 iPath = queue[i];
+                if (PtPath_Shade(&samplers[iPath], scene, &paths[iPath], hits[i], b))
+                {
+                    queue[liveCount] = iPath;
+                    ++liveCount;
+                }
+            }
+        }
 
-        PtResult result = Pt_TraceRay(&sampler, scene, ray.ro, ray.rd);
-        colors[i] = f3_lerpvs(colors[i], result.color, sampleWeight);
-        albedos[i] = f3_lerpvs(albedos[i], result.albedo, sampleWeight);
-        normals[i] = f3_lerpvs(normals[i], result.normal, sampleWeight);
+        for (i32 i = 0; i < count; ++i)
+        {
+            PtPath_CacheFlush(scene, &paths[i]);
+            PtPath_GuideFlush(&paths[i]);
+            AccumulateResult(trace, pixels[i], PtPath_Result(&paths[i]));
+        }
     }
     SetSampler(sampler);
+
+    fetch_add_u64(&task->rayCount, rayCount, MO_Relaxed);
+    fetch_add_u64(&task->convergedCount, convergedCount, MO_Relaxed);
 }
 
-ProfileMark(pm_trace, Pt_Trace)
-void Pt_Trace(PtTrace* desc, const Camera* camera)
+typedef struct task_Reproject
 {
-    ProfileBegin(pm_trace);
+    Task task;
+    PtTrace* trace;
+    CameraRayGen gen;       // of the current camera, without dof
+    CameraRayGen prevGen;   // of the history's camera
+    i32 maxHistory;
+} task_Reproject;
+
+// merges the history into pixels whose primary hit was visible
+// at the same depth and orientation from the previous camera
+static void ReprojectFn(void* pbase, i32 begin, i32 end)
+{
+    task_Reproject *const pim_noalias task = pbase;
+    PtTrace *const pim_noalias trace = task->trace;
+    const CameraRayGen gen = task->gen;
+    const CameraRayGen prev = task->prevGen;
+    const int2 size = gen.size;
+    const i32 maxHistory = task->maxHistory;
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        const float depth = trace->depth[i];
+        const i32 n = trace->sampleCount[i];
+        if ((depth <= 0.0f) || (n <= 0))
+        {
+            continue;
+        }
+
+        // primary hit through the pixel center
+        int2 coord = { i % size.x, i / size.x };
+        float2 uv = f2_snorm(f2_mul(f2_addvs(i2_f2(coord), 0.5f), gen.rcpSize));
+        float4 rd = proj_dir(gen.right, gen.up, gen.fwd, gen.slope, uv);
+        float4 P = f4_add(gen.eye, f4_mulvs(rd, depth));
+
+        float4 prevRd = f4_sub(P, prev.eye);
+        const float prevDepth = f4_length3(prevRd);
+        prevRd = f4_divvs(prevRd, f1_max(prevDepth, kEpsilon));
+        if (f4_dot3(prevRd, prev.fwd) <= kEpsilon)
+        {
+            continue;
+        }
+        float2 prevUv = unproj_dir(prev.right, prev.up, prev.fwd, prev.slope, prevRd);
+        float2 prevCoordf = f2_mul(f2_unorm(prevUv), i2_f2(size));
+        int2 prevCoord = f2_i2(f2_floor(prevCoordf));
+        if ((prevCoord.x < 0) || (prevCoord.y < 0) || (prevCoord.x >= size.x) || (prevCoord.y >= size.y))
+        {
+            continue;
+        }
+        const i32 j = prevCoord.x + prevCoord.y * size.x;
+        const i32 h = i1_min(trace->histSampleCount[j], maxHistory);
+        if (h <= 0)
+        {
+            continue;
+        }
+
+        // disocclusion: another surface was in front, or a different one
+        if (f1_distance(trace->histDepth[j], prevDepth) > kReprojectDepthTol * prevDepth)
+        {
+            continue;
+        }
+        float4 N = f3_f4(trace->normal[i], 0.0f);
+        float4 prevN = f3_f4(trace->histNormal[j], 0.0f);
+        float NoN = f4_dot3(N, prevN);
+        if (NoN < kReprojectNormalTol * f4_length3(N) * f4_length3(prevN))
+        {
+            continue;
+        }
+
+        const i32 count = n + h;
+        const float w = (float)n / (float)count;
+        trace->color[i] = f3_lerpvs(trace->histColor[j], trace->color[i], w);
+        trace->albedo[i] = f3_lerpvs(trace->histAlbedo[j], trace->albedo[i], w);
+        trace->normal[i] = f3_lerpvs(trace->histNormal[j], trace->normal[i], w);
+        trace->moment2[i] = f1_lerp(trace->histMoment2[j], trace->moment2[i], w);
+        trace->sampleCount[i] = count;
+    }
+}
+
+// swaps the accumulation into the history, for ReprojectFn to read
+static void SwapHistory(PtTrace *const pim_noalias trace)
+{
+    float3* color = trace->color;
+    float3* albedo = trace->albedo;
+    float3* normal = trace->normal;
+    float* moment2 = trace->moment2;
+    i32* sampleCount = trace->sampleCount;
+    float* depth = trace->depth;
+    trace->color = trace->histColor;
+    trace->albedo = trace->histAlbedo;
+    trace->normal = trace->histNormal;
+    trace->moment2 = trace->histMoment2;
+    trace->sampleCount = trace->histSampleCount;
+    trace->depth = trace->histDepth;
+    trace->histColor = color;
+    trace->histAlbedo = albedo;
+    trace->histNormal = normal;
+    trace->histMoment2 = moment2;
+    trace->histSampleCount = sampleCount;
+    trace->histDepth = depth;
+}
+
+ProfileMark(pm_reproject, Reproject)
+static void Reproject(PtTrace *const pim_noalias trace, Camera const *const pim_noalias camera)
+{
+    ProfileBegin(pm_reproject);
+
+    task_Reproject *const pim_noalias task = Temp_Calloc(sizeof(*task));
+    task->trace = trace;
+    task->gen = CameraRayGen_New(trace, camera);
+    task->prevGen = CameraRayGen_New(trace, &trace->camera);
+    task->maxHistory = ConVar_GetInt(&cv_pt_reproject_max);
+    Task_Run(&task->task, ReprojectFn, trace->imageSize.x * trace->imageSize.y);
+
+    ProfileEnd(pm_reproject);
+}
+
+ProfileMark(pm_traceSubmit, Pt_TraceSubmit)
+void Pt_TraceSubmit(PtTrace* desc, const Camera* camera)
+{
+    ProfileBegin(pm_traceSubmit);
 
     ASSERT(desc);
     ASSERT(desc->scene);
@@ -2408,15 +6761,115 @@ void Pt_Trace(PtTrace* desc, const Camera* camera)
     ASSERT(desc->albedo);
     ASSERT(desc->normal);
 
+    // the scene and accumulation may only change between traces
+    Pt_TraceCancel(desc);
+
     DofUpdate(desc, camera);
 
     PtScene_Update(desc->scene);
 
-    trace_task_t *const pim_noalias task = Temp_Calloc(sizeof(*task));
+    trace_task_t *const pim_noalias task = Perm_Calloc(sizeof(*task));
     task->trace = desc;
     task->camera = *camera;
-    const i32 workSize = desc->imageSize.x * desc->imageSize.y;
-    Task_Run(task, TraceFn, workSize);
+    task->tileSize = ConVar_GetInt(&cv_pt_tile_size);
+    i32 tileCount = 0;
+    task->tiles = NewTileOrder(desc->imageSize, task->tileSize, &tileCount);
+
+    const i32 texelCount = desc->imageSize.x * desc->imageSize.y;
+    if (desc->sampleWeight >= 1.0f)
+    {
+        // accumulation restarted; keep it as history when only the camera moved
+        task->reproject = ConVar_GetBool(&cv_pt_reproject) &&
+            (desc->camera.fovy > 0.0f) &&
+            memcmp(&desc->camera, camera, sizeof(*camera));
+        if (task->reproject)
+        {
+            SwapHistory(desc);
+        }
+        memset(desc->sampleCount, 0, sizeof(desc->sampleCount[0]) * texelCount);
+    }
+
+    ++desc->frame;
+    task->start = Time_Now();
+    // tiles run on the workers only, the frame loop keeps its own pace
+    Task_SubmitBackground(task, ConVar_GetBool(&cv_pt_wavefront) ? TraceWaveFn : TraceFn, tileCount);
+    TaskSys_Schedule();
+    desc->job = task;
+
+    ProfileEnd(pm_traceSubmit);
+}
+
+// called once the task of the in flight trace has completed
+static void FinishTrace(PtTrace* desc)
+{
+    trace_task_t *const pim_noalias task = desc->job;
+    ASSERT(Task_Stat(task) == TaskStatus_Complete);
+    desc->job = NULL;
+
+    const i32 texelCount = desc->imageSize.x * desc->imageSize.y;
+    const double seconds = Time_Sec(Time_Now() - task->start);
+    if ((seconds > 0.0) && !task->cancel)
+    {
+        float raysPerSecond = (float)(task->rayCount / seconds);
+        desc->raysPerSecond = f1_lerp(desc->raysPerSecond, raysPerSecond, 0.1f);
+    }
+    desc->convergedFraction = (float)task->convergedCount / texelCount;
+
+    if (task->reproject)
+    {
+        Reproject(desc, &task->camera);
+    }
+    desc->camera = task->camera;
+
+    Mem_Free(task->tiles);
+    Mem_Free(task);
+}
+
+ProfileMark(pm_tracePoll, Pt_TracePoll)
+bool Pt_TracePoll(PtTrace* desc)
+{
+    ASSERT(desc);
+    trace_task_t* task = desc->job;
+    if (task)
+    {
+        if (Task_Stat(task) != TaskStatus_Complete)
+        {
+            return false;
+        }
+        ProfileBegin(pm_tracePoll);
+        FinishTrace(desc);
+        ProfileEnd(pm_tracePoll);
+    }
+    return true;
+}
+
+ProfileMark(pm_traceCancel, Pt_TraceCancel)
+void Pt_TraceCancel(PtTrace* desc)
+{
+    ASSERT(desc);
+    trace_task_t* task = desc->job;
+    if (task)
+    {
+        ProfileBegin(pm_traceCancel);
+        store_i32(&task->cancel, 1, MO_Relaxed);
+        Task_Await(task);
+        FinishTrace(desc);
+        ProfileEnd(pm_traceCancel);
+    }
+}
+
+ProfileMark(pm_trace, Pt_Trace)
+void Pt_Trace(PtTrace* desc, const Camera* camera)
+{
+    ProfileBegin(pm_trace);
+
+    Pt_TraceSubmit(desc, camera);
+    trace_task_t* task = desc->job;
+    if (task)
+    {
+        Task_Await(task);
+        FinishTrace(desc);
+    }
 
     ProfileEnd(pm_trace);
 }
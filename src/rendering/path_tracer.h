@@ -13,12 +13,22 @@ PtSampler VEC_CALL PtSampler_Get(void);
 void VEC_CALL PtSampler_Set(PtSampler sampler);
 float2 VEC_CALL Pt_Sample2D(PtSampler*const pim_noalias sampler);
 float VEC_CALL Pt_Sample1D(PtSampler*const pim_noalias sampler);
+// begins sample 'index' of a pixel or texel, using the sequence chosen by pt_sampler.
+// until then, and after PtSampler_Get, samples are independent randoms.
+void VEC_CALL PtSampler_Start(PtSampler*const pim_noalias sampler, u32 pixel, u32 index);
 
 PtScene* PtScene_New(void);
 void PtScene_Update(PtScene* scene);
 void PtScene_Del(PtScene* scene);
 void PtScene_Gui(PtScene* scene);
 
+typedef struct Crate_s Crate;
+
+// saves the scene's emissives and light grid, keyed by its geometry and materials
+bool PtScene_SaveLights(Crate* crate, PtScene const* scene);
+// holds saved lights until a scene of matching geometry and materials is built
+bool PtScene_LoadLights(Crate* crate);
+
 void PtTrace_New(PtTrace* trace, PtScene* scene, int2 imageSize);
 void PtTrace_Del(PtTrace* trace);
 void PtTrace_Gui(PtTrace* trace);
@@ -41,6 +51,14 @@ PtResult VEC_CALL Pt_TraceRay(
 
 void Pt_Trace(PtTrace* traceDesc, const Camera* camera);
 
+// Pt_Trace split across frames: the submitted trace runs on the worker pool
+// until Pt_TracePoll returns true. trace buffers are in use until then.
+void Pt_TraceSubmit(PtTrace* traceDesc, const Camera* camera);
+// true when no trace is in flight, finishing a completed one
+bool Pt_TracePoll(PtTrace* traceDesc);
+// skips the remaining tiles of the in flight trace and waits for it
+void Pt_TraceCancel(PtTrace* traceDesc);
+
 PtResults Pt_RayGen(
     PtScene*const pim_noalias scene,
     float4 origin,
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "pt_types_public.h"
+#include "rendering/mesh.h"
+#include "rendering/texture.h"
+#include "containers/dict.h"
 
 PIM_C_BEGIN
 
@@ -32,6 +35,83 @@ typedef struct PtScatter_s
     float pdf;
 } PtScatter;
 
+// vertices per path that feed the radiance cache
+#define kPtCacheVerts 3
+
+// path vertex awaiting the radiance reflected back along the path
+typedef struct PtCacheVert_s
+{
+    float4 luminance;   // path luminance on arrival
+    float4 attenuation; // path throughput on arrival
+    u32 hash;           // radiance cache cell
+} PtCacheVert;
+
+// radiance cache cell. sums hold float bits for atomic accumulation
+typedef struct PtCacheCell_s
+{
+    u32 key;            // 0 when empty
+    u32 count;
+    u32 sum[3];
+} PtCacheCell;
+
+// vertices per path that train the path guide
+#define kPtGuideVerts 3
+// nodes per directional quadtree
+#define kPtGuideNodes 64
+
+// node of a directional quadtree over the cylindrical mapping of the
+// sphere. sums hold float bits of each quadrant's flux.
+typedef struct PtGuideNode_s
+{
+    u32 sum[4];
+    u16 child[4];       // 0 for leaf quadrants
+} PtGuideNode;
+
+typedef struct PtGuideTree_s
+{
+    PtGuideNode nodes[kPtGuideNodes];
+    i32 nodeCount;
+} PtGuideTree;
+
+// directional distributions of a path guide cell
+typedef struct PtGuideCell_s
+{
+    PtGuideTree sampling;   // built from the previous training tree
+    PtGuideTree training;   // accumulates flux while tracing
+    u32 count;              // training samples
+    u32 threshold;          // training samples before a rebuild
+    bool ready;             // sampling tree has been built
+} PtGuideCell;
+
+// path vertex awaiting the radiance arriving along its scattered ray
+typedef struct PtGuideVert_s
+{
+    float4 luminance;   // path luminance before scattering
+    float4 attenuation; // path throughput after scattering
+    float4 dir;         // w: pdf of dir
+    PtGuideCell* cell;
+} PtGuideVert;
+
+// integrator state of a single path, between bounces
+typedef struct PtPath_s
+{
+    float4 ro;
+    float4 rd;
+    float4 luminance;
+    float4 attenuation;
+    float3 albedo;
+    float3 normal;
+    float resultWeight;
+    float depth;        // primary hit distance, 0: no hit
+    float coneWidth;    // ray cone width at ro
+    float coneSpread;   // ray cone spread angle
+    u32 prevFlags;
+    i32 cacheCount;
+    i32 guideCount;
+    PtCacheVert cacheVerts[kPtCacheVerts];
+    PtGuideVert guideVerts[kPtGuideVerts];
+} PtPath;
+
 typedef struct PtLightSample_s
 {
     float4 direction;
@@ -62,6 +142,16 @@ typedef struct PtMediaDesc_s
     float phaseBlend;
 } PtMediaDesc;
 
+// media noise density baked over the noise slab of the scene
+typedef struct PtMediaVolume_s
+{
+    Grid grid;
+    // unorm height density at voxel centers
+    // [grid.size]
+    u8* pim_noalias density;
+    u32 hash;           // of the parameters the density was baked from
+} PtMediaVolume;
+
 typedef struct PtMedia_s
 {
     float4 scattering;
@@ -71,11 +161,156 @@ typedef struct PtMedia_s
 
 typedef struct RTCSceneTy* RTCScene;
 
+typedef enum
+{
+    PtLightSelect_Grid = 0, // per cell distributions over visible emissives
+    PtLightSelect_Tree,     // light bvh with orientation cones
+
+    PtLightSelect_COUNT
+} PtLightSelect;
+
+// node of the light tree, leaves hold a single emissive
+typedef struct PtLightNode_s
+{
+    Box3D bounds;
+    float4 axis;        // axis of the cone bounding emitter normals
+    float thetaO;       // half angle of the normal cone
+    float thetaE;       // emission spread beyond thetaO
+    float energy;       // estimated flux of the subtree
+    i32 parent;         // -1 for the root
+    i32 children[2];    // -1 for leaves
+    i32 iEmit;          // leaf emissive, or -1
+} PtLightNode;
+
+// sparse entry of a light grid cell, one per visible emissive.
+// probabilities are quantized to 1/65536 and sum to exactly 1 per cell.
+typedef struct PtLightEntry_s
+{
+    i32 iEmit;          // sorted ascending within a cell
+    u32 live;           // hit counter, merged from PtLightTally by UpdateDists
+    u16 cdf;            // start of this entry's probability range
+    u16 pdf;            // width of the range, minus 1
+    u16 aliasProb;      // alias table threshold
+    u16 alias;          // alias table entry, relative to the cell
+} PtLightEntry;
+
+// a cell's range of the light grid entry pool
+typedef struct PtLightCell_s
+{
+    i32 offset;
+    i32 count;
+    u32 sum;            // live sum of the previous update
+} PtLightCell;
+
+// per thread hit counter of a light entry, see LightOnHit
+typedef struct PtLightTally_s
+{
+    i32 entry;          // index into lightEntries, plus 1. 0: empty
+    u32 amt;
+} PtLightTally;
+
+// per thread hit of an emissive missing from the cell, see LightOnHit
+typedef struct PtLightMiss_s
+{
+    i32 cell;           // index into lightCells, plus 1. 0: empty
+    i32 iEmit;
+    u32 amt;
+} PtLightMiss;
+
+// derived light data of a scene as saved in a map crate.
+// valid for a scene whose flattened geometry and materials hash to 'hash'.
+#define kDiskPtLightsVersion 2
+typedef struct DiskPtLights_s
+{
+    i32 version;
+    i32 triCount;
+    u64 hash;
+    i32 emissiveCount;
+    i32 emitTriCount;
+    i32 entryCount;     // 0 when no light grid was saved
+    i32 alias;          // lightAlias of the grid
+    Grid grid;
+} DiskPtLights;
+
+// loaded DiskPtLights, waiting for a scene to consume it
+typedef struct PtLightBake_s
+{
+    DiskPtLights hdr;
+    i32* pim_noalias triToEmit;
+    i32* pim_noalias emitOffsets;
+    i32* pim_noalias emitTris;
+    float* pim_noalias emitCdfs;
+    float* pim_noalias emitAreas;
+    PtLightCell* pim_noalias cells;
+    PtLightEntry* pim_noalias entries;
+} PtLightBake;
+
+// albedo, rome and normal of a material texel, fetched together
+typedef struct PtTexel_s
+{
+    R8G8B8A8_t albedo;  // srgb (albedo, alpha)
+    R8G8B8A8_t rome;    // srgb (roughness, occlusion, metallic, emission)
+    short2 normal;      // tangent space xy
+} PtTexel;
+
+// a material's textures packed into one mip chain
+typedef struct PtMatTex_s
+{
+    int2 size;          // of mip 0
+    // each mip in morton order, see CoordToMortonPow2
+    // [MipChainLen(size)]
+    PtTexel* pim_noalias texels;
+} PtMatTex;
+
+typedef struct PtEmitCacheKey_s
+{
+    MeshId mesh;
+    TextureId rome;
+    u32 romeGeneration;     // Texture.generation the entry was computed from
+    int2 texSize;           // PtMatTex.size the rome texture was packed at
+} PtEmitCacheKey;
+
+// average emission of each triangle of a mesh under a rome texture
+typedef struct PtEmitCacheEntry_s
+{
+    float* pim_noalias emission;    // [triCount]
+    i32 triCount;
+    u32 build;                      // last scene build that used it
+} PtEmitCacheEntry;
+
+// a mesh welded once and shared by its instances
+typedef struct PtMesh_s
+{
+    RTCScene rtcScene;              // bottom level scene, in object space
+    i32* pim_noalias indices;       // [Mesh.length] welded vertex of each corner
+    i32* pim_noalias corners;       // [vertCount] first corner of each vertex
+    i32 vertCount;
+} PtMesh;
+
+// a drawable placed into the top level rtc scene
+typedef struct PtInstance_s
+{
+    float4x4 matrix;    // local to world, as last committed
+    MeshId mesh;        // key into PtScene.meshes
+    i32 iEntity;        // index into Entities
+    i32 vertBase;       // first welded vertex
+    i32 vertCount;      // welded vertex count
+    i32 indexBase;      // first index; iVert = indexBase + primID * 3
+    bool lightsMoved;   // moved since its emissives were refit, see UpdateLights
+} PtInstance;
+
 typedef struct PtScene_s
 {
+    // top level scene, one instance per PtInstance
     RTCScene rtcScene;
+    // welds and bottom level scenes, shared by instances of the same mesh
+    // MeshId -> PtMesh
+    Dict meshes;
+    // [instCount]
+    PtInstance* pim_noalias instances;
 
     // all geometry within the scene
+    // vertices are welded within each drawable
     // xyz: vertex position
     //   w: 1
     // [vertCount]
@@ -86,21 +321,78 @@ typedef struct PtScene_s
     //  xy: texture coordinate
     // [vertCount]
     float2* pim_noalias uvs;
+    // vertex indices, 3 per triangle
+    // iVert refers to the first index of a triangle
+    // [indexCount]
+    i32* pim_noalias indices;
     // material indices
-    // [vertCount]
+    // [indexCount / 3]
     i32* pim_noalias matIds;
     // emissive index
-    // [vertCount]
-    i32* pim_noalias vertToEmit;
+    // [indexCount / 3]
+    i32* pim_noalias triToEmit;
 
-    // emissive triangle indices
+    // packed texels of each distinct albedo, rome, normal set
+    // [matTexCount]
+    PtMatTex* pim_noalias matTexs;
+    // index into matTexs, -1 when untextured
+    // [matCount]
+    i32* pim_noalias matToTex;
+
+    // emissives are coplanar triangles of one material, sampled by area.
+    // range of each emissive's members in emitTris
+    // [emissiveCount + 1]
+    i32* pim_noalias emitOffsets;
+    // member triangle indices, grouped by emissive
+    // [emitTriCount]
+    i32* pim_noalias emitTris;
+    // fraction of the emissive's area up to and including each member
+    // [emitTriCount]
+    float* pim_noalias emitCdfs;
+    // [emissiveCount]
+    float* pim_noalias emitAreas;
+
+    // light tree, when lightSelect is PtLightSelect_Tree
+    // [lightNodeCount]
+    PtLightNode* pim_noalias lightNodes;
+    // leaf node of each emissive
     // [emissiveCount]
-    i32* pim_noalias emitToVert;
+    i32* pim_noalias lightLeaves;
 
-    // grid of discrete light distributions
+    // grid of sparse discrete light distributions
     Grid lightGrid;
     // [lightGrid.size]
-    Dist1D* pim_noalias lightDists;
+    PtLightCell* pim_noalias lightCells;
+    // pool of all cells' entries
+    // [lightEntryCount]
+    PtLightEntry* pim_noalias lightEntries;
+    // [kMaxThreads][kLightTallySlots] pending hits of each thread
+    PtLightTally* pim_noalias lightTallies;
+    // [kMaxThreads][kLightMissSlots] pending entries to add, see UpdateDists
+    PtLightMiss* pim_noalias lightMisses;
+
+    // baked media density, when pt_media_bake is set
+    PtMediaVolume mediaVolume;
+
+    // mean free path of the local majorant of each cell
+    Grid majorantGrid;
+    // [majorantGrid.size]
+    float* pim_noalias majorantMfps;
+    // media parameters the majorants were built from
+    PtMediaDesc majorantDesc;
+    // hash of the baked volume the majorants were built from, 0: none
+    u32 majorantVolHash;
+
+    // path guide, when pt_guide is set
+    Grid guideGrid;
+    // allocated on first use
+    // [guideGrid.size]
+    PtGuideCell** pim_noalias guideCells;
+
+    // hash grid of reflected radiance, when pt_cache is set
+    // [kCacheCapacity]
+    PtCacheCell* pim_noalias cache;
+    float cacheMeters;
 
     // surface description, indexed by matIds
     // [matCount]
@@ -110,10 +402,22 @@ typedef struct PtScene_s
 
     // array lengths
     i32 vertCount;
+    i32 indexCount;
+    i32 instCount;
     i32 matCount;
+    i32 matTexCount;
     i32 emissiveCount;
+    i32 emitTriCount;
+    i32 lightNodeCount;
+    i32 lightEntryCount;
+    PtLightSelect lightSelect;
+    bool lightAlias;
+    u64 lightsMoved;    // time instances last moved under the lights, 0: current
+    u64 rtcMoved;       // time instances last moved, 0: rtcScene built for tracing
     // parameters
     PtMediaDesc mediaDesc;
+    PtMediaDesc mediaEdit;          // gui copy of mediaDesc, see PtScene_Update
+    char mediaPreset[PIM_PATH];     // pending preset load, see PtScene_Update
     u64 modtime;
 } PtScene;
 
@@ -3,18 +3,30 @@
 #include "common/macro.h"
 #include "math/types.h"
 #include "common/random.h"
+#include "rendering/camera.h"
 
 PIM_C_BEGIN
 
 typedef struct Material_s Material;
-typedef struct Camera_s Camera;
 typedef struct Task_s Task;
 
 typedef struct PtScene_s PtScene;
 
+typedef enum
+{
+    PtSeq_Random = 0,   // independent uniform randoms
+    PtSeq_Sobol,        // owen scrambled sobol, padded per dimension
+
+    PtSeq_COUNT
+} PtSeq;
+
 typedef struct PtSampler_s
 {
     Prng rng;
+    u32 seed;   // per pixel scramble
+    u32 index;  // sample index within the pixel
+    u32 dim;    // next dimension to draw
+    PtSeq seq;
 } PtSampler;
 
 typedef enum
@@ -53,9 +65,24 @@ typedef struct PtTrace_s
     float3* pim_noalias albedo;
     float3* pim_noalias normal;
     float3* pim_noalias denoised;
+    float* pim_noalias moment2;     // running mean of squared luminance
+    i32* pim_noalias sampleCount;   // samples accumulated per pixel
+    float* pim_noalias depth;       // running mean of primary hit distance, 0: no hit
+    // accumulation of the previous camera, reprojected by Pt_Trace
+    float3* pim_noalias histColor;
+    float3* pim_noalias histAlbedo;
+    float3* pim_noalias histNormal;
+    float* pim_noalias histMoment2;
+    i32* pim_noalias histSampleCount;
+    float* pim_noalias histDepth;
+    Camera camera;                  // camera of the accumulation
     int2 imageSize;
-    float sampleWeight;
+    float sampleWeight;             // 1: restarts accumulation
+    float raysPerSecond;            // smoothed extension ray throughput of Pt_Trace
+    float convergedFraction;        // pixels skipped by adaptive sampling last frame
+    u32 frame;                      // traces submitted, staggers adaptive revisits
     PtDofInfo dofinfo;
+    void* job;                      // in flight trace, see Pt_TraceSubmit
 } PtTrace;
 
 typedef struct PtResult_s
@@ -63,6 +90,7 @@ typedef struct PtResult_s
     float3 color;
     float3 albedo;
     float3 normal;
+    float depth;    // primary hit distance, 0: no hit
 } PtResult;
 
 typedef struct PtResults_s
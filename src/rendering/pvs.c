@@ -0,0 +1,149 @@
+#include "rendering/pvs.h"
+#include "allocator/allocator.h"
+#include "assets/crate.h"
+#include "common/guid.h"
+#include "math/float4_funcs.h"
+#include <string.h>
+
+void Pvs_Del(Pvs *const pvs)
+{
+    if (pvs)
+    {
+        Mem_Free(pvs->nodes);
+        Mem_Free(pvs->leafVis);
+        Mem_Free(pvs->vis);
+        memset(pvs, 0, sizeof(*pvs));
+    }
+}
+
+bool Pvs_IsEmpty(Pvs const *const pvs)
+{
+    return !pvs || (pvs->nodeCount <= 0) || (pvs->visLeafCount <= 0);
+}
+
+i32 Pvs_FindLeaf(Pvs const *const pvs, float4 pt)
+{
+    if (Pvs_IsEmpty(pvs))
+    {
+        return 0;
+    }
+    PvsNode const *const pim_noalias nodes = pvs->nodes;
+    const i32 nodeCount = pvs->nodeCount;
+    i32 i = 0;
+    for (i32 depth = 0; (i >= 0) && (depth < nodeCount); ++depth)
+    {
+        if (i >= nodeCount)
+        {
+            return 0;
+        }
+        const float4 plane = nodes[i].plane;
+        const float d = f4_dot3(plane, pt) - plane.w;
+        i = nodes[i].children[(d < 0.0f) ? 1 : 0];
+    }
+    if (i >= 0)
+    {
+        return 0;
+    }
+    const i32 leaf = ~i;
+    return (leaf < pvs->leafCount) ? leaf : 0;
+}
+
+i32 Pvs_RowSize(Pvs const *const pvs)
+{
+    return (pvs->visLeafCount + 7) >> 3;
+}
+
+void Pvs_OrRow(Pvs const *const pvs, i32 leaf, u8 *const pim_noalias row)
+{
+    const i32 rowSize = Pvs_RowSize(pvs);
+    const i32 offset = ((leaf > 0) && (leaf < pvs->leafCount)) ? pvs->leafVis[leaf] : -1;
+    if ((offset < 0) || (offset >= pvs->visSize))
+    {
+        // solid, outside the map or unvised: sees everything
+        memset(row, 0xff, rowSize);
+        return;
+    }
+
+    u8 const *const pim_noalias vis = pvs->vis;
+    const i32 visSize = pvs->visSize;
+    i32 i = offset;
+    i32 j = 0;
+    while ((j < rowSize) && (i < visSize))
+    {
+        const u8 b = vis[i++];
+        if (b)
+        {
+            row[j++] |= b;
+        }
+        else
+        {
+            const i32 zeroes = (i < visSize) ? vis[i++] : rowSize;
+            j += zeroes;
+        }
+    }
+}
+
+bool Pvs_Save(Crate *const crate, Pvs const *const src)
+{
+    if (Pvs_IsEmpty(src))
+    {
+        return true;
+    }
+
+    DiskPvs dpvs = { 0 };
+    dpvs.version = kDiskPvsVersion;
+    dpvs.nodeCount = src->nodeCount;
+    dpvs.leafCount = src->leafCount;
+    dpvs.visLeafCount = src->visLeafCount;
+    dpvs.visSize = src->visSize;
+
+    bool wrote = true;
+    wrote &= Crate_Set(crate,
+        Guid_FromStr("pvs"), &dpvs, sizeof(dpvs));
+    wrote &= Crate_Set(crate,
+        Guid_FromStr("pvs.nodes"), src->nodes, sizeof(src->nodes[0]) * src->nodeCount);
+    wrote &= Crate_Set(crate,
+        Guid_FromStr("pvs.leafVis"), src->leafVis, sizeof(src->leafVis[0]) * src->leafCount);
+    wrote &= Crate_Set(crate,
+        Guid_FromStr("pvs.vis"), src->vis, src->visSize);
+    return wrote;
+}
+
+bool Pvs_Load(Crate *const crate, Pvs *const dst)
+{
+    Pvs_Del(dst);
+
+    DiskPvs dpvs = { 0 };
+    if (!Crate_Get(crate, Guid_FromStr("pvs"), &dpvs, sizeof(dpvs)))
+    {
+        return false;
+    }
+    if ((dpvs.version != kDiskPvsVersion) ||
+        (dpvs.nodeCount <= 0) ||
+        (dpvs.leafCount <= 0) ||
+        (dpvs.visSize <= 0))
+    {
+        return false;
+    }
+
+    dst->nodeCount = dpvs.nodeCount;
+    dst->leafCount = dpvs.leafCount;
+    dst->visLeafCount = dpvs.visLeafCount;
+    dst->visSize = dpvs.visSize;
+    dst->nodes = Perm_Alloc(sizeof(dst->nodes[0]) * dpvs.nodeCount);
+    dst->leafVis = Perm_Alloc(sizeof(dst->leafVis[0]) * dpvs.leafCount);
+    dst->vis = Perm_Alloc(dpvs.visSize);
+
+    bool loaded = true;
+    loaded &= Crate_Get(crate,
+        Guid_FromStr("pvs.nodes"), dst->nodes, sizeof(dst->nodes[0]) * dpvs.nodeCount);
+    loaded &= Crate_Get(crate,
+        Guid_FromStr("pvs.leafVis"), dst->leafVis, sizeof(dst->leafVis[0]) * dpvs.leafCount);
+    loaded &= Crate_Get(crate,
+        Guid_FromStr("pvs.vis"), dst->vis, dpvs.visSize);
+    if (!loaded)
+    {
+        Pvs_Del(dst);
+    }
+    return loaded;
+}
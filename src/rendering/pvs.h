@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common/macro.h"
+#include "math/types.h"
+
+PIM_C_BEGIN
+
+typedef struct Crate_s Crate;
+
+// bsp node, partitions space by its plane
+typedef struct PvsNode_s
+{
+    float4 plane;       // xyz: normal, w: distance
+    i32 children[2];    // [front, back]. >= 0: node index, < 0: ~leaf index
+} PvsNode;
+
+// potentially visible set of a bsp map, in world space.
+// leaf 0 is solid. leafs [1, visLeafCount] may have a row of visibility bits,
+// one per leaf in that range, run length compressed.
+// anything without visibility info is treated as visible.
+typedef struct Pvs_s
+{
+    i32 nodeCount;
+    i32 leafCount;
+    i32 visLeafCount;
+    i32 visSize;
+    PvsNode* pim_noalias nodes;
+    i32* pim_noalias leafVis;   // byte offset of each leaf's row in vis, -1: no row
+    u8* pim_noalias vis;        // zero bytes are followed by their repeat count
+} Pvs;
+
+#define kDiskPvsVersion 1
+typedef struct DiskPvs_s
+{
+    i32 version;
+    i32 nodeCount;
+    i32 leafCount;
+    i32 visLeafCount;
+    i32 visSize;
+} DiskPvs;
+
+void Pvs_Del(Pvs *const pvs);
+
+bool Pvs_IsEmpty(Pvs const *const pvs);
+
+// leaf containing the point, 0: solid or no pvs
+i32 Pvs_FindLeaf(Pvs const *const pvs, float4 pt);
+
+// bytes of a decompressed row, see Pvs_OrRow
+i32 Pvs_RowSize(Pvs const *const pvs);
+
+// ors the leafs potentially visible from leaf into row
+void Pvs_OrRow(Pvs const *const pvs, i32 leaf, u8 *const pim_noalias row);
+
+// whether leaf is set in a row made by Pvs_OrRow
+pim_inline bool Pvs_RowHas(Pvs const *const pvs, u8 const *const pim_noalias row, i32 leaf)
+{
+    if ((leaf <= 0) || (leaf > pvs->visLeafCount))
+    {
+        return true;
+    }
+    const i32 bit = leaf - 1;
+    return (row[bit >> 3] >> (bit & 7)) & 1;
+}
+
+bool Pvs_Save(Crate *const crate, Pvs const *const src);
+bool Pvs_Load(Crate *const crate, Pvs *const dst);
+
+PIM_C_END
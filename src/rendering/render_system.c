@@ -76,16 +76,27 @@ static cmdstat_t CmdSaveMap(i32 argc, const char** argv);
 
 // ----------------------------------------------------------------------------
 
+#define kDynResHoldSeconds 0.25  // full resolution resumes after this long still
+#define kDynResMinScale 0.25f
+#define kDynResSteps 16.0f
+#define kTraceStallFrames 4.0   // a trace this many frames long must span frames
+
 static FrameBuf ms_buffers[1];
+
 static i32 ms_iFrame;
 
 static Camera ms_ptcam;
 static PtScene* ms_ptscene;
 static PtTrace ms_trace;
+// reduced resolution trace of dynamic resolution
+static PtTrace ms_lowTrace;
+static float ms_dynScale = kDynResMinScale;
+static u64 ms_lastMove;
 
 static i32 ms_lmSampleCount;
 static i32 ms_acSampleCount;
 static i32 ms_ptSampleCount;
+static i32 ms_lowSampleCount;
 static i32 ms_cmapSampleCount;
 
 // ----------------------------------------------------------------------------
@@ -149,13 +160,33 @@ static void EnsurePtTrace(void)
     }
 }
 
+// size: quantized fraction of the framebuffer, see PathTrace
+static void EnsurePtLowTrace(int2 size)
+{
+    EnsurePtScene();
+
+    bool dirty = false;
+    dirty |= !ms_lowTrace.color;
+    dirty |= ms_lowTrace.imageSize.x != size.x;
+    dirty |= ms_lowTrace.imageSize.y != size.y;
+    if (dirty)
+    {
+        PtTrace_Del(&ms_lowTrace);
+        PtTrace_New(&ms_lowTrace, ms_ptscene, size);
+        ms_lowSampleCount = 0;
+    }
+    ms_lowTrace.dofinfo = ms_trace.dofinfo;
+}
+
 static void ShutdownPtScene(void)
 {
     if (ms_ptscene)
     {
+        // cancels any trace still in flight against the scene
+        PtTrace_Del(&ms_trace);
+        PtTrace_Del(&ms_lowTrace);
         PtScene_Del(ms_ptscene);
         ms_ptscene = NULL;
-        PtTrace_Del(&ms_trace);
     }
 }
 
@@ -173,6 +204,13 @@ static void LightmapRepack(void)
     *LmPack_Get() = pack;
 }
 
+// waits out any path trace in flight, so the scene may be updated
+static void CancelPtTraces(void)
+{
+    Pt_TraceCancel(&ms_trace);
+    Pt_TraceCancel(&ms_lowTrace);
+}
+
 ProfileMark(pm_Lightmap_Trace, Lightmap_Trace)
 static void Lightmap_Trace(void)
 {
@@ -190,6 +228,7 @@ static void Lightmap_Trace(void)
 
         float timeslice = 1.0f / ConVar_GetInt(&cv_lm_timeslice);
         i32 spp = ConVar_GetInt(&cv_lm_spp);
+        CancelPtTraces();
         LmPack_Bake(ms_ptscene, timeslice, spp);
 
         static u64 s_lastUpload;
@@ -270,89 +309,273 @@ static void TaskBlitNormalFn(void* pbase, i32 begin, i32 end)
     }
 }
 
+typedef struct TaskUpscale_s
+{
+    Task task;
+    const float3* pim_noalias src;
+    const float3* pim_noalias albedo;
+    const float3* pim_noalias normal;
+    float4* pim_noalias dst;
+    int2 srcSize;
+    int2 dstSize;
+    bool unorm;
+} TaskUpscale;
+
+// bilinear upscale whose taps are weighted by their albedo and normal
+// similarity to the nearest source texel, so edges stay sharp
+static void TaskUpscaleFn(void* pbase, i32 begin, i32 end)
+{
+    TaskUpscale* task = pbase;
+    const float3* pim_noalias src = task->src;
+    const float3* pim_noalias albedo = task->albedo;
+    const float3* pim_noalias normal = task->normal;
+    float4* pim_noalias dst = task->dst;
+    const int2 srcSize = task->srcSize;
+    const int2 dstSize = task->dstSize;
+    const float2 scale = f2_div(i2_f2(srcSize), i2_f2(dstSize));
+    const int2 hi = i2_addvs(srcSize, -1);
+    for (i32 i = begin; i < end; ++i)
+    {
+        int2 coord = { i % dstSize.x, i / dstSize.x };
+        float2 srcf = f2_subvs(f2_mul(f2_addvs(i2_f2(coord), 0.5f), scale), 0.5f);
+        float2 lo = f2_floor(srcf);
+        float2 frac = f2_sub(srcf, lo);
+        int2 a = f2_i2(lo);
+        int2 near = i2_clamp(f2_i2(f2_floor(f2_addvs(srcf, 0.5f))), i2_0, hi);
+        i32 iNear = near.x + near.y * srcSize.x;
+        float3 refAlbedo = albedo[iNear];
+        float3 refNormal = f3_normalize(normal[iNear]);
+
+        float3 sum = f3_0;
+        float weights = 0.0f;
+        for (i32 j = 0; j < 4; ++j)
+        {
+            int2 tap = i2_clamp(i2_v(a.x + (j & 1), a.y + (j >> 1)), i2_0, hi);
+            i32 k = tap.x + tap.y * srcSize.x;
+            float wx = (j & 1) ? frac.x : 1.0f - frac.x;
+            float wy = (j >> 1) ? frac.y : 1.0f - frac.y;
+            float wn = f1_sat(f3_dot(f3_normalize(normal[k]), refNormal));
+            wn *= wn;
+            wn *= wn;
+            float wa = 1.0f / (1.0f + 16.0f * f3_distancesq(albedo[k], refAlbedo));
+            float w = wx * wy * wn * wa;
+            sum = f3_add(sum, f3_mulvs(src[k], w));
+            weights += w;
+        }
+        float3 value = (weights > kEpsilon) ? f3_divvs(sum, weights) : src[iNear];
+        float4 result = f3_f4(value, 1.0f);
+        dst[i] = task->unorm ? f4_unorm(result) : result;
+    }
+}
+
+// steers the dynamic resolution scale toward the budget,
+// once per completed trace that was sized by it
+static void DynResMeasure(double traceMs)
+{
+    float budget = ConVar_GetFloat(&cv_pt_dynres_ms);
+    // cost scales with pixel count, the square of the scale
+    float ratio = sqrtf(budget / (float)pim_max(traceMs, 1e-3));
+    ratio = f1_clamp(ratio, 0.8f, 1.25f);
+    ms_dynScale = f1_clamp(ms_dynScale * ratio, kDynResMinScale, 1.0f);
+}
+
+// internal resolution of dynamic resolution, in steps to limit reallocation
+static int2 DynResSize(int2 fullSize)
+{
+    float steps = f1_round(ms_dynScale * kDynResSteps) / kDynResSteps;
+    int2 size;
+    size.x = i1_max(1, (i32)(fullSize.x * steps));
+    size.y = i1_max(1, (i32)(fullSize.y * steps));
+    return size;
+}
+
 ProfileMark(pm_PathTrace, PathTrace)
 ProfileMark(pm_ptBlit, Blit)
+// presents the completed accumulation of trace to the front buffer
+static void PresentTrace(PtTrace* trace)
+{
+    const int2 size = trace->imageSize;
+    const i32 texCount = size.x * size.y;
+
+    float3* pim_noalias output3 = trace->color;
+    if (ConVar_GetBool(&cv_pt_denoise))
+    {
+        bool denoised = Denoise(
+            DenoiseType_Image,
+            size,
+            trace->color,
+            trace->albedo,
+            trace->normal,
+            trace->denoised);
+
+        if (!denoised)
+        {
+            ConVar_SetBool(&cv_pt_denoise, false);
+        }
+        else
+        {
+            output3 = trace->denoised;
+        }
+    }
+
+    ProfileBegin(pm_ptBlit);
+
+    bool unorm = false;
+    if (ConVar_GetBool(&cv_pt_albedo))
+    {
+        output3 = trace->albedo;
+    }
+    if (ConVar_GetBool(&cv_pt_normal))
+    {
+        output3 = trace->normal;
+        unorm = true;
+    }
+
+    if (trace != &ms_trace)
+    {
+        FrameBuf* buf = GetFrontBuf();
+        TaskUpscale* task = Temp_Calloc(sizeof(*task));
+        task->src = output3;
+        task->albedo = trace->albedo;
+        task->normal = trace->normal;
+        task->dst = buf->light;
+        task->srcSize = size;
+        task->dstSize = ms_trace.imageSize;
+        task->unorm = unorm;
+        Task_Run(task, TaskUpscaleFn, task->dstSize.x * task->dstSize.y);
+    }
+    else
+    {
+        TaskBlit* task = Temp_Calloc(sizeof(*task));
+        task->src = output3;
+        task->dst = GetFrontBuf()->light;
+        Task_Run(task, unorm ? TaskBlitNormalFn : TaskBlitFn, texCount);
+    }
+
+    ProfileEnd(pm_ptBlit);
+}
+
+// traces run on the worker pool across frames.
+// the front buffer holds the latest completed accumulation until the next one finishes.
 static bool PathTrace(void)
 {
     static u64 s_lap;
+    static u64 s_submit;
+    static u32 s_submitFrame;
+    static bool s_stallWarned;
 
     if (ConVar_GetBool(&cv_pt_trace))
     {
         ProfileBegin(pm_PathTrace);
         EnsurePtTrace();
 
+        bool restart = false;
         {
             Camera camera;
             Camera_Get(&camera);
 
-            bool dirty = false;
-            dirty |= ConVar_CheckDirty(&cv_pt_trace, Time_Lap(&s_lap));
-            dirty |= memcmp(&camera, &ms_ptcam, sizeof(camera));
+            bool dirty = ConVar_CheckDirty(&cv_pt_trace, Time_Lap(&s_lap));
+            bool moved = memcmp(&camera, &ms_ptcam, sizeof(camera)) != 0;
+            restart = dirty && !moved;
 
-            if (dirty)
+            if (dirty || moved)
             {
                 ms_ptcam = camera;
                 ms_ptSampleCount = 0;
+                ms_lowSampleCount = 0;
+            }
+            if (moved)
+            {
+                ms_lastMove = Time_Now();
             }
         }
 
-        ms_trace.sampleWeight = 1.0f / ++ms_ptSampleCount;
-        const int2 size = ms_trace.imageSize;
-        const i32 texCount = size.x * size.y;
-        Pt_Trace(&ms_trace, &ms_ptcam);
-
-        float3* pim_noalias output3 = ms_trace.color;
-        if (ConVar_GetBool(&cv_pt_denoise))
+        // while the camera moves, trace a smaller image within the time budget
+        // and upscale it; the full resolution trace resumes once it stops.
+        // motion starts at the minimum scale, and a scale that reaches full
+        // resolution keeps tracing into the full trace and its reprojection.
+        PtTrace* trace = &ms_trace;
+        PtTrace* other = &ms_lowTrace;
+        i32* sampleCount = &ms_ptSampleCount;
+        const bool moving = Time_Sec(Time_Now() - ms_lastMove) < kDynResHoldSeconds;
+        const bool dynres = ConVar_GetBool(&cv_pt_dynres) && moving;
+        if (dynres)
         {
-            bool denoised = Denoise(
-                DenoiseType_Image,
-                size,
-                ms_trace.color,
-                ms_trace.albedo,
-                ms_trace.normal,
-                ms_trace.denoised);
-
-            if (!denoised)
+            // a low resolution trace in flight keeps its size,
+            // resizing it would cancel the trace
+            const int2 fullSize = ms_trace.imageSize;
+            const int2 lowSize = ms_lowTrace.job ? ms_lowTrace.imageSize : DynResSize(fullSize);
+            if ((lowSize.x < fullSize.x) || (lowSize.y < fullSize.y))
             {
-                ConVar_SetBool(&cv_pt_denoise, false);
-            }
-            else
-            {
-                output3 = ms_trace.denoised;
+                EnsurePtLowTrace(lowSize);
+                trace = &ms_lowTrace;
+                other = &ms_trace;
+                sampleCount = &ms_lowSampleCount;
             }
         }
+        else
+        {
+            ms_dynScale = kDynResMinScale;
+        }
 
+        // a moving camera lets the in flight trace finish and be presented,
+        // its successor restarts accumulation. anything else cancels it.
+        Pt_TraceCancel(other);
+        if (restart)
         {
-            ProfileBegin(pm_ptBlit);
+            Pt_TraceCancel(trace);
+        }
+        if (trace == &ms_trace)
+        {
+            // the low resolution buffers are only needed while moving
+            PtTrace_Del(&ms_lowTrace);
+            ms_lowSampleCount = 0;
+        }
 
-            if (ConVar_GetBool(&cv_pt_albedo))
-            {
-                output3 = ms_trace.albedo;
-            }
-            if (ConVar_GetBool(&cv_pt_normal))
+        const bool inFlight = trace->job != NULL;
+        if (Pt_TracePoll(trace))
+        {
+            bool resized = false;
+            if (inFlight && !restart)
             {
-                TaskBlit* task = Temp_Calloc(sizeof(*task));
-                task->src = ms_trace.normal;
-                task->dst = GetFrontBuf()->light;
-                Task_Run(task, TaskBlitNormalFn, texCount);
-
-                output3 = NULL;
+                // traces run off the main thread, so frames keep their
+                // pace and a long trace spans many of them. one that
+                // finished within a single frame stretched that frame.
+                const double frameSec = pim_max(
+                    1.0 / ConVar_GetInt(&cv_r_fpslimit), Time_SmoothDeltaf());
+                const double traceSec = Time_Sec(Time_Now() - s_submit);
+                const u32 frames = Time_FrameCount() - s_submitFrame;
+                if (!s_stallWarned && (frames <= 1) &&
+                    (traceSec > kTraceStallFrames * frameSec))
+                {
+                    s_stallWarned = true;
+                    Con_Logf(LogSev_Warning, "pt", "Frame loop stalled on a %.1fms trace", traceSec * 1000.0);
+                }
+                if (dynres)
+                {
+                    // a new size waits for the next frame, between traces
+                    DynResMeasure(Time_Milli(Time_Now() - s_submit));
+                    const int2 size = DynResSize(ms_trace.imageSize);
+                    resized = (size.x != trace->imageSize.x) || (size.y != trace->imageSize.y);
+                }
+                PresentTrace(trace);
             }
 
-            if (output3)
+            if (!resized)
             {
-                TaskBlit* task = Temp_Calloc(sizeof(*task));
-                task->src = output3;
-                task->dst = GetFrontBuf()->light;
-                Task_Run(task, TaskBlitFn, texCount);
+                trace->sampleWeight = 1.0f / ++(*sampleCount);
+                Pt_TraceSubmit(trace, &ms_ptcam);
+                // stamped after the synchronous scene update inside the submit
+                s_submit = Time_Now();
+                s_submitFrame = Time_FrameCount();
             }
-
-            ProfileEnd(pm_ptBlit);
         }
 
         ProfileEnd(pm_PathTrace);
         return true;
     }
+
+    CancelPtTraces();
     return false;
 }
 
@@ -1387,6 +1610,7 @@ static float CalcStdDev(const float3* pim_noalias color, int2 size)
 
 static cmdstat_t CmdPtStdDev(i32 argc, const char** argv)
 {
+    Pt_TraceCancel(&ms_trace);
     const float3* color = ms_trace.color;
     int2 size = ms_trace.imageSize;
     if (color)
@@ -1467,6 +1691,8 @@ static cmdstat_t CmdLoadMap(i32 argc, const char** argv)
         loaded = true;
         loaded &= Entities_Load(crate, Entities_Get());
         loaded &= LmPack_Load(crate, LmPack_Get());
+        // optional, rebuilt by the path tracer when missing or outdated
+        PtScene_LoadLights(crate);
         loaded &= Crate_Close(crate);
     }
 
@@ -1518,6 +1744,8 @@ static cmdstat_t CmdSaveMap(i32 argc, const char** argv)
         saved = true;
         saved &= Entities_Save(crate, Entities_Get());
         saved &= LmPack_Save(crate, LmPack_Get());
+        CancelPtTraces();
+        saved &= PtScene_SaveLights(crate, ms_ptscene);
         saved &= Crate_Close(crate);
     }
 
@@ -139,6 +139,35 @@ pim_inline i32 VEC_CALL WrapPow2(int2 size, int2 coord)
     return CoordToIndex(size, WrapCoordPow2(size, coord));
 }
 
+// ----------------------------------------------------------------------------
+// morton (z-order) layout of pow2 textures: square blocks of the shorter
+// side in z-order, placed one after another along the longer side.
+// neighboring texels in x and y are usually within one cache line.
+
+pim_inline u32 VEC_CALL MortonSpread(u32 x)
+{
+    x &= 0xffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+// coord: within size
+pim_inline i32 VEC_CALL CoordToMortonPow2(int2 size, int2 coord)
+{
+    const i32 side = i1_min(size.x, size.y);
+    const i32 mask = side - 1;
+    u32 index = MortonSpread(coord.x & mask) | (MortonSpread(coord.y & mask) << 1);
+    i32 block = (size.x > size.y) ? (coord.x / side) : (coord.y / side);
+    return (i32)index + block * side * side;
+}
+pim_inline i32 VEC_CALL WrapMortonPow2(int2 size, int2 coord)
+{
+    return CoordToMortonPow2(size, WrapCoordPow2(size, coord));
+}
+
 pim_inline i32 VEC_CALL UvClamp(int2 size, float2 uv)
 {
     return Clamp(size, UvToCoord(size, uv));
@@ -327,6 +356,18 @@ pim_inline bilinear_t VEC_CALL BilinearWrapPow2(int2 size, float2 uv)
     b.d = WrapPow2(size, i2_v(a.x + 1, a.y + 1));
     return b;
 }
+pim_inline bilinear_t VEC_CALL BilinearWrapMortonPow2(int2 size, float2 uv)
+{
+    bilinear_t b;
+    float2 coordf = UvToCoordf(size, uv);
+    b.frac = f2_frac(coordf);
+    int2 a = f2_i2(coordf);
+    b.a = WrapMortonPow2(size, a);
+    b.b = WrapMortonPow2(size, i2_v(a.x + 1, a.y + 0));
+    b.c = WrapMortonPow2(size, i2_v(a.x + 0, a.y + 1));
+    b.d = WrapMortonPow2(size, i2_v(a.x + 1, a.y + 1));
+    return b;
+}
 
 // ----------------------------------------------------------------------------
 
@@ -182,6 +182,7 @@ bool Texture_Upload(TextureId id)
         i32 height = tex->size.y;
         i32 bytes = (width * height * vkrFormatToBpp(tex->format)) / 8;
         uploaded = vkrTexTable_Upload(tex->slot, 0, tex->texels, bytes);
+        ++tex->generation;
     }
     ProfileEnd(pm_upload);
     return uploaded;
@@ -28,6 +28,7 @@ typedef struct Texture_s
     void* pim_noalias texels;
     VkFormat format;
     vkrTextureId slot;
+    u32 generation;     // bumped when Texture_Upload changes the texels
 } Texture;
 
 #define kTextureVersion 5
@@ -32,32 +32,38 @@ static pim_thread_local i32 ms_tid;
 
 // ----------------------------------------------------------------------------
 
-static bool ExecuteTask(Task* task)
+// runs one granule, returns false once the task has none left to hand out
+static bool ExecuteGranule(Task* task)
 {
-    if (task)
+    const i32 wsize = task->worksize;
+    const i32 gran = i1_max(1, wsize / ms_worksplit);
+
+    const i32 a = fetch_add_i32(&task->head, gran, MO_AcqRel);
+    const i32 b = i1_min(a + gran, wsize);
+    if (a >= b)
     {
-        const i32 wsize = task->worksize;
-        const i32 gran = i1_max(1, wsize / ms_worksplit);
-        const TaskExecuteFn fn = task->execute;
+        return false;
+    }
 
-        i32 a = fetch_add_i32(&task->head, gran, MO_AcqRel);
-        i32 b = i1_min(a + gran, wsize);
-        while (a < b)
-        {
-            fn(task, a, b);
+    task->execute(task, a, b);
 
-            const i32 count = b - a;
-            const i32 prev = fetch_add_i32(&task->tail, count, MO_AcqRel);
-            ASSERT(prev < wsize);
-            if ((prev + count) >= wsize)
-            {
-                store_i32(&task->status, TaskStatus_Complete, MO_Release);
-                Event_WakeAll(&ms_waitDone);
-                break;
-            }
-            a = fetch_add_i32(&task->head, gran, MO_AcqRel);
-            b = i1_min(a + gran, wsize);
-        }
+    const i32 count = b - a;
+    const i32 prev = fetch_add_i32(&task->tail, count, MO_AcqRel);
+    ASSERT(prev < wsize);
+    if ((prev + count) >= wsize)
+    {
+        store_i32(&task->status, TaskStatus_Complete, MO_Release);
+        Event_WakeAll(&ms_waitDone);
+        return false;
+    }
+    return true;
+}
+
+static bool ExecuteTask(Task* task)
+{
+    if (task)
+    {
+        while (ExecuteGranule(task)) {}
     }
     return task != NULL;
 }
@@ -65,6 +71,29 @@ static bool ExecuteTask(Task* task)
 static bool TryRunTask(i32 tid)
 {
     Task* task = PtrQueue_TryPop(&ms_queues[tid]);
+    if (task && load_i32(&task->background, MO_Acquire))
+    {
+        if (ms_tid == 0)
+        {
+            // the main thread drains worker queues at the end of the frame,
+            // hand background work back instead of blocking the frame on it.
+            if ((Task_Stat(task) == TaskStatus_Complete) ||
+                PtrQueue_TryPush(&ms_queues[tid], task))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // one granule at a time, then behind whatever was queued meanwhile,
+            // so foreground tasks are not left to the main thread alone
+            if (ExecuteGranule(task) && !PtrQueue_TryPush(&ms_queues[tid], task))
+            {
+                ExecuteTask(task);
+            }
+            return true;
+        }
+    }
     return ExecuteTask(task);
 }
 
@@ -110,7 +139,7 @@ TaskStatus Task_Stat(const void* pbase)
     return (TaskStatus)load_i32(&task->status, MO_Acquire);
 }
 
-void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
+static void SubmitTask(void* pbase, TaskExecuteFn execute, i32 worksize, bool background)
 {
     ASSERT(execute);
     Task *const task = pbase;
@@ -123,11 +152,16 @@ void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
         store_i32(&task->head, 0, MO_Release);
         store_i32(&task->tail, 0, MO_Release);
 
+        // without workers the main thread has to run it regardless
+        const i32 numthreads = ms_numthreads;
+        background = background && (numthreads > 1);
+        store_i32(&task->background, background, MO_Release);
+        const i32 first = background ? 1 : 0;
+
         bool anyFull = false;
         bool resubmit[kMaxThreads] = { 0 };
 
-        const i32 numthreads = ms_numthreads;
-        for (i32 t = 0; t < numthreads; ++t)
+        for (i32 t = first; t < numthreads; ++t)
         {
             bool full = !PtrQueue_TryPush(&ms_queues[t], task);
             anyFull |= full;
@@ -138,7 +172,7 @@ void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
         {
             anyFull = false;
             TaskSys_Schedule();
-            for (i32 t = 0; t < numthreads; ++t)
+            for (i32 t = first; t < numthreads; ++t)
             {
                 if (resubmit[t])
                 {
@@ -152,6 +186,16 @@ void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
     }
 }
 
+void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
+{
+    SubmitTask(pbase, execute, worksize, false);
+}
+
+void Task_SubmitBackground(void* pbase, TaskExecuteFn execute, i32 worksize)
+{
+    SubmitTask(pbase, execute, worksize, true);
+}
+
 ProfileMark(pm_exec, Task_Exec);
 ProfileMark(pm_await, Task_Wait);
 void Task_Await(void* pbase)
@@ -255,11 +299,16 @@ void TaskSys_EndFrame(void)
 {
     ProfileBegin(pm_endframe);
 
-    // clear out backlog, in case a queue piles up
+    // clear out backlog, in case a queue piles up.
+    // background tasks go back into their queue, so visit each entry once.
     const i32 numthreads = ms_numthreads;
     for (i32 tid = 0; tid < numthreads; ++tid)
     {
-        while (TryRunTask(tid)) {}
+        const u32 count = PtrQueue_Size(&ms_queues[tid]);
+        for (u32 i = 0; i < count; ++i)
+        {
+            TryRunTask(tid);
+        }
     }
 
     ProfileEnd(pm_endframe);
@@ -20,12 +20,15 @@ typedef struct Task_s
     i32 worksize;
     i32 head;
     i32 tail;
+    i32 background;
 } Task;
 
 i32 Task_ThreadId(void);
 i32 Task_ThreadCount(void);
 
 void Task_Submit(void* task, TaskExecuteFn execute, i32 worksize);
+// only worker threads pick it up, the main thread just awaits it
+void Task_SubmitBackground(void* task, TaskExecuteFn execute, i32 worksize);
 TaskStatus Task_Stat(const void* task);
 void Task_Await(void* task);
 